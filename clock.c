@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           aarch64 and Alpha boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,69 +9,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <sys/times.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
- * are set by GCC when it calls the C preprocessor
+ * Note: the constants __i386__, __x86_64__, __aarch64__ and
+ * __alpha are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
-/*******************************************************
- * Pentium versions of start_counter() and get_counter()
- *******************************************************/
-
-
-/* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
-{
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
-}
-
-/* Record the current value of the cycle counter. */
-void start_counter()
-{
-    access_counter(&cyc_hi, &cyc_lo);
-}
-
-/* Return the number of cycles since the last call to start_counter. */
-double get_counter()
-{
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
-}
-/* $end x86cyclecounter */
-
-#elif defined(__alpha)
+#if defined(__alpha)
 
 /****************************************************
  * Alpha versions of start_counter() and get_counter()
@@ -136,27 +90,27 @@ double get_counter()
 #else
 
 /****************************************************************
- * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * Everywhere else start_counter() and get_counter() read the tick
+ * counter of clock.h: the time stamp counter on x86 and x86-64, the
+ * virtual counter on aarch64, and TICK_CLOCK in nanoseconds on the
+ * rest. The "cycles" they return are ticks of that counter, and
+ * mhz() measures its rate, so fcyc and fsecs work on any of them.
  ***************************************************************/
 
+static uint64_t cyc_start = 0;
+
+/* Record the current value of the counter */
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    if (ticks_rdtscp < 0)
+	ticks_probe();	/* not inside the first timed stretch */
+    cyc_start = ticks_begin();
 }
 
-double get_counter() 
+/* Return the number of ticks since the last call to start_counter */
+double get_counter()
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(ticks_end() - cyc_start);
 }
 #endif
 
@@ -166,6 +120,7 @@ double get_counter()
 /*******************************
  * Machine-independent functions
  ******************************/
+
 double ovhd()
 {
     /* Do it twice to eliminate cache effects */
@@ -181,24 +136,41 @@ double ovhd()
 
 /* $begin mhz */
 /* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
+/* while sleeping for sleeptime seconds, timed by TICK_CLOCK */
 double mhz_full(int verbose, int sleeptime)
 {
-    double rate;
+    struct timespec t0, t1;
+    double rate, cycles;
 
+    clock_gettime(TICK_CLOCK, &t0);
     start_counter();
     sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+    cycles = get_counter();
+    clock_gettime(TICK_CLOCK, &t1);
+    rate = cycles / ((t1.tv_sec - t0.tv_sec) * 1e6 +
+		     (t1.tv_nsec - t0.tv_nsec) / 1e3);
     if (verbose) 
 	printf("Processor clock rate ~= %.1f MHz\n", rate);
     return rate;
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* Version using a default sleeptime. Where get_counter reads the tick
+   counter, the short calibration of ticks_hz does as well. */
 double mhz(int verbose)
 {
+#if defined(__alpha)
     return mhz_full(verbose, 2);
+#else
+    double rate = ticks_hz() / 1e6;
+
+    if (verbose) {
+	printf("Processor clock rate ~= %.1f MHz\n", rate);
+	if (!ticks_invariant())
+	    printf("Warning: the counter is not invariant, so times may drift with the clock speed\n");
+    }
+    return rate;
+#endif
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -277,3 +249,105 @@ double get_comp_counter()
     return ctime;
 }
 
+
+/** Tick counter for timing single calls */
+
+#define TICK_CAL_NS   20000000  /* calibrate ticks_hz over 20 ms */
+#define TICK_OVHD_N       1001  /* back-to-back reads for ticks_ovhd */
+#define PAIR_TRIES           5  /* tries at reading counter and clock together */
+
+static int cmp_ticks(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Read the counter and TICK_CLOCK (in ns) as nearly at once as can
+   be: of a few tries, the one whose counter reads on either side of
+   the clock read are closest, with the counter taken halfway */
+static void clock_pair(uint64_t *ticks, double *ns)
+{
+    struct timespec ts;
+    uint64_t c0, c1, best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < PAIR_TRIES; i++) {
+	c0 = ticks_begin();
+	clock_gettime(TICK_CLOCK, &ts);
+	c1 = ticks_end();
+	if (c1 - c0 < best) {
+	    best = c1 - c0;
+	    *ticks = c0 + (c1 - c0) / 2;
+	    *ns = ts.tv_sec * 1e9 + ts.tv_nsec;
+	}
+    }
+}
+
+/* Count the ticks that elapse over TICK_CAL_NS of TICK_CLOCK */
+double ticks_hz(void)
+{
+    static double hz = 0;
+    uint64_t c0 = 0, c1 = 0;
+    double ns0 = 0, ns1 = 0;
+
+    if (hz == 0) {
+	clock_pair(&c0, &ns0);
+	do {
+	    clock_pair(&c1, &ns1);
+	} while (ns1 - ns0 < TICK_CAL_NS);
+	hz = (c1 - c0) / ((ns1 - ns0) / 1e9);
+    }
+    return hz;
+}
+
+/* Median of TICK_OVHD_N back-to-back pairs, so a stray interrupt does
+   not count */
+double ticks_ovhd(void)
+{
+    static double ovh = -1;
+    uint64_t d[TICK_OVHD_N], t0;
+    int i;
+
+    if (ovh < 0) {
+	for (i = 0; i < TICK_OVHD_N; i++) {
+	    t0 = read_ticks();
+	    d[i] = read_ticks() - t0;
+	}
+	qsort(d, TICK_OVHD_N, sizeof(uint64_t), cmp_ticks);
+	ovh = d[TICK_OVHD_N / 2];
+    }
+    return ovh;
+}
+
+int ticks_rdtscp = -1;
+
+/* CPUID leaf 0x80000001 has RDTSCP in bit 27 of EDX. Some hypervisors
+   mask it, and executing it there raises SIGILL. */
+void ticks_probe(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+
+    ticks_rdtscp = __get_cpuid(0x80000001, &a, &b, &c, &d) != 0
+	&& ((d >> 27) & 1);
+#else
+    ticks_rdtscp = 0;
+#endif
+}
+
+/* CPUID leaf 0x80000007 has the invariant TSC in bit 8 of EDX. The
+   aarch64 generic timer runs at a fixed rate by definition, and so
+   does the clock read_ticks falls back on. */
+int ticks_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+
+    if (__get_cpuid(0x80000007, &a, &b, &c, &d) == 0)
+	return 0;
+    return (d >> 8) & 1;
+#else
+    return 1;
+#endif
+}
@@ -20,3 +20,93 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+/** Tick counter for timing single calls */
+
+#include <stdint.h>
+#include <time.h>
+
+/* The clock the counter is calibrated against (and stands in for
+   where there is none): free of NTP slewing where the OS has one */
+#ifdef CLOCK_MONOTONIC_RAW
+#define TICK_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define TICK_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* Read a free-running counter: the time stamp counter on x86, the
+   virtual counter on aarch64, else TICK_CLOCK in nanoseconds */
+static inline uint64_t read_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    asm volatile("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(TICK_CLOCK, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* 1 if the CPU has RDTSCP, 0 if not, -1 until ticks_probe has looked
+   (ticks_end calls it the first time) */
+extern int ticks_rdtscp;
+void ticks_probe(void);
+
+/* read_ticks fenced for timing a stretch of code: ticks_begin waits
+   for the code before it to finish and keeps the code after it from
+   starting early, and ticks_end waits for the timed code and keeps
+   what follows from starting before the read */
+static inline uint64_t ticks_begin(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) :: "memory");
+    return (uint64_t)hi << 32 | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    asm volatile("isb; mrs %0, cntvct_el0; isb" : "=r" (v) :: "memory");
+    return v;
+#else
+    return read_ticks();
+#endif
+}
+
+static inline uint64_t ticks_end(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    if (ticks_rdtscp < 0)
+	ticks_probe();
+    if (ticks_rdtscp)
+	asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi) :: "ecx", "memory");
+    else
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) :: "memory");
+    return (uint64_t)hi << 32 | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    asm volatile("isb; mrs %0, cntvct_el0; isb" : "=r" (v) :: "memory");
+    return v;
+#else
+    return read_ticks();
+#endif
+}
+
+/* Ticks of read_ticks per second */
+double ticks_hz(void);
+
+/* Ticks between two back-to-back read_ticks (the median of many) */
+double ticks_ovhd(void);
+
+/* Nonzero if the counter ticks at a constant rate whatever the core's
+   frequency and power state (the invariant TSC on x86) */
+int ticks_invariant(void);
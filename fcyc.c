@@ -8,6 +8,7 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -98,11 +99,11 @@ static int has_converged()
 }
 
 /* 
- * clear - Code to clear cache 
+ * fcyc_clear - Code to clear cache 
  */
 static volatile int sink = 0;
 
-static void clear()
+void fcyc_clear(void)
 {
     int x = sink;
     int *cptr, *cend;
@@ -113,6 +114,8 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages would all read the one zero page */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -134,7 +137,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		fcyc_clear();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
@@ -144,7 +147,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		fcyc_clear();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
@@ -13,6 +13,11 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Evict the test's data from the cache by reading a buffer of the
+   cache size, as fcyc does before each sample with clear_cache set.
+   The other timers call it too. */
+void fcyc_clear(void);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
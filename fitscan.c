@@ -0,0 +1,143 @@
+/*
+ * fitscan.c - scalar, SSE2 and AVX2 searches of a packed size array
+ *
+ * The vector kernels compare a whole vector of sizes against key-1 at
+ * once, fold the lanes into a bit mask with movemask and take the
+ * lowest set bit. They are compiled with per-function target
+ * attributes, so the rest of the driver needs no extra flags, and
+ * fit_scan picks one at run time from what the CPU supports.
+ */
+#include <stdlib.h>
+
+#include "fitscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FIT_X86 1
+#include <immintrin.h>
+#endif
+
+/* Vector kernels hand arrays shorter than this to the scalar loop */
+#define FIT_VECTOR_MIN 16
+
+static fit_scan_fn best;    /* kernel fit_scan uses, chosen on first call */
+
+/*
+ * scan_tail - Scalar scan of sizes[i..n)
+ */
+static size_t scan_tail(const uint32_t *sizes, size_t i, size_t n,
+			uint32_t key)
+{
+    for (; i < n; i++)
+	if (sizes[i] >= key)
+	    return i;
+    return n;
+}
+
+static size_t fit_scan_scalar(const uint32_t *sizes, size_t n, uint32_t key)
+{
+    return scan_tail(sizes, 0, n, key);
+}
+
+#ifdef FIT_X86
+/*
+ * fit_scan_sse2 - Four sizes per compare, sixteen per loop iteration
+ */
+__attribute__((target("sse2")))
+static size_t fit_scan_sse2(const uint32_t *sizes, size_t n, uint32_t key)
+{
+    __m128i k = _mm_set1_epi32((int)key - 1);
+    size_t i;
+    int m0, m1, m2, m3;
+
+    if (n < FIT_VECTOR_MIN)
+	return scan_tail(sizes, 0, n, key);
+    for (i = 0; i + 16 <= n; i += 16) {
+	const __m128i *v = (const __m128i *)(sizes + i);
+	m0 = _mm_movemask_ps(_mm_castsi128_ps(
+		 _mm_cmpgt_epi32(_mm_loadu_si128(v), k)));
+	m1 = _mm_movemask_ps(_mm_castsi128_ps(
+		 _mm_cmpgt_epi32(_mm_loadu_si128(v + 1), k)));
+	m2 = _mm_movemask_ps(_mm_castsi128_ps(
+		 _mm_cmpgt_epi32(_mm_loadu_si128(v + 2), k)));
+	m3 = _mm_movemask_ps(_mm_castsi128_ps(
+		 _mm_cmpgt_epi32(_mm_loadu_si128(v + 3), k)));
+	if (m0 | m1 | m2 | m3)
+	    return i + __builtin_ctz(m0 | m1 << 4 | m2 << 8 | m3 << 12);
+    }
+    return scan_tail(sizes, i, n, key);
+}
+
+/*
+ * fit_scan_avx2 - Eight sizes per compare, thirty-two per loop iteration
+ */
+__attribute__((target("avx2")))
+static size_t fit_scan_avx2(const uint32_t *sizes, size_t n, uint32_t key)
+{
+    __m256i k = _mm256_set1_epi32((int)key - 1);
+    size_t i;
+    unsigned m0, m1, m2, m3;
+
+    if (n < FIT_VECTOR_MIN)
+	return scan_tail(sizes, 0, n, key);
+    for (i = 0; i + 32 <= n; i += 32) {
+	const __m256i *v = (const __m256i *)(sizes + i);
+	m0 = _mm256_movemask_ps(_mm256_castsi256_ps(
+		 _mm256_cmpgt_epi32(_mm256_loadu_si256(v), k)));
+	m1 = _mm256_movemask_ps(_mm256_castsi256_ps(
+		 _mm256_cmpgt_epi32(_mm256_loadu_si256(v + 1), k)));
+	m2 = _mm256_movemask_ps(_mm256_castsi256_ps(
+		 _mm256_cmpgt_epi32(_mm256_loadu_si256(v + 2), k)));
+	m3 = _mm256_movemask_ps(_mm256_castsi256_ps(
+		 _mm256_cmpgt_epi32(_mm256_loadu_si256(v + 3), k)));
+	if (m0 | m1 | m2 | m3)
+	    return i + __builtin_ctz(m0 | m1 << 8 | m2 << 16 | m3 << 24);
+    }
+    for (; i + 8 <= n; i += 8) {
+	m0 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(
+		 _mm256_loadu_si256((const __m256i *)(sizes + i)), k)));
+	if (m0)
+	    return i + __builtin_ctz(m0);
+    }
+    return scan_tail(sizes, i, n, key);
+}
+#endif /* FIT_X86 */
+
+/*
+ * fit_scan_kernel - Look up a kernel, checking that the CPU can run it
+ */
+fit_scan_fn fit_scan_kernel(int kind)
+{
+    switch (kind) {
+    case FIT_SCALAR:
+	return fit_scan_scalar;
+#ifdef FIT_X86
+    case FIT_SSE2:
+	return __builtin_cpu_supports("sse2") ? fit_scan_sse2 : NULL;
+    case FIT_AVX2:
+	return __builtin_cpu_supports("avx2") ? fit_scan_avx2 : NULL;
+#endif
+    default:
+	return NULL;
+    }
+}
+
+const char *fit_scan_name(int kind)
+{
+    static const char *names[FIT_KERNELS] = {"scalar", "sse2", "avx2"};
+
+    return (kind >= 0 && kind < FIT_KERNELS) ? names[kind] : "none";
+}
+
+/*
+ * fit_scan - Dispatch to the fastest kernel. The choice is made once;
+ *     every later call is a single indirect call.
+ */
+size_t fit_scan(const uint32_t *sizes, size_t n, uint32_t key)
+{
+    int kind;
+
+    if (best == NULL)
+	for (kind = FIT_KERNELS - 1; best == NULL; kind--)
+	    best = fit_scan_kernel(kind);
+    return best(sizes, n, key);
+}
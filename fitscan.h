@@ -0,0 +1,28 @@
+/*
+ * fitscan.h - find the first entry >= a key in a packed array of sizes
+ *
+ * The free index in mm.c keeps the sizes of its free blocks in a dense
+ * uint32_t array, so a fit search is a linear scan that the hardware
+ * prefetches instead of a pointer chase through the heap. Sizes and
+ * keys must be below 2^31, since the vector kernels compare signed.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Index of the first sizes[i] >= key, or n if there is none */
+typedef size_t (*fit_scan_fn)(const uint32_t *sizes, size_t n, uint32_t key);
+
+/* Kernels, from slowest to fastest */
+#define FIT_SCALAR 0
+#define FIT_SSE2   1
+#define FIT_AVX2   2
+#define FIT_KERNELS 3
+
+/* The kernel of that kind, or NULL if this build or CPU lacks it */
+fit_scan_fn fit_scan_kernel(int kind);
+
+/* Name of a kernel kind, for reports */
+const char *fit_scan_name(int kind);
+
+/* Scan with the fastest kernel available */
+size_t fit_scan(const uint32_t *sizes, size_t n, uint32_t key);
@@ -8,7 +8,13 @@
 #include "ftimer.h"
 #include "config.h"
 
+/* Cache cleared by fcyc_clear: more than the last level of a
+   current CPU, read a 64-byte line at a time */
+#define FSECS_CACHE_BYTES (1<<25)
+#define FSECS_CACHE_BLOCK 64
+
 static double Mhz;  /* estimated CPU clock frequency */
+static int ftimer_clear = 0; /* what set_fsecs_clear_cache told ftimer */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -18,6 +24,8 @@ extern int verbose; /* -v option in mdriver.c */
 void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
+    set_fcyc_cache_size(FSECS_CACHE_BYTES);
+    set_fcyc_cache_block(FSECS_CACHE_BLOCK);
 
 #if USE_FCYC
     if (verbose)
@@ -54,4 +62,42 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
+/*
+ * set_fsecs_clear_cache - Clear the cache before each run that fsecs
+ * times, with whichever timer it uses
+ */
+void set_fsecs_clear_cache(int clear)
+{
+    set_fcyc_clear_cache(clear);
+    set_ftimer_clear_cache(clear);
+    ftimer_clear = clear;
+}
 
+/*
+ * fsecs_sample - Return the running time of one run of f (in seconds),
+ * cold if the cache is cleared first
+ */
+double fsecs_sample(fsecs_test_funct f, void *argp, int cold)
+{
+#if USE_FCYC
+    double cycles;
+
+    if (cold)
+	fcyc_clear();
+    start_counter();
+    f(argp);
+    cycles = get_counter();
+    return cycles/(Mhz*1e6);
+#else
+    double secs;
+
+    set_ftimer_clear_cache(cold);
+#if USE_ITIMER
+    secs = ftimer_itimer(f, argp, 1);
+#else
+    secs = ftimer_gettod(f, argp, 1);
+#endif
+    set_ftimer_clear_cache(ftimer_clear);
+    return secs;
+#endif
+}
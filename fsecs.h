@@ -2,3 +2,9 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Clear the cache before each timed run of f, whatever the timer */
+void set_fsecs_clear_cache(int clear);
+
+/* Time one run of f (in seconds), after clearing the cache if cold */
+double fsecs_sample(fsecs_test_funct f, void *argp, int cold);
@@ -11,11 +11,14 @@
 #include <stdio.h>
 #include <sys/time.h>
 #include "ftimer.h"
+#include "fcyc.h"
 
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
 
+static int clear_cache = 0; /* clear the cache before each run */
+
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
  * of f(argp). Return the average of n runs.  
@@ -26,6 +29,16 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n)
     int i;
 
     init_etime();
+    if (clear_cache) {
+	tmeas = 0;
+	for (i = 0; i < n; i++) {
+	    fcyc_clear();
+	    start = get_etime();
+	    f(argp);
+	    tmeas += get_etime() - start;
+	}
+	return tmeas / n;
+    }
     start = get_etime();
     for (i = 0; i < n; i++) 
 	f(argp);
@@ -43,6 +56,17 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     struct timeval stv, etv;
     double diff;
 
+    if (clear_cache) {
+	diff = 0;
+	for (i = 0; i < n; i++) {
+	    fcyc_clear();
+	    gettimeofday(&stv, NULL);
+	    f(argp);
+	    gettimeofday(&etv,NULL);
+	    diff += 1E3*(etv.tv_sec - stv.tv_sec) + 1E-3*(etv.tv_usec-stv.tv_usec);
+	}
+	return (1E-3*diff/n);
+    }
     gettimeofday(&stv, NULL);
     for (i = 0; i < n; i++) 
 	f(argp);
@@ -52,6 +76,15 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/* 
+ * set_ftimer_clear_cache - When set, clear the cache before each of
+ * the n runs and time the runs one at a time, leaving the clearing out
+ */
+void set_ftimer_clear_cache(int clear)
+{
+    clear_cache = clear;
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
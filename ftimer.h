@@ -12,3 +12,6 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* When set, clear the cache (fcyc_clear) before each run, outside
+   the timed part. Default = 0 */
+void set_ftimer_clear_cache(int clear);
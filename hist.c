@@ -0,0 +1,72 @@
+/*
+ * hist.c - log-linear latency histograms
+ *
+ * Bucket i < 2*HIST_SUB holds the value i. Above that, bucket
+ * (shift+1)*HIST_SUB + k holds the values whose top HIST_SUB_BITS+1
+ * bits are HIST_SUB + k after shifting right by shift.
+ */
+#include <string.h>
+
+#include "hist.h"
+
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+uint64_t hist_bucket_high(int i)
+{
+    int shift;
+
+    if (i < 2 * HIST_SUB)
+	return i;
+    shift = i / HIST_SUB - 1;
+    return (((uint64_t)(i % HIST_SUB + HIST_SUB) + 1) << shift) - 1;
+}
+
+uint64_t hist_quantile(const hist_t *h, double q)
+{
+    uint64_t want, seen = 0, v;
+    int i;
+
+    if (h->count == 0)
+	return 0;
+    want = (uint64_t)(q * h->count + 0.5);
+    if (want < 1)
+	want = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->bucket[i];
+	if (seen >= want)
+	    break;
+    }
+    v = hist_bucket_high(i);
+    return v < h->max ? v : h->max;
+}
+
+void hist_dump(const hist_t *h, FILE *f, double scale)
+{
+    uint64_t seen = 0, v;
+    double p;
+    int i;
+
+    fprintf(f, "%12s %14s %10s %14s\n",
+	    "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (i = 0; i < HIST_BUCKETS && seen < h->count; i++) {
+	if (h->bucket[i] == 0)
+	    continue;
+	seen += h->bucket[i];
+	v = hist_bucket_high(i);
+	if (v > h->max)
+	    v = h->max;
+	p = (double)seen / h->count;
+	if (p < 1)
+	    fprintf(f, "%12.3f %14.12f %10lu %14.2f\n", v * scale, p,
+		    (unsigned long)seen, 1 / (1 - p));
+	else
+	    fprintf(f, "%12.3f %14.12f %10lu %14s\n", v * scale, p,
+		    (unsigned long)seen, "inf");
+    }
+    fprintf(f, "#[Mean = %.3f, Max = %.3f, Total count = %lu]\n",
+	    h->count ? h->sum / h->count * scale : 0.0, h->max * scale,
+	    (unsigned long)h->count);
+}
@@ -0,0 +1,57 @@
+/*
+ * hist.h - log-linear latency histograms
+ *
+ * Values below 2*HIST_SUB are counted exactly; above that, every power
+ * of two is split into HIST_SUB equal buckets, so a value is known to
+ * within 1/HIST_SUB of itself however large it is (the HdrHistogram
+ * layout). Recording is a few shifts and an increment, and a histogram
+ * is a fixed array that covers every 64-bit value.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)          /* buckets per octave */
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;      /* values recorded */
+    uint64_t max;        /* largest of them, exactly */
+    double sum;          /* their sum, for the mean */
+    uint64_t bucket[HIST_BUCKETS];
+} hist_t;
+
+/* Empty the histogram */
+void hist_reset(hist_t *h);
+
+/* Bucket of value v */
+static inline int hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < 2 * HIST_SUB)
+	return (int)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+/* Count one value */
+static inline void hist_record(hist_t *h, uint64_t v)
+{
+    h->bucket[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+	h->max = v;
+}
+
+/* Largest value that falls in bucket i */
+uint64_t hist_bucket_high(int i);
+
+/* Value at or below which the fraction q of the values lie, as the
+   top of its bucket (never above the max); 0 if the histogram is empty */
+uint64_t hist_quantile(const hist_t *h, double q);
+
+/* Write the percentile distribution to f, one line per nonempty
+   bucket: value (times scale), percentile, count so far, 1/(1-p) */
+void hist_dump(const hist_t *h, FILE *f, double scale);
@@ -7,17 +7,39 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <getopt.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
 
 #include "mm.h"
+#include "region.h"
+#include "pool.h"
+#include "fitscan.h"
 #include "memlib.h"
+#include "mtr.h"
+#include "mtz.h"
+#include "tstream.h"
+#include "hist.h"
+#include "clock.h"
+#include "perfctr.h"
 #include "fsecs.h"
 #include "config.h"
 
@@ -30,6 +52,79 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Levels of the skip list of payload ranges, enough for 4^16 blocks */
+#define RANGE_LEVELS  16
+
+/* Under a heap limit (-L) the driver holds limit/BALLAST_DIV bytes it
+   hands back to the pressure callback */
+#define BALLAST_DIV    8
+
+/* Random points at which each persistent heap is killed (-p) */
+#define PERSIST_CRASHES 20
+
+/* Cold replays of each trace with and without a reservation (-r) */
+#define RESERVE_RUNS   5
+#define RESERVE_TRIES  4 /* replays to find what -r 0 must reserve */
+
+/* Samples per trace in the RSS-over-time report (-D) */
+#define RSS_SAMPLES   10
+
+/* Compaction work allowed after each free in handle mode (-H), bytes */
+#define HANDLE_BUDGET 4096
+
+/* Pool micro-benchmark */
+#define POOL_OBJS    1000 /* objects live at the peak of each round */
+#define POOL_ROUNDS   100 /* allocate-all/free-all rounds per run */
+
+/* Free-block search micro-benchmark */
+#define FIT_MIN_BLOCKS     10  /* shortest free list searched */
+#define FIT_MAX_BLOCKS 100000  /* longest free list searched */
+#define FIT_RUN_BLOCKS (1<<22) /* blocks visited per timed run */
+#define FIT_NODE_SIZE      64  /* one list node per cache line */
+
+/* Shared-heap benchmark (-W) */
+#define SHARED_OPS    100000 /* mallocs per worker */
+#define SHARED_RING      256 /* blocks in flight to each worker */
+#define SHARED_MAXSIZE 16384 /* largest buffer passed on (bytes) */
+
+/* Independent heaps (-I) */
+#define HEAPS_SIZE    (1<<20) /* maxsize of the interleaved and filled heaps */
+#define HEAPS_SLOTS       256 /* blocks live in each interleaved heap at most */
+#define HEAPS_OPS      100000 /* requests spread over the two heaps */
+#define HEAPS_MAXSIZE    1024 /* largest interleaved request (bytes) */
+#define HEAPS_CHECK     10000 /* requests between heap checks */
+#define HEAPS_FILL         64 /* request size that fills a heap (bytes) */
+#define HEAPS_CYCLE_SIZE (32*(1<<20)) /* maxsize of each created/destroyed heap */
+#define HEAPS_MIN_BLOCKS   10 /* fewest blocks in a destroyed heap */
+#define HEAPS_MAX_BLOCKS 100000 /* most blocks in a destroyed heap */
+#define HEAPS_CYCLES       20 /* create/destroy cycles per block count */
+
+/* Contents of byte k of block s of interleaved heap j */
+#define HEAPS_BYTE(j, s, k) ((unsigned char)((s) * 7 + (k) + (j) * 0x80))
+
+/* Request latency (-T) */
+#define LAT_OPS        3 /* histograms per trace: malloc, free, realloc */
+
+/* Hardware event counts (-c) */
+#define PERF_RUNS     10 /* runs of the speed test counted per trace */
+
+/* Benchmark mode (-b, -n) */
+#define BENCH_WARMUP   3 /* untimed runs of each trace before the samples */
+#define BENCH_BOOT  1000 /* bootstrap resamples for the confidence interval */
+#define BENCH_CV     2.0 /* flag traces whose CV is above this (percent) */
+
+/* Results file and baseline (--json, --baseline) */
+#define BASE_THRESHOLD 5.0 /* default regression threshold (percent) */
+#define BASE_ALPHA    0.05 /* significance level of the throughput test */
+#define BASE_TRACES    256 /* most traces read from a baseline */
+
+/* Timeline (-w, -o) */
+#define TIMELINE_OPS  1000 /* requests per window if -o comes without -w */
+
+/* Streaming replay (-s) */
+#define STREAM_CHUNK  (1<<16) /* requests per chunk read ahead */
+#define STREAM_REPORT 10000000 /* requests between progress lines (-V) */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -37,21 +132,17 @@
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload, as a node of a skip list
+ * in address order. A node of level k is allocated with room for k
+ * next pointers; the list head has RANGE_LEVELS.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *next[1]; /* next node at each of its levels */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef enum {ALLOC, FREE, REALLOC} RequestType;
-typedef struct {
-    RequestType type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -61,6 +152,13 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int num_regions;     /* number of region ids (0 if no region ops) */
+    int *block_regions;  /* region each region-carved block belongs to */
+    int *region_blocks;  /* most recent block carved from each region... */
+    int *next_block;     /* ... chained through the older blocks */
+    mm_region_t **regions; /* handles of the live regions */
+    void *map;           /* mapped .mtr file holding ops and block_regions */
+    size_t map_len;      /* ... and its length, or NULL and 0 */
 } trace_t;
 
 /*
@@ -73,24 +171,209 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/*
+ * Holds the params to the pool micro-benchmark. Each round gets nobjs
+ * objects and then frees them in a fixed shuffled order.
+ */
+typedef struct {
+    int objsize;   /* bytes per object */
+    int nobjs;     /* objects live at the peak of each round */
+    int rounds;    /* rounds per timed run */
+    int *order;    /* order in which each round frees its objects */
+    void **objs;   /* objects of the current round */
+} poolbench_t;
+
+/*
+ * A free block as the boundary-tag engine used to see it: a size in
+ * the header and a link to the next free block.
+ */
+typedef struct fitnode {
+    size_t hdr;             /* block size */
+    struct fitnode *next;   /* next free block */
+} fitnode_t;
+
+/*
+ * Holds the params to the free-block search micro-benchmark. The same
+ * n free blocks are searched either as a linked list in shuffled
+ * address order or as a packed size array; only the last one fits.
+ */
+typedef struct {
+    size_t n;           /* free blocks */
+    fitnode_t *list;    /* first block of the list */
+    uint32_t *sizes;    /* packed size array */
+    fit_scan_fn scan;   /* kernel under test, NULL for the list */
+    int reps;           /* searches per timed run */
+    size_t found;       /* sum of one run's results, so none is elided */
+} fitbench_t;
+
+/*
+ * The inbox of one worker of the shared-heap benchmark, kept in the
+ * shared heap. Its left neighbour pushes offsets of filled buffers at
+ * tail; the worker pops them at head, checks and frees them.
+ */
+typedef struct {
+    long head;                /* next slot to pop (written by the owner) */
+    long tail;                /* next slot to fill (written by the producer) */
+    long slot[SHARED_RING];   /* buffer offsets from the first inbox */
+    long remote;              /* buffers the owner freed for the producer */
+    long bad;                 /* buffers that arrived damaged */
+} inbox_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double vsecs;    /* secs taken by the correctness check */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only when replaying under a heap limit (-L) */
+    double peak;     /* largest heap size reached by the correctness run */
+    int pressure;    /* memory-pressure callbacks during that run */
+    int retries;     /* requests that succeeded once the ballast went */
+
+    /* defined only when comparing deferred and eager frees (-F) */
+    double util_eager; /* util with eager frees (util is deferred) */
+    double p99_eager;  /* 99th percentile mm_free latency, eager (ns) */
+    double p99;        /* 99th percentile mm_free latency, deferred (ns) */
+
+    /* defined only when replaying through handles (-H) */
+    double util_handle;  /* util with handles, never compacted */
+    double util_compact; /* util with handles, compacted after each free */
+    double moved;        /* bytes moved by mm_compact */
+
+    /* defined only when reordering free blocks by address (-A) */
+    double util_unordered; /* util without reordering (util is with) */
+    double spread_unordered; /* median distance between consecutive */
+    double spread;           /*   allocations, without and with (bytes) */
+    double near_unordered;   /* fraction of them less than a page apart, */
+    double near;             /*   without and with */
+
+    /* defined only when comparing size classes (-C) */
+    double frag_geo;     /* internal fragmentation, geometric classes */
+    double frag_gen;     /* internal fragmentation, generated classes */
+    double util_classes; /* util with requests rounded to their class */
+
+    /* defined only when reserving the heap up front (-r) */
+    double reserved;     /* bytes reserved with MM_PREFAULT */
+    double setup;        /* mean time taken by mm_reserve (ns) */
+    double tail;         /* p99.9 request latency without it (ns) */
+    double tail_reserved; /* p99.9 request latency with it (ns) */
+    double grown;        /* most bytes the heap grew after mm_reserve */
+    double faults;       /* most page faults after mm_reserve */
+
+    /* defined only when crashing a persistent heap (-p) */
+    int crashes;         /* times the heap's process was killed */
+    int in_mm;           /* ... while inside an allocator call */
+    int clean;           /* crashes after which the heap recovered intact */
+    int broken;          /* ... and after which it failed the heap check */
+    int bad_blocks;      /* listed blocks whose contents were lost */
+    double rebuild;      /* time to build the heap for the whole trace (ns) */
+    double reopen;       /* mean time mm_heap_open took to recover it (ns) */
+
+    /* defined only when counting hardware events (-c) */
+    double events[PERF_EVENTS];  /* per run of the speed test, -1 if not counted */
+
+    /* defined only in benchmark mode (-b) */
+    double mean;         /* mean of the warm samples (secs) */
+    double median;       /* ... their median */
+    double stddev;       /* ... their standard deviation */
+    double ci_lo;        /* 95% bootstrap confidence interval of the mean */
+    double ci_hi;
+    double cold;         /* median of as many samples with the cache cleared */
+
+    /* defined only when timing each request (-T) */
+    double lat_count[LAT_OPS];   /* mallocs, frees and reallocs timed */
+    double lat[LAT_OPS][4];      /* p50, p99, p99.9 and max of each (ns) */
+
+    /* defined only when sampling a timeline (-w) */
+    int windows;         /* windows sampled */
+    double kops_min;     /* throughput of the slowest window (Kops/s) */
+    double kops_max;     /* ... and of the fastest */
+    int slow_op;         /* request that ended the slowest window */
+    double slow_free;    /* free blocks at its end */
+    double max_free;     /* most free blocks at the end of any window */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/*
+ * Describes one field of stats_t for the results file (--json): its
+ * name, where it is, and how many ints or doubles it holds
+ */
+typedef struct {
+    const char *name;
+    size_t offset;
+    int is_int;
+    int count;
+} statfield_t;
+
+#define STAT_D(f)    {#f, offsetof(stats_t, f), 0, 1}
+#define STAT_I(f)    {#f, offsetof(stats_t, f), 1, 1}
+#define STAT_A(f, n) {#f, offsetof(stats_t, f), 0, n}
+
+static const statfield_t stat_fields[] = {
+    STAT_D(ops), STAT_I(valid), STAT_D(secs), STAT_D(vsecs), STAT_D(util),
+    STAT_D(peak), STAT_I(pressure), STAT_I(retries),
+    STAT_D(util_eager), STAT_D(p99_eager), STAT_D(p99),
+    STAT_D(util_handle), STAT_D(util_compact), STAT_D(moved),
+    STAT_D(util_unordered), STAT_D(spread_unordered), STAT_D(spread),
+    STAT_D(near_unordered), STAT_D(near),
+    STAT_D(frag_geo), STAT_D(frag_gen), STAT_D(util_classes),
+    STAT_D(reserved), STAT_D(setup), STAT_D(tail), STAT_D(tail_reserved),
+    STAT_D(grown), STAT_D(faults),
+    STAT_I(crashes), STAT_I(in_mm), STAT_I(clean), STAT_I(broken),
+    STAT_I(bad_blocks),
+    STAT_D(rebuild), STAT_D(reopen),
+    STAT_A(events, PERF_EVENTS),
+    STAT_D(mean), STAT_D(median), STAT_D(stddev), STAT_D(ci_lo),
+    STAT_D(ci_hi), STAT_D(cold),
+    STAT_A(lat_count, LAT_OPS), STAT_A(lat, LAT_OPS * 4),
+    STAT_I(windows), STAT_D(kops_min), STAT_D(kops_max), STAT_I(slow_op),
+    STAT_D(slow_free), STAT_D(max_free),
+};
+
+/* The baseline's numbers for one trace (--baseline) */
+typedef struct {
+    char name[MAXLINE];
+    int valid;
+    double ops, secs, util, mean, stddev;
+} base_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int region_emulate = 0; /* replay region ops with mm_malloc/mm_free */
+static size_t heap_limit = 0;  /* soft heap limit for mm malloc (-L) */
+static int pressure_calls = 0; /* memory-pressure callbacks so far */
+static char *ballast = NULL;   /* released when the heap is short (-L) */
+static int ballast_freed = 0;  /* times the callback released it */
+static long decay_ms = 0;      /* purge age for mm malloc's free pages (-D) */
+static int defer_frees = 0;    /* compare deferred and eager mm_free (-F) */
+static int use_handles = 0;    /* also replay through handles (-H) */
+static int reorder_every = 0;  /* address-order free blocks every n frees (-A) */
+static int size_classes = 0;   /* compare size-class tables (-C) */
+static int reserve = 0;        /* compare with a prefaulted heap (-r) */
+static size_t reserve_bytes = 0; /* bytes to reserve, 0 = the trace's peak */
+static char *persist_file = NULL; /* crash and recover a heap in this file (-p) */
+static int latency = 0;        /* time every request (-T) */
+static int counters = 0;       /* count hardware events (-c) */
+static int bench_samples = 0;  /* timed samples per trace (-b) */
+static double bench_cv = BENCH_CV; /* CV above which a trace is noisy (-n) */
+static FILE *lat_dump = NULL;  /* file the histograms go to (-d) */
+static int window = 0;         /* sample every window requests (-w) */
+static FILE *tl_file = NULL;   /* file the samples go to (-o) */
+static char *json_file = NULL; /* write the results here (--json) */
+static char *base_file = NULL; /* compare with the results here (--baseline) */
+static double base_threshold = BASE_THRESHOLD; /* regression above this % */
+static int tl_json = 0;        /* ... as JSON rather than CSV */
+static unsigned int *geo_class = NULL; /* the geometric table (-C) */
+static int geo_classes = 0;    /* its length */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -107,6 +390,8 @@ static const char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
+static int range_level(void);
+static void range_find(range_t *head, char *lo, range_t **before);
 static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
@@ -114,7 +399,10 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *map_trace(char *path);
+static void print_load(trace_t *trace, struct timespec *t0);
 static void free_trace(trace_t *trace);
+static void region_link(trace_t *trace, int rid, int index);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,12 +410,77 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 int *retries);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void count_events(fsecs_test_funct f, void *argp, stats_t *stats);
+static void pin_cpu(void);
+static void eval_mm_bench(speed_t *params, stats_t *stats);
+static void eval_mm_rss(trace_t *trace, int tracenum);
+static double eval_mm_freelat(trace_t *trace);
+static void eval_mm_defer(trace_t *trace, int tracenum, range_t **ranges,
+			  stats_t *stats);
+static size_t heap_resident(void);
+static int eval_mm_handles(trace_t *trace, int tracenum, size_t budget,
+			   double *util, double *moved);
+static void eval_mm_spread(trace_t *trace, double *spread, double *near);
+static void eval_mm_reorder(trace_t *trace, int tracenum, range_t **ranges,
+			    stats_t *stats);
+static void eval_mm_coldlat(trace_t *trace, size_t bytes, double *lat,
+			    double *setup, size_t *grown, long *faults);
+static void eval_mm_reserve(trace_t *trace, stats_t *stats);
+static void eval_mm_persist(trace_t *trace, stats_t *stats);
+static void eval_mm_latency(trace_t *trace, int tracenum, char *name,
+			    stats_t *stats);
+static void eval_mm_timeline(trace_t *trace, int tracenum, char *name,
+			     stats_t *stats);
+static void make_geo_classes(void);
+static void eval_mm_classes(trace_t *trace, int tracenum, range_t **ranges,
+			    stats_t *stats);
+
+/* Micro-benchmark of mm_pool_get/put against mm_malloc/mm_free */
+static void eval_pool_bench(int objsize);
+static void eval_pool_speed(void *ptr);
+static void eval_pool_mm_speed(void *ptr);
+
+/* Micro-benchmark of list versus packed-array free-block search */
+static void eval_fit_bench(void);
+static void eval_fit_speed(void *ptr);
+
+/* Multi-process benchmark of a shared heap */
+static void eval_shared_bench(int workers);
+static void shared_worker(int fd, int id, int n);
+
+/* Independent heaps made and released with mm_heap_create/destroy */
+static void eval_heaps_bench(void);
+static void heaps_interleave(void);
+static void heaps_fill(void);
+static void heaps_cycle(void);
+static int heaps_alloc(mm_heap_t *h, void **blocks, int n);
+
+/* Streaming replay of a trace too large to load */
+static void eval_mm_stream(char *path);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printevents(int n, stats_t *stats);
+static void printlimits(int n, stats_t *stats);
+static void printdefer(int n, stats_t *stats);
+static void printhandles(int n, stats_t *stats);
+static void printreorder(int n, stats_t *stats);
+static void printclasses(int n, stats_t *stats);
+static void printreserve(int n, stats_t *stats);
+static void printpersist(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printtimeline(int n, stats_t *stats);
+static void printbench(int n, stats_t *stats);
+static void json_string(FILE *f, const char *s);
+static void write_json(char *path, int n, char **names, stats_t *stats,
+		       double perfindex);
+static int compare_baseline(char *path, int n, char **names, stats_t *stats);
+static int pressure_callback(mm_heap_t *h, size_t need, void *arg);
+static void need_feature(int used, int feature, const char *flag);
 static void usage(void);
 static void unix_error(const char *msg);
 static void malloc_error(int tracenum, int opnum, const char *msg);
@@ -138,8 +491,7 @@ static void app_error(const char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
@@ -147,20 +499,47 @@ int main(int argc, char **argv)
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */
+    struct timespec t0, t1;    /* bracket each correctness check */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int pool_size = 0;   /* If set, run the pool benchmark instead (-P) */
+    int fit_bench = 0;   /* If set, run the search benchmark instead (-S) */
+    int shared_workers = 0; /* If set, run the shared-heap benchmark (-W) */
+    int indep_heaps = 0; /* If set, exercise independent heaps instead (-I) */
+    char *stream_file = NULL; /* If set, stream this trace instead (-s) */
+    const unsigned int *classes; /* mm.c's size-class table (-C) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
     int numcorrect;
+    int regressions = 0; /* traces worse than the baseline (--baseline) */
+
+    /* options without a short form */
+    enum { OPT_JSON = 256, OPT_BASELINE, OPT_THRESHOLD };
+    static struct option long_opts[] = {
+	{"json",      required_argument, NULL, OPT_JSON},
+	{"baseline",  required_argument, NULL, OPT_BASELINE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{NULL, 0, NULL, 0}
+    };
 
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:hvVgalcRFHISCTA:P:L:D:b:d:n:o:r:p:s:w:W:",
+			    long_opts, NULL)) != EOF) {
         switch (c) {
+        case OPT_JSON: /* Write every result and the environment here */
+            json_file = strdup(optarg);
+            break;
+        case OPT_BASELINE: /* Compare with the results in this file */
+            base_file = strdup(optarg);
+            break;
+        case OPT_THRESHOLD: /* Regressions above this percentage fail */
+            base_threshold = atof(optarg);
+            break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -186,6 +565,99 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'b': /* Benchmark mode: this many samples per trace */
+            bench_samples = atoi(optarg);
+            if (bench_samples < 2) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'n': /* Flag benchmark traces noisier than this CV (%) */
+            bench_cv = atof(optarg);
+            break;
+        case 'c': /* Count hardware events around the speed test */
+            counters = 1;
+            break;
+        case 'R': /* Replay region ops as individual mallocs and frees */
+            region_emulate = 1;
+            break;
+        case 'D': /* Purge free pages after this many ms; report RSS */
+            decay_ms = atol(optarg);
+            if (decay_ms <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'F': /* Defer frees; compare with eager frees */
+            defer_frees = 1;
+            break;
+        case 'A': /* Address-order the free blocks every n frees */
+            reorder_every = atoi(optarg);
+            if (reorder_every <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'C': /* Compare generated and geometric size classes */
+            size_classes = 1;
+            break;
+        case 'H': /* Also replay through relocatable handles */
+            use_handles = 1;
+            break;
+        case 'r': /* Compare request latency with a prefaulted heap */
+            reserve = 1;
+            reserve_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'T': /* Time every request; print latency percentiles */
+            latency = 1;
+            break;
+        case 'd': /* Also dump the latency histograms to this file */
+            latency = 1;
+            if ((lat_dump = fopen(optarg, "w")) == NULL)
+		unix_error(optarg);
+            break;
+        case 'w': /* Sample throughput and free blocks every n requests */
+            window = atoi(optarg);
+            if (window <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'o': /* Write the samples to this file, CSV or .json */
+            if ((tl_file = fopen(optarg, "w")) == NULL)
+		unix_error(optarg);
+            tl_json = strlen(optarg) > 5 &&
+		!strcmp(optarg + strlen(optarg) - 5, ".json");
+            break;
+        case 'p': /* Crash and recover a persistent heap in this file */
+            persist_file = strdup(optarg);
+            break;
+        case 'L': /* Replay the traces under a soft heap limit */
+            heap_limit = strtoul(optarg, NULL, 0);
+            break;
+        case 's': /* Stream one trace file instead of loading it */
+            stream_file = strdup(optarg);
+            break;
+        case 'I': /* Exercise independent heaps (mm_heap_create) */
+            indep_heaps = 1;
+            break;
+        case 'S': /* Benchmark free-block search */
+            fit_bench = 1;
+            break;
+        case 'P': /* Benchmark pools of objects of this size */
+            pool_size = atoi(optarg);
+            if (pool_size <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'W': /* Benchmark a heap shared by up to n processes */
+            shared_workers = atoi(optarg);
+            if (shared_workers <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -201,6 +673,15 @@ int main(int argc, char **argv)
         }
     }
 
+    /* The other engines accept these features' calls and ignore them */
+    need_feature(decay_ms, MM_DECAY, "-D");
+    need_feature(defer_frees, MM_DEFERRED, "-F");
+    need_feature(size_classes, MM_CLASSES, "-C");
+    need_feature(reorder_every, MM_REORDER, "-A");
+    need_feature(use_handles, MM_COMPACT, "-H");
+    need_feature(persist_file != NULL || shared_workers, MM_FILES,
+		 persist_file != NULL ? "-p" : "-W");
+
     /*
      * Check and print team info
      */
@@ -239,6 +720,11 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (counters && perf_open() == 0) {
+	printf("Hardware counters unavailable, not counting: %s\n",
+	       perf_error());
+	counters = 0;
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package
@@ -258,12 +744,18 @@ int main(int argc, char **argv)
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    libc_stats[i].vsecs = (t1.tv_sec - t0.tv_sec) +
+		(t1.tv_nsec - t0.tv_nsec) / 1e9;
 	    if (libc_stats[i].valid) {
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (counters)
+		    count_events(eval_libc_speed, &speed_params, &libc_stats[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -288,6 +780,51 @@ int main(int argc, char **argv)
 
     /* Initialize the simulated memory system in memlib.c */
     mem_init();
+    if (heap_limit) {
+	mm_set_limit(heap_limit);
+	mm_set_pressure_callback(pressure_callback, NULL);
+    }
+    if (decay_ms)
+	mm_set_decay(decay_ms);
+    if (defer_frees)
+	mm_set_deferred(1);
+    if (reorder_every)
+	mm_set_reorder(reorder_every);
+    if (size_classes)
+	make_geo_classes();
+
+    /* The micro-benchmarks replace the trace-driven evaluation */
+    if (fit_bench) {
+	eval_fit_bench();
+	exit(0);
+    }
+    if (pool_size) {
+	eval_pool_bench(pool_size);
+	exit(errors ? 1 : 0);
+    }
+    if (shared_workers) {
+	eval_shared_bench(shared_workers);
+	exit(errors ? 1 : 0);
+    }
+    if (indep_heaps) {
+	eval_heaps_bench();
+	exit(errors ? 1 : 0);
+    }
+    if (stream_file) {
+	eval_mm_stream(stream_file);
+	exit(errors ? 1 : 0);
+    }
+
+    if (tl_file != NULL && !window)
+	window = TIMELINE_OPS;
+    if (tl_file != NULL && tl_json)
+	fprintf(tl_file, "{\"engine\": \"%s\", \"window\": %d, \"traces\": [",
+		mm_engine_name(), window);
+    else if (tl_file != NULL)
+	fprintf(tl_file, "trace,name,op,kops,free_blocks,free_bytes,heap,live\n");
+
+    if (bench_samples)
+	pin_cpu();
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
@@ -295,26 +832,126 @@ int main(int argc, char **argv)
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	pressure_calls = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges,
+					  &mm_stats[i].retries);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ballast = NULL;  /* it went with that run's heap */
+	mm_stats[i].vsecs = (t1.tv_sec - t0.tv_sec) +
+	    (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	mm_stats[i].peak = mem_heappeak();
+	mm_stats[i].pressure = pressure_calls;
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    if (decay_ms)
+		eval_mm_rss(trace, i);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (counters)
+		count_events(eval_mm_speed, &speed_params, &mm_stats[i]);
+	    if (bench_samples)
+		eval_mm_bench(&speed_params, &mm_stats[i]);
+	    if (defer_frees)
+		eval_mm_defer(trace, i, &ranges, &mm_stats[i]);
+	    if (reorder_every)
+		eval_mm_reorder(trace, i, &ranges, &mm_stats[i]);
+	    if (size_classes)
+		eval_mm_classes(trace, i, &ranges, &mm_stats[i]);
+	    if (reserve)
+		eval_mm_reserve(trace, &mm_stats[i]);
+	    if (persist_file)
+		eval_mm_persist(trace, &mm_stats[i]);
+	    if (latency)
+		eval_mm_latency(trace, i, tracefiles[i], &mm_stats[i]);
+	    if (window)
+		eval_mm_timeline(trace, i, tracefiles[i], &mm_stats[i]);
+	    if (use_handles &&
+		eval_mm_handles(trace, i, 0, &mm_stats[i].util_handle,
+				&mm_stats[i].moved))
+		eval_mm_handles(trace, i, HANDLE_BUDGET,
+				&mm_stats[i].util_compact, &mm_stats[i].moved);
 	}
 	free_trace(trace);
     }
 
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	printf("\nResults for mm malloc (%s engine):\n", mm_engine_name());
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (bench_samples) {
+	printf("%d samples per trace (us), noisy above %.1f%% CV:\n",
+	       bench_samples, bench_cv);
+	printbench(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (defer_frees) {
+	printf("Deferred vs eager mm_free:\n");
+	printdefer(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (reorder_every) {
+	printf("Free blocks reordered by address every %d frees:\n",
+	       reorder_every);
+	printreorder(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (size_classes) {
+	printf("Generated (%d) vs geometric (%d) size classes up to %u bytes:\n",
+	       mm_size_classes(&classes), geo_classes, geo_class[geo_classes-1]);
+	printf("The generated classes were chosen from the traces in "
+	       "sizeclass.h;\nfrag-gen is in-sample for those traces.\n");
+	printclasses(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (reserve) {
+	printf("p99.9 request latency over %d cold runs without and with "
+	       "mm_reserve(%s, MM_PREFAULT):\n", RESERVE_RUNS,
+	       reserve_bytes ? "bytes" : "peak");
+	printreserve(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (persist_file) {
+	printf("Persistent heap in %s, killed at %d random points "
+	       "per trace and recovered:\n", persist_file, PERSIST_CRASHES);
+	printpersist(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (latency) {
+	printf("Request latency (ns), timer overhead of %.0f ns subtracted:\n",
+	       ticks_ovhd() * 1e9 / ticks_hz());
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+	if (lat_dump != NULL)
+	    fclose(lat_dump);
+    }
+    if (window) {
+	printf("Throughput over windows of %d requests:\n", window);
+	printtimeline(num_tracefiles, mm_stats);
+	printf("\n");
+	if (tl_file != NULL) {
+	    if (tl_json)
+		fprintf(tl_file, "\n]}\n");
+	    fclose(tl_file);
+	}
+    }
+    if (use_handles) {
+	printf("Handles, compacting %d bytes per free:\n", HANDLE_BUDGET);
+	printhandles(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (heap_limit) {
+	printf("Heap limit %lu bytes:\n", (unsigned long)heap_limit);
+	printlimits(num_tracefiles, mm_stats);
+	printf("\n");
+    }
 
     /*
      * Accumulate the aggregate statistics for the student's mm package
@@ -364,7 +1001,13 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    if (json_file != NULL)
+	write_json(json_file, num_tracefiles, tracefiles, mm_stats, perfindex);
+    if (base_file != NULL)
+	regressions = compare_baseline(base_file, num_tracefiles, tracefiles,
+				       mm_stats);
+
+    exit(regressions ? 1 : 0);
 }
 
 
@@ -372,8 +1015,50 @@ int main(int argc, char **argv)
  * The following routines manipulate the range list, which keeps
  * track of the extent of every allocated block payload. We use the
  * range list to detect any overlapping allocated blocks.
+ *
+ * The list is a skip list in address order. Payloads never overlap
+ * one another, so a new block overlaps some payload if and only if
+ * it overlaps the one just below it or the one just above it, and
+ * adding, checking and removing a block all take O(log n) expected
+ * time. *ranges is the list's head node, made on the first add.
  ****************************************************************/
 
+/*
+ * range_level - Pick the height of a new node: 1, then one more level
+ *     with probability 1/4 each, from a generator of our own so that
+ *     the allocator sees the same rand() sequence as before
+ */
+static int range_level(void)
+{
+    static unsigned int seed = 2463534242U;
+    int level = 1;
+
+    for (;;) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	if ((seed & 3) != 0 || level == RANGE_LEVELS)
+	    return level;
+	level++;
+    }
+}
+
+/*
+ * range_find - Find, at every level, the last node whose payload
+ *     starts below lo, or the head
+ */
+static void range_find(range_t *head, char *lo, range_t **before)
+{
+    range_t *p = head;
+    int k;
+
+    for (k = RANGE_LEVELS - 1; k >= 0; k--) {
+	while (p->next[k] != NULL && p->next[k]->lo < lo)
+	    p = p->next[k];
+	before[k] = p;
+    }
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
@@ -384,8 +1069,9 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *before[RANGE_LEVELS];
     char msg[MAXLINE];
+    int k, level;
 
     assert(size > 0);
 
@@ -406,27 +1092,39 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    if (*ranges == NULL) {
+	*ranges = (range_t *)calloc(1, sizeof(range_t) +
+				    (RANGE_LEVELS-1) * sizeof(range_t *));
+	if (*ranges == NULL)
+	    unix_error("calloc error in add_range");
+    }
+
+    /* The payload must not overlap its neighbours, hence any payload */
+    range_find(*ranges, lo, before);
+    p = before[0];
+    if (p == *ranges || p->hi < lo)
+	p = p->next[0];
+    if (p != NULL && p->lo <= hi) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and linking it in at its height.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
+    level = range_level();
+    p = (range_t *)malloc(sizeof(range_t) + (level-1) * sizeof(range_t *));
+    if (p == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    for (k = 0; k < level; k++) {
+	p->next[k] = before[k]->next[k];
+	before[k]->next[k] = p;
+    }
     return 1;
 }
 
@@ -435,18 +1133,18 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            // int size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    range_t *p, *before[RANGE_LEVELS];
+    int k;
+
+    if (*ranges == NULL)
+	return;
+    range_find(*ranges, lo, before);
+    p = before[0]->next[0];
+    if (p == NULL || p->lo != lo)
+	return;
+    for (k = 0; k < RANGE_LEVELS && before[k]->next[k] == p; k++)
+	before[k]->next[k] = p->next[k];
+    free(p);
 }
 
 /*
@@ -457,10 +1155,13 @@ static void clear_ranges(range_t **ranges)
     range_t *p;
     range_t *pnext;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+    if (*ranges == NULL)
+	return;
+    for (p = (*ranges)->next[0];  p != NULL;  p = pnext) {
+        pnext = p->next[0];
         free(p);
     }
+    free(*ranges);
     *ranges = NULL;
 }
 
@@ -478,24 +1179,41 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    int index, size;
+    int index, size, rid;
     int max_index = 0;
+    int max_region = -1;
     int op_index;
+    uint32_t magic;
+    struct timespec t0;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+    trace->map_len = 0;
 
-    /* Read the trace file header */
+    /* Binary and compressed traces are mapped rather than read */
     strcpy(path, tracedir);
     strcat(path, filename);
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 &&
+	(magic == MTR_MAGIC || magic == MTZ_MAGIC)) {
+	fclose(tracefile);
+	free(trace);
+	trace = map_trace(path);
+	print_load(trace, &t0);
+	return trace;
+    }
+    rewind(tracefile);
+
+    /* Read the trace file header */
     if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)) ) {
       unix_error("fscanf of heapsize\n");
     }
@@ -524,6 +1242,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
 
+    /* ... and the region, if any, that each block is carved out of */
+    if ((trace->block_regions =
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    if ((trace->next_block =
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 6 failed in read_trace");
+
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -554,6 +1280,31 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'n':
+	  if ( 1 != fscanf(tracefile, "%u", &rid) ) {
+	    unix_error("fscanf of region create\n");
+	  }
+	    trace->ops[op_index].type = RNEW;
+	    trace->ops[op_index].index = rid;
+	    max_region = (rid > max_region) ? rid : max_region;
+	    break;
+	case 'b':
+	  if ( 3 != fscanf(tracefile, "%u %u %u", &rid, &index, &size) ) {
+	    unix_error("fscanf of region alloc\n");
+	  }
+	    trace->ops[op_index].type = RALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->block_regions[index] = rid;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'd':
+	  if ( 1 != fscanf(tracefile, "%u", &rid) ) {
+	    unix_error("fscanf of region destroy\n");
+	  }
+	    trace->ops[op_index].type = RFREE;
+	    trace->ops[op_index].index = rid;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n",
 		   type[0], path);
@@ -566,32 +1317,169 @@ static trace_t *read_trace(char *tracedir, char *filename)
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+    /* Region handles and block chains, one per region id */
+    trace->num_regions = max_region + 1;
+    if ((trace->regions = (mm_region_t **)
+	 calloc(trace->num_regions + 1, sizeof(mm_region_t *))) == NULL)
+	unix_error("malloc 7 failed in read_trace");
+    if ((trace->region_blocks =
+	 (int *)malloc((trace->num_regions + 1) * sizeof(int))) == NULL)
+	unix_error("malloc 8 failed in read_trace");
+
+    print_load(trace, &t0);
+    return trace;
+}
+
+/*
+ * print_load - with -V, report how long loading a trace took since t0
+ */
+static void print_load(trace_t *trace, struct timespec *t0)
+{
+    struct timespec t1;
+
+    if (verbose > 1) {
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("Loaded %d ops in %.6f secs\n", trace->num_ops,
+	       (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9);
+    }
+}
+
+/*
+ * map_trace - map a binary (.mtr) trace file. The ops and the region
+ *     of each block are used where they lie in the file, so nothing is
+ *     parsed or copied; only the per-id arrays that the driver writes
+ *     to are allocated. A compressed (.mtz) file is decoded into
+ *     arrays of its own, as read_trace would have parsed it.
+ */
+static trace_t *map_trace(char *path)
+{
+    trace_t *trace;
+    mtr_header_t *hdr;
+    struct stat st;
+    char *p;
+    mtz_state_t s;
+    int fd, n;
+
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in map_trace");
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+    trace->map = p;
+    trace->map_len = st.st_size;
+
+    hdr = (mtr_header_t *)p;
+    if ((size_t)st.st_size < sizeof(mtr_header_t) +
+	(hdr->magic == MTZ_MAGIC ? MTZ_MAXOP : 0) ||
+	hdr->version != MTR_VERSION || hdr->opsize != sizeof(traceop_t) ||
+	hdr->num_ids < 0 || hdr->num_ops < 0 || hdr->num_regions < 0 ||
+	(hdr->magic == MTR_MAGIC && (size_t)st.st_size != MTR_SIZE(hdr))) {
+	sprintf(msg, "%s is not a version %d trace of this build", path,
+		MTR_VERSION);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->num_regions = hdr->num_regions;
+    if (hdr->magic == MTZ_MAGIC) {
+	if ((trace->ops = (traceop_t *)
+	     malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in map_trace");
+	if ((trace->block_regions =
+	     (int *)calloc(trace->num_ids + 1, sizeof(int))) == NULL)
+	    unix_error("malloc 5 failed in map_trace");
+	mtz_init(&s);
+	n = trace->num_ops;
+	if (mtz_decode(&s, (unsigned char *)p + sizeof(mtr_header_t),
+		       (unsigned char *)p + st.st_size, trace->ops, &n,
+		       trace->block_regions, trace->num_ids) == NULL ||
+	    n != trace->num_ops) {
+	    sprintf(msg, "%s is corrupt", path);
+	    app_error(msg);
+	}
+	munmap(p, st.st_size);
+	trace->map = NULL;
+	trace->map_len = 0;
+    } else {
+	trace->ops = (traceop_t *)(p + sizeof(mtr_header_t));
+	trace->block_regions = (int *)(trace->ops + trace->num_ops);
+
+	/* the ops are replayed from the start several times */
+	madvise(p, st.st_size, MADV_WILLNEED);
+    }
+
+    if ((trace->blocks =
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+    if ((trace->next_block =
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 6 failed in map_trace");
+    if ((trace->regions = (mm_region_t **)
+	 calloc(trace->num_regions + 1, sizeof(mm_region_t *))) == NULL)
+	unix_error("malloc 7 failed in map_trace");
+    if ((trace->region_blocks =
+	 (int *)malloc((trace->num_regions + 1) * sizeof(int))) == NULL)
+	unix_error("malloc 8 failed in map_trace");
+
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record and the arrays it points
+ *              to, all of which were allocated in read_trace() or
+ *              mapped by map_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* unmap or free the arrays... */
+	munmap(trace->map, trace->map_len);
+    else {
+	free(trace->ops);
+	free(trace->block_regions);
+    }
     free(trace->blocks);
     free(trace->block_sizes);
+    free(trace->next_block);
+    free(trace->regions);
+    free(trace->region_blocks);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * region_link - Chain block index onto the list of blocks carved out
+ *     of region rid, so that destroying the region can retire them.
+ */
+static void region_link(trace_t *trace, int rid, int index)
+{
+    trace->next_block[index] = trace->region_blocks[rid];
+    trace->region_blocks[rid] = index;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm_valid - Check the mm malloc package for correctness. Under
+ *    a heap limit (-L) it first allocates the ballast the pressure
+ *    callback can release, and counts in *retries the requests that
+ *    succeeded only because it did.
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 int *retries)
 {
-    int i, j;
+    int i, j, freed;
     int index;
     int size;
     int oldsize;
@@ -608,11 +1496,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    *retries = 0;
+    if (heap_limit)
+	ballast = (char *) mm_malloc(heap_limit / BALLAST_DIV);
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
 	index = trace->ops[i].index;
 	size = trace->ops[i].size;
+	freed = ballast_freed;
 
         switch (trace->ops[i].type) {
 
@@ -623,6 +1515,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
+	    *retries += ballast_freed != freed;
 
 	    /*
 	     * Test the range of the new block for correctness and add it
@@ -652,6 +1545,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
+	    *retries += ballast_freed != freed;
 
 	    /* Remove the old region from the range list */
 	    remove_range(ranges, oldp);
@@ -689,6 +1583,45 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+	case RNEW: /* mm_region_create */
+	    trace->region_blocks[index] = -1;
+	    if (region_emulate)
+		break;
+	    if ((trace->regions[index] = mm_region_create(0)) == NULL) {
+		malloc_error(tracenum, i, "mm_region_create failed.");
+		return 0;
+	    }
+	    break;
+
+	case RALLOC: /* mm_region_alloc */
+	    if (region_emulate)
+		p = (char *) mm_malloc(size);
+	    else
+		p = (char *) mm_region_alloc(
+		    trace->regions[trace->block_regions[index]], size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_region_alloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    region_link(trace, trace->block_regions[index], index);
+	    break;
+
+	case RFREE: /* mm_region_destroy */
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		remove_range(ranges, trace->blocks[j]);
+		if (region_emulate)
+		    mm_free(trace->blocks[j]);
+	    }
+	    if (!region_emulate)
+		mm_region_destroy(trace->regions[index]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -704,15 +1637,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak size of the heap in bytes while running the student's malloc
+ *   package on the trace, plus any metadata the package keeps outside
+ *   the heap (see mm_metasize).
  *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {
-    int i;
+    int i, j;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -783,146 +1715,2584 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
 	    break;
 
+	case RNEW: /* mm_region_create */
+	    index = trace->ops[i].index;
+	    trace->region_blocks[index] = -1;
+	    if (!region_emulate &&
+		(trace->regions[index] = mm_region_create(0)) == NULL)
+		app_error("mm_region_create failed in eval_mm_util");
+	    break;
+
+	case RALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (region_emulate)
+		p = (char *) mm_malloc(size);
+	    else
+		p = (char *) mm_region_alloc(
+		    trace->regions[trace->block_regions[index]], size);
+	    if (p == NULL)
+		app_error("mm_region_alloc failed in eval_mm_util");
+
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    region_link(trace, trace->block_regions[index], index);
+
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case RFREE: /* mm_region_destroy */
+	    index = trace->ops[i].index;
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		if (region_emulate)
+		    mm_free(trace->blocks[j]);
+		total_size -= trace->block_sizes[j];
+	    }
+	    if (!region_emulate)
+		mm_region_destroy(trace->regions[index]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size /
+	    (double)(mem_heappeak() + mm_metasize()));
 }
 
 
 /*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ * heap_resident - Bytes of the simulated heap currently resident in RAM
  */
-static void eval_mm_speed(void *ptr)
+static size_t heap_resident(void)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    static unsigned char *vec = NULL;
+    static size_t veclen = 0;
+    size_t pagesize = mem_pagesize();
+    size_t npages = (mem_heapsize() + pagesize - 1) / pagesize;
+    size_t i, resident = 0;
+
+    if (npages > veclen) {
+	if ((vec = (unsigned char *) realloc(vec, npages)) == NULL)
+	    unix_error("realloc failed in heap_resident");
+	veclen = npages;
+    }
+    if (npages == 0 || mincore(mem_heap_lo(), mem_heapsize(), vec) < 0)
+	return 0;
+    for (i = 0; i < npages; i++)
+	resident += vec[i] & 1;
+    return resident * pagesize;
+}
 
-    /* Reset the heap and initialize the mm package */
+/*
+ * eval_mm_rss - Replay the trace and print, RSS_SAMPLES times along the
+ *    way, the elapsed time, the heap size and how much of the heap is
+ *    resident. Run with decay purging on, this shows how quickly freed
+ *    memory is handed back to the OS.
+ */
+static void eval_mm_rss(trace_t *trace, int tracenum)
+{
+    int i, j, index, size;
+    int every = (trace->num_ops + RSS_SAMPLES - 1) / RSS_SAMPLES;
+    char *p;
+    struct timespec start, now;
+
+    /* Start from a heap with nothing resident */
+    size = (mem_heappeak() + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (size > 0)
+	madvise(mem_heap_lo(), size, MADV_DONTNEED);
     mem_reset_brk();
     if (mm_init() < 0)
-	app_error("mm_init failed in eval_mm_speed");
+	app_error("mm_init failed in eval_mm_rss");
 
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = (char *) mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
-
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
+    printf("RSS over time for trace %d (decay %ld ms):\n", tracenum, decay_ms);
+    printf("%10s%10s%10s%10s\n", "msecs", "ops", "heap(KB)", "rss(KB)");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = (char *) mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_rss");
+	    memset(p, 0, size);
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = (char *) mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_rss");
+	    memset(p, 0, size);
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    if ((p = (char *) mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_rss");
+	    memset(p, 0, size);
+	    trace->blocks[index] = p;
+	    region_link(trace, trace->block_regions[index], index);
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j])
+		mm_free(trace->blocks[j]);
+	    break;
+	}
+	if ((i + 1) % every == 0 || i == trace->num_ops - 1) {
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    printf("%10.3f%10d%10.0f%10.0f\n",
+		   (now.tv_sec - start.tv_sec) * 1e3 +
+		   (now.tv_nsec - start.tv_nsec) / 1e6,
+		   i + 1, mem_heapsize() / 1024.0, heap_resident() / 1024.0);
+	}
+    }
+}
+
+/*
+ * cmp_double - qsort comparison for doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_freelat - Replay the trace, timing every mm_free, and return
+ *    the 99th percentile free latency in nanoseconds
+ */
+static double eval_mm_freelat(trace_t *trace)
+{
+    int i, j, index, nfrees = 0;
+    double *lat, p99;
+    char *p;
+    struct timespec t0, t1;
+
+    if ((lat = (double *) malloc(trace->num_ids * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_freelat");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_freelat");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    if ((p = (char *) mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_freelat");
+	    trace->blocks[index] = p;
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    break;
+	case REALLOC:
+	    if ((p = (char *) mm_realloc(trace->blocks[index],
+					 trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_freelat");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    mm_free(trace->blocks[index]);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    lat[nfrees++] = (t1.tv_sec - t0.tv_sec) * 1e9 +
+		(t1.tv_nsec - t0.tv_nsec);
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		mm_free(trace->blocks[j]);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		lat[nfrees++] = (t1.tv_sec - t0.tv_sec) * 1e9 +
+		    (t1.tv_nsec - t0.tv_nsec);
+	    }
+	    break;
+	}
+    }
+
+    p99 = 0;
+    if (nfrees > 0) {
+	qsort(lat, nfrees, sizeof(double), cmp_double);
+	p99 = lat[(int)(0.99 * (nfrees - 1))];
+    }
+    free(lat);
+    return p99;
+}
+
+/*
+ * eval_mm_coldlat - Replay the trace on a heap with no page resident,
+ *    storing the latency of every request in lat (ns). With bytes
+ *    nonzero, mm_reserve(bytes, MM_PREFAULT) runs first: *setup is set
+ *    to the time it took, and *grown and *faults to how far the heap
+ *    grew and how many page faults the process took after it.
+ */
+static void eval_mm_coldlat(trace_t *trace, size_t bytes, double *lat,
+			    double *setup, size_t *grown, long *faults)
+{
+    int i, j, index, size;
+    size_t heapsize;
+    char *p;
+    struct timespec t0, t1;
+    struct rusage ru0, ru1;
+
+    /* Start from a heap with nothing resident, as a fresh process does */
+    size = (mem_heappeak() + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (size > 0)
+	madvise(mem_heap_lo(), size, MADV_DONTNEED);
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_coldlat");
+
+    if (bytes) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (mm_reserve(bytes, MM_PREFAULT) < 0)
+	    app_error("mm_reserve failed in eval_mm_coldlat");
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	*setup = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    heapsize = mem_heapsize();
+    getrusage(RUSAGE_SELF, &ru0);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    if ((p = (char *) mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_coldlat");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = (char *) mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_coldlat");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j])
+		mm_free(trace->blocks[j]);
+	    break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (trace->ops[i].type == RALLOC)
+	    region_link(trace, trace->block_regions[index], index);
+	lat[i] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+
+    getrusage(RUSAGE_SELF, &ru1);
+    if (bytes) {
+	*grown = mem_heapsize() - heapsize;
+	*faults = ru1.ru_minflt - ru0.ru_minflt + ru1.ru_majflt - ru0.ru_majflt;
+    }
+}
+
+/*
+ * eval_mm_reserve - Replay the trace RESERVE_RUNS times on a cold heap
+ *    and as many times on one reserved and prefaulted up front, and
+ *    take the p99.9 request latency of each set of runs. The
+ *    reservation is reserve_bytes or, with -r 0, what the trace needs:
+ *    the peak heap size of the correctness run, raised until a reserved
+ *    replay no longer grows the heap (a reserved heap is carved up
+ *    differently), at most RESERVE_TRIES times. The growth and faults
+ *    after mm_reserve are reported; while the heap did not grow, no
+ *    request may have faulted.
+ */
+static void eval_mm_reserve(trace_t *trace, stats_t *stats)
+{
+    double *lat, setup;
+    size_t n = (size_t)trace->num_ops * RESERVE_RUNS, grown;
+    long faults;
+    int r;
+
+    if ((lat = (double *) malloc(n * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_reserve");
+    memset(lat, 0, n * sizeof(double)); /* no faults of our own later */
+
+    stats->reserved = reserve_bytes ? reserve_bytes : stats->peak;
+    for (r = 0; !reserve_bytes && r < RESERVE_TRIES; r++) {
+	eval_mm_coldlat(trace, stats->reserved, lat, &setup, &grown, &faults);
+	if (grown == 0)
+	    break;
+	stats->reserved += grown;
+    }
+
+    for (r = 0; r < RESERVE_RUNS; r++)
+	eval_mm_coldlat(trace, 0, lat + (size_t)r * trace->num_ops,
+			NULL, NULL, NULL);
+    qsort(lat, n, sizeof(double), cmp_double);
+    stats->tail = lat[(size_t)(0.999 * (n - 1))];
+
+    stats->setup = stats->grown = stats->faults = 0;
+    for (r = 0; r < RESERVE_RUNS; r++) {
+	eval_mm_coldlat(trace, stats->reserved,
+			lat + (size_t)r * trace->num_ops,
+			&setup, &grown, &faults);
+	stats->setup += setup / RESERVE_RUNS;
+	if (grown > stats->grown)
+	    stats->grown = grown;
+	if (faults > stats->faults)
+	    stats->faults = faults;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    stats->tail_reserved = lat[(size_t)(0.999 * (n - 1))];
+    free(lat);
+
+    if (stats->grown == 0 && stats->faults) {
+	printf("ERROR: %.0f page faults inside mm_reserve(%.0f)\n",
+	       stats->faults, stats->reserved);
+	errors++;
+    }
+}
+
+/*
+ * The root object of a persistent heap under test: whether the child
+ * that built it died inside the allocator, and where each live block
+ * of the trace is, relative to the root, and how big it is
+ */
+typedef struct {
+    long off;   /* block - root, or 0 if the block is not live */
+    int size;   /* payload bytes, each set to the id's low byte */
+} persist_ent_t;
+
+typedef struct {
+    int in_mm;            /* the child died inside the allocator */
+    double ns;            /* replay time of the whole trace (ns) */
+    persist_ent_t ent[];  /* one per block id */
+} persist_root_t;
+
+/* What recovering one crashed heap found, in memory shared with the
+   process that recovered it */
+typedef struct {
+    int check_errors;     /* mm_heap_checkheap problems, before and after */
+    int bad_blocks;       /* listed blocks whose contents were lost */
+    double reopen;        /* time mm_heap_open took (ns) */
+} persist_found_t;
+
+/*
+ * persist_build - In a child process: replay the trace into a fresh
+ *    heap in persist_file, keeping the root up to date with its live
+ *    blocks. With a delay, SIGALRM kills the child that many ns in,
+ *    wherever it is, or SIGKILL at the end if it gets there first.
+ *    Without, the child times the replay, closes the heap and exits.
+ *    A block enters the root only after its contents are written and
+ *    leaves it before it is freed or reallocated, so a crash can leak
+ *    a block but never leave the root pointing at a free one.
+ */
+static void persist_build(trace_t *trace, double delay)
+{
+    volatile persist_root_t *root;
+    persist_ent_t *ent;
+    struct itimerval it;
+    struct timespec t0, t1;
+    mm_heap_t *h;
+    int i, j, index, size;
+    unsigned char *p;
+
+    signal(SIGALRM, SIG_DFL);
+    if ((h = mm_heap_open(persist_file, MAX_HEAP)) == NULL)
+	_exit(1);
+    root = (persist_root_t *) mm_heap_malloc(h, sizeof(persist_root_t) +
+					     trace->num_ids * sizeof(persist_ent_t));
+    if (root == NULL)
+	_exit(1);
+    memset((void *)root, 0, sizeof(persist_root_t) +
+	   trace->num_ids * sizeof(persist_ent_t));
+    ent = (persist_ent_t *)root->ent;
+    mm_heap_set_root(h, (void *)root);
+
+    if (delay > 0) {
+	memset(&it, 0, sizeof(it));
+	it.it_value.tv_sec = (long)(delay / 1e9);
+	it.it_value.tv_usec = (long)(fmod(delay, 1e9) / 1e3);
+	if (it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0)
+	    it.it_value.tv_usec = 1;
+	setitimer(ITIMER_REAL, &it, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+/* Call the allocator, marking in the root that the child is inside */
+#define PERSIST_CALL(call) do {						\
+	root->in_mm = 1;						\
+	call;								\
+	root->in_mm = 0;						\
+    } while (0)
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_heap_malloc/free */
+	case REALLOC:
+	    if (trace->ops[i].type == REALLOC) {
+		p = (unsigned char *)root + ent[index].off;
+		ent[index].off = 0;
+		PERSIST_CALL(p = mm_heap_realloc(h, p, size));
+	    } else
+		PERSIST_CALL(p = mm_heap_malloc(h, size));
+	    if (p == NULL)
+		_exit(1);
+	    memset(p, index & 0xFF, size);
+	    ent[index].size = size;
+	    ent[index].off = (char *)p - (char *)root;
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    break;
+	case FREE:
+	    p = (unsigned char *)root + ent[index].off;
+	    ent[index].off = 0;
+	    PERSIST_CALL(mm_heap_free(h, p));
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		p = (unsigned char *)root + ent[j].off;
+		ent[j].off = 0;
+		PERSIST_CALL(mm_heap_free(h, p));
+	    }
+	    break;
+	}
+    }
+#undef PERSIST_CALL
+
+    if (delay > 0)
+	kill(getpid(), SIGKILL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    root->ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    mm_heap_close(h);
+    _exit(0);
+}
+
+/*
+ * persist_recover - In a child process: reopen the heap, run
+ *    mm_heap_checkheap on it, check the contents of every block the
+ *    root lists, free them all and check the heap once more. A heap
+ *    damaged badly enough to crash this child counts as broken.
+ */
+static void persist_recover(trace_t *trace, persist_found_t *found)
+{
+    persist_root_t *root;
+    struct timespec t0, t1;
+    mm_heap_t *h;
+    unsigned char *p;
+    int i, k;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((h = mm_heap_open(persist_file, 0)) == NULL)
+	_exit(1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    found->reopen = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+    if ((found->check_errors = mm_heap_checkheap(h, 0)) != 0)
+	_exit(0);  /* freeing blocks of a broken heap proves nothing */
+    if ((root = (persist_root_t *) mm_heap_root(h)) == NULL)
+	_exit(1);
+    for (i = 0; i < trace->num_ids; i++) {
+	if (root->ent[i].off == 0)
+	    continue;
+	p = (unsigned char *)root + root->ent[i].off;
+	for (k = 0; k < root->ent[i].size; k++) {
+	    if (p[k] != (i & 0xFF)) {
+		found->bad_blocks++;
+		break;
+	    }
+	}
+	mm_heap_free(h, p);
+    }
+    mm_heap_free(h, root);
+    mm_heap_set_root(h, NULL);
+    found->check_errors += mm_heap_checkheap(h, 0);
+    mm_heap_close(h);
+    _exit(0);
+}
+
+/*
+ * persist_run - Run persist_build, or persist_recover if found is not
+ *    NULL, in a child and return its wait status
+ */
+static int persist_run(trace_t *trace, double delay, persist_found_t *found)
+{
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) < 0)
+	unix_error("fork failed in eval_mm_persist");
+    if (pid == 0) {
+	if (found == NULL)
+	    persist_build(trace, delay);
+	else
+	    persist_recover(trace, found);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+	unix_error("waitpid failed in eval_mm_persist");
+    return status;
+}
+
+/*
+ * eval_mm_persist - Crash a persistent heap at PERSIST_CRASHES random
+ *    points and recover it each time. A first child replays the whole
+ *    trace to time it; then each child is killed a random time into
+ *    the replay, one point in each of PERSIST_CRASHES equal slices of
+ *    that time, and another reopens the heap and checks it. A crash
+ *    point recovers cleanly if the heap checks out before and after
+ *    freeing every block the root lists and none of them is damaged.
+ */
+static void eval_mm_persist(trace_t *trace, stats_t *stats)
+{
+    static persist_found_t *found = NULL;
+    persist_root_t *root;
+    mm_heap_t *h;
+    double ns;
+    int r, status;
+
+    if (found == NULL &&
+	(found = mmap(NULL, sizeof(*found), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	unix_error("mmap failed in eval_mm_persist");
+
+    unlink(persist_file);
+    status = persist_run(trace, 0, NULL);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	app_error("the persistent heap could not be built (tags engine only)");
+    if ((h = mm_heap_open(persist_file, 0)) == NULL ||
+	(root = (persist_root_t *) mm_heap_root(h)) == NULL)
+	app_error("mm_heap_open could not reopen a closed heap");
+    ns = stats->rebuild = root->ns;
+    mm_heap_close(h);
+
+    stats->crashes = stats->in_mm = stats->clean = stats->broken = 0;
+    stats->bad_blocks = 0;
+    stats->reopen = 0;
+    for (r = 0; r < PERSIST_CRASHES; r++) {
+	unlink(persist_file);
+	status = persist_run(trace, ns * (r + drand48()) / PERSIST_CRASHES,
+			     NULL);
+	if (!WIFSIGNALED(status))
+	    app_error("the persistent heap could not be built");
+	stats->crashes++;
+
+	if ((h = mm_heap_open(persist_file, 0)) == NULL)
+	    app_error("mm_heap_open failed to reopen a crashed heap");
+	if ((root = (persist_root_t *) mm_heap_root(h)) != NULL)
+	    stats->in_mm += root->in_mm;
+	mm_heap_close(h);
+
+	memset(found, 0, sizeof(*found));
+	status = persist_run(trace, 0, found);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+	    found->check_errors != 0)
+	    stats->broken++;
+	else if (found->bad_blocks == 0)
+	    stats->clean++;
+	stats->bad_blocks += found->bad_blocks;
+	stats->reopen += found->reopen / PERSIST_CRASHES;
+    }
+    unlink(persist_file);
+}
+
+/*
+ * eval_mm_latency - Replay the trace, reading the tick counter around
+ *    every request, and record each latency less the timer's own
+ *    overhead in a histogram per request type. Region requests are
+ *    replayed as mallocs and frees, as in eval_mm_freelat. The
+ *    percentiles go into stats and, with -d, the histograms into the
+ *    dump file.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum, char *name,
+			    stats_t *stats)
+{
+    static hist_t hist[LAT_OPS];
+    static const char *op_name[LAT_OPS] = {"malloc", "free", "realloc"};
+    static const double q[3] = {0.5, 0.99, 0.999};
+    int i, j, k, index;
+    uint64_t t0, t1, ovh = ticks_ovhd();
+    double ns = 1e9 / ticks_hz();
+    char *p;
+
+/* Record the latency of the call just made in histogram h */
+#define LAT_RECORD(h) do {						\
+	hist_record(&hist[h], (t1 - t0 > ovh) ? t1 - t0 - ovh : 0);	\
+    } while (0)
+
+    for (k = 0; k < LAT_OPS; k++)
+	hist_reset(&hist[k]);
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    t0 = read_ticks();
+	    p = (char *) mm_malloc(trace->ops[i].size);
+	    t1 = read_ticks();
+	    if (p == NULL)
+		app_error("mm_malloc failed in eval_mm_latency");
+	    LAT_RECORD(0);
+	    trace->blocks[index] = p;
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    break;
+	case REALLOC:
+	    t0 = read_ticks();
+	    p = (char *) mm_realloc(trace->blocks[index], trace->ops[i].size);
+	    t1 = read_ticks();
+	    if (p == NULL)
+		app_error("mm_realloc failed in eval_mm_latency");
+	    LAT_RECORD(2);
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    t0 = read_ticks();
+	    mm_free(trace->blocks[index]);
+	    t1 = read_ticks();
+	    LAT_RECORD(1);
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		t0 = read_ticks();
+		mm_free(trace->blocks[j]);
+		t1 = read_ticks();
+		LAT_RECORD(1);
+	    }
+	    break;
+	}
+    }
+#undef LAT_RECORD
+
+    for (k = 0; k < LAT_OPS; k++) {
+	stats->lat_count[k] = hist[k].count;
+	for (j = 0; j < 3; j++)
+	    stats->lat[k][j] = hist_quantile(&hist[k], q[j]) * ns;
+	stats->lat[k][3] = hist[k].max * ns;
+	if (lat_dump != NULL && hist[k].count > 0) {
+	    fprintf(lat_dump, "# trace %d %s %s (ns)\n",
+		    tracenum, name, op_name[k]);
+	    hist_dump(&hist[k], lat_dump, ns);
+	    fprintf(lat_dump, "\n");
+	}
+    }
+}
+
+/*
+ * tl_sample - Write one sample of the timeline: the throughput of the
+ *    window that ended with request op, and the heap after it
+ */
+static void tl_sample(int tracenum, char *name, int op, double kops,
+		      size_t blocks, size_t bytes, size_t live, int first)
+{
+    if (tl_json)
+	fprintf(tl_file, "%s\n  {\"op\": %d, \"kops\": %.1f, "
+		"\"free_blocks\": %lu, \"free_bytes\": %lu, "
+		"\"heap\": %lu, \"live\": %lu}", first ? "" : ",", op, kops,
+		(unsigned long)blocks, (unsigned long)bytes,
+		(unsigned long)mem_heapsize(), (unsigned long)live);
+    else
+	fprintf(tl_file, "%d,%s,%d,%.1f,%lu,%lu,%lu,%lu\n", tracenum, name,
+		op, kops, (unsigned long)blocks, (unsigned long)bytes,
+		(unsigned long)mem_heapsize(), (unsigned long)live);
+}
+
+/*
+ * eval_mm_timeline - Replay the trace in windows of window requests.
+ *    Each window is timed with the tick counter, and after it the
+ *    free blocks, heap size and live payload bytes are sampled
+ *    outside the timed part. Region requests are replayed as mallocs
+ *    and frees, as in eval_mm_freelat. The slowest and fastest
+ *    windows go into stats and, with -o, every sample into the file.
+ */
+static void eval_mm_timeline(trace_t *trace, int tracenum, char *name,
+			     stats_t *stats)
+{
+    static int traces = 0;   /* traces written to a JSON file so far */
+    int i, j, index, start;
+    size_t live = 0, blocks, bytes;
+    uint64_t t0;
+    double hz = ticks_hz(), kops;
+    char *p;
+
+    stats->windows = 0;
+    stats->max_free = 0;
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_timeline");
+    if (tl_file != NULL && tl_json) {
+	fprintf(tl_file, "%s\n {\"trace\": %d, \"name\": ",
+		traces++ ? "," : "", tracenum);
+	json_string(tl_file, name);
+	fprintf(tl_file, ", \"samples\": [");
+    }
+
+    start = 0;
+    t0 = read_ticks();
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    if ((p = (char *) mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_timeline");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    live += trace->ops[i].size;
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    break;
+	case REALLOC:
+	    if ((p = (char *) mm_realloc(trace->blocks[index],
+					 trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_timeline");
+	    trace->blocks[index] = p;
+	    live += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    live -= trace->block_sizes[index];
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j]) {
+		mm_free(trace->blocks[j]);
+		live -= trace->block_sizes[j];
+	    }
+	    break;
+	}
+
+	/* End of a window: stop the clock, sample, restart it */
+	if (i + 1 - start == window || i + 1 == trace->num_ops) {
+	    kops = (i + 1 - start) * hz / (double)(read_ticks() - t0) / 1e3;
+	    mm_freestats(&blocks, &bytes);
+	    if (tl_file != NULL)
+		tl_sample(tracenum, name, i + 1, kops, blocks, bytes, live,
+			  stats->windows == 0);
+	    if (stats->windows == 0 || kops < stats->kops_min) {
+		stats->kops_min = kops;
+		stats->slow_op = i + 1;
+		stats->slow_free = blocks;
+	    }
+	    if (stats->windows == 0 || kops > stats->kops_max)
+		stats->kops_max = kops;
+	    if (blocks > stats->max_free)
+		stats->max_free = blocks;
+	    stats->windows++;
+	    start = i + 1;
+	    t0 = read_ticks();
+	}
+    }
+    if (tl_file != NULL && tl_json)
+	fprintf(tl_file, "]}");
+}
+
+/*
+ * eval_mm_defer - Measure the free latency of the deferred mode the
+ *    trace was just evaluated in, then util and free latency with
+ *    eager frees for comparison. Deferred mode is back on afterwards.
+ */
+static void eval_mm_defer(trace_t *trace, int tracenum, range_t **ranges,
+			  stats_t *stats)
+{
+    stats->p99 = eval_mm_freelat(trace);
+    mm_set_deferred(0);
+    stats->util_eager = eval_mm_util(trace, tracenum, ranges);
+    stats->p99_eager = eval_mm_freelat(trace);
+    mm_set_deferred(1);
+}
+
+/*
+ * eval_mm_spread - Replay the trace and measure how far apart the
+ *    blocks handed out by consecutive mallocs are: the median distance
+ *    in bytes, and the fraction that are less than a page apart
+ */
+static void eval_mm_spread(trace_t *trace, double *spread, double *near)
+{
+    int i, j, index, n = 0, nnear = 0;
+    double *dist, d;
+    char *p, *last = NULL;
+
+    if ((dist = (double *) malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_spread");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_spread");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case RALLOC: /* regions are replayed with mm_malloc/mm_free */
+	    if ((p = (char *) mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_spread");
+	    trace->blocks[index] = p;
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    if (last != NULL) {
+		d = (p > last) ? p - last : last - p;
+		dist[n++] = d;
+		if (d < mem_pagesize())
+		    nnear++;
+	    }
+	    last = p;
+	    break;
+	case REALLOC:
+	    if ((p = (char *) mm_realloc(trace->blocks[index],
+					 trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_spread");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+	case RFREE:
+	    for (j = trace->region_blocks[index]; j >= 0;
+		 j = trace->next_block[j])
+		mm_free(trace->blocks[j]);
+	    break;
+	}
+    }
+
+    *spread = 0;
+    *near = 0;
+    if (n > 0) {
+	qsort(dist, n, sizeof(double), cmp_double);
+	*spread = dist[n / 2];
+	*near = (double)nnear / n;
+    }
+    free(dist);
+}
+
+/*
+ * eval_mm_reorder - Measure the allocation spread of the reordering
+ *    mode the trace was just evaluated in, then util and spread with
+ *    reordering off for comparison. Reordering is back on afterwards.
+ */
+static void eval_mm_reorder(trace_t *trace, int tracenum, range_t **ranges,
+			    stats_t *stats)
+{
+    eval_mm_spread(trace, &stats->spread, &stats->near);
+    mm_set_reorder(0);
+    stats->util_unordered = eval_mm_util(trace, tracenum, ranges);
+    eval_mm_spread(trace, &stats->spread_unordered, &stats->near_unordered);
+    mm_set_reorder(reorder_every);
+}
+
+/*
+ * make_geo_classes - Build the default geometric table the generated
+ *    classes are measured against: as many classes as mm.c was built
+ *    with, up to the same largest class, each a constant factor bigger
+ *    than the last (rounded up to ALIGNMENT). Where rounding would
+ *    repeat a class, the class is one ALIGNMENT step bigger instead,
+ *    and the classes above it spread over what is left.
+ */
+static void make_geo_classes(void)
+{
+    const unsigned int *gen;
+    double ratio;
+    unsigned int c, top;
+    int i, n;
+
+    n = mm_size_classes(&gen);
+    top = gen[n-1];
+    if ((geo_class = (unsigned int *) malloc(n * sizeof(unsigned int))) == NULL)
+	unix_error("malloc failed in make_geo_classes");
+    geo_class[0] = 2*ALIGNMENT < top ? 2*ALIGNMENT : top;
+    geo_classes = 1;
+    for (i = 1; i < n && geo_class[i-1] < top; i++) {
+	ratio = pow((double)top / geo_class[i-1], 1.0 / (n - i));
+	c = (unsigned int) ceil(geo_class[i-1] * ratio);
+	c = (c + ALIGNMENT-1) & ~(ALIGNMENT-1);
+	if (c <= geo_class[i-1])
+	    c = geo_class[i-1] + ALIGNMENT;
+	if (i == n-1 || c > top)
+	    c = top;
+	geo_class[geo_classes++] = c;
+    }
+}
+
+/*
+ * geo_size_class - The smallest geometric class that holds size bytes,
+ *    or size itself if none does
+ */
+static size_t geo_size_class(size_t size)
+{
+    int lo = 0, hi = geo_classes, mid;
+
+    if (size > geo_class[geo_classes-1])
+	return size;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (geo_class[mid] < size)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return geo_class[lo];
+}
+
+/*
+ * eval_mm_classes - Measure the internal fragmentation that rounding
+ *    each malloc and realloc request of the trace up to its class would
+ *    cost, as a fraction of the class bytes, under the geometric and
+ *    the generated table; requests above the largest class have no
+ *    class and are skipped. Then measure util with the generated
+ *    classes rounding every request in mm.c.
+ */
+static void eval_mm_classes(trace_t *trace, int tracenum, range_t **ranges,
+			    stats_t *stats)
+{
+    double geo = 0, gen = 0, waste_geo = 0, waste_gen = 0;
+    size_t size;
+    int i;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type != ALLOC && trace->ops[i].type != REALLOC)
+	    continue;
+	size = trace->ops[i].size;
+	if (size > geo_class[geo_classes-1])
+	    continue;
+	geo += geo_size_class(size);
+	waste_geo += geo_size_class(size) - size;
+	gen += mm_size_class(size);
+	waste_gen += mm_size_class(size) - size;
+    }
+    stats->frag_geo = (geo > 0) ? waste_geo / geo : 0;
+    stats->frag_gen = (gen > 0) ? waste_gen / gen : 0;
+
+    mm_set_classes(1);
+    stats->util_classes = eval_mm_util(trace, tracenum, ranges);
+    mm_set_classes(0);
+}
+
+/*
+ * eval_mm_handles - Replay the trace with every block allocated through
+ *    a handle, checking that each block keeps its contents however it
+ *    moves. With a nonzero budget, mm_compact runs after each free and
+ *    realloc. Sets *util like eval_mm_util and *moved to the bytes
+ *    moved by compaction; returns 0 if a block was lost or corrupted.
+ */
+static int eval_mm_handles(trace_t *trace, int tracenum, size_t budget,
+			   double *util, double *moved)
+{
+    mm_handle_t *handles;
+    int i, j, k, index, size, oldsize, total_size = 0, max_total_size = 0;
+    unsigned char *p;
+
+    if ((handles = (mm_handle_t *) calloc(trace->num_ids,
+					  sizeof(mm_handle_t))) == NULL)
+	unix_error("calloc failed in eval_mm_handles");
+    *moved = 0;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	free(handles);
+	return 0;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_halloc */
+	case RALLOC:
+	    if ((handles[index] = mm_halloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		free(handles);
+		return 0;
+	    }
+	    if (trace->ops[i].type == RALLOC)
+		region_link(trace, trace->block_regions[index], index);
+	    memset(mm_hlock(handles[index]), index & 0xFF, size);
+	    mm_hunlock(handles[index]);
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC: /* mm_hrealloc */
+	case FREE: /* mm_hfree */
+	    /* Check that the block survived whatever moves it has seen */
+	    oldsize = trace->block_sizes[index];
+	    p = mm_hlock(handles[index]);
+	    for (j = 0; j < oldsize; j++)
+		if (p[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "handle block lost its contents.");
+		    free(handles);
+		    return 0;
+		}
+	    mm_hunlock(handles[index]);
+	    total_size -= oldsize;
+
+	    if (trace->ops[i].type == FREE)
+		mm_hfree(handles[index]);
+	    else {
+		if (mm_hrealloc(handles[index], size) == NULL) {
+		    malloc_error(tracenum, i, "mm_hrealloc failed.");
+		    free(handles);
+		    return 0;
+		}
+		memset(mm_hlock(handles[index]), index & 0xFF, size);
+		mm_hunlock(handles[index]);
+		trace->block_sizes[index] = size;
+		total_size += size;
+	    }
+	    if (budget)
+		*moved += mm_compact(budget);
+	    break;
+
+	case RNEW:
+	    trace->region_blocks[index] = -1;
+	    break;
+
+	case RFREE:
+	    for (k = trace->region_blocks[index]; k >= 0;
+		 k = trace->next_block[k]) {
+		mm_hfree(handles[k]);
+		total_size -= trace->block_sizes[k];
+	    }
+	    if (budget)
+		*moved += mm_compact(budget);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handles");
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+
+    free(handles);
+    *util = (double)max_total_size / (double)(mem_heappeak() + mm_metasize());
+    return 1;
+}
+
+/*
+ * eval_mm_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package.
+ */
+static void eval_mm_speed(void *ptr)
+{
+    int i, j, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_speed");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++)
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = (char *) mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
             if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            block = trace->blocks[index];
+            mm_free(block);
+            break;
+
+	case RNEW: /* mm_region_create */
+	    index = trace->ops[i].index;
+	    if (region_emulate)
+		trace->region_blocks[index] = -1;
+	    else if ((trace->regions[index] = mm_region_create(0)) == NULL)
+		app_error("mm_region_create error in eval_mm_speed");
+	    break;
+
+	case RALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (region_emulate) {
+		if ((p = (char *) mm_malloc(size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_speed");
+		region_link(trace, trace->block_regions[index], index);
+	    }
+	    else if ((p = (char *) mm_region_alloc(
+			  trace->regions[trace->block_regions[index]],
+			  size)) == NULL)
+		app_error("mm_region_alloc error in eval_mm_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case RFREE: /* mm_region_destroy */
+	    index = trace->ops[i].index;
+	    if (region_emulate) {
+		for (j = trace->region_blocks[index]; j >= 0;
+		     j = trace->next_block[j])
+		    mm_free(trace->blocks[j]);
+	    }
+	    else
+		mm_region_destroy(trace->regions[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_valid");
+        }
+}
+
+/*
+ * count_events - Count the hardware events of PERF_RUNS runs of a
+ *    speed test, after one run to warm the caches as fsecs does, and
+ *    store the counts per run in stats
+ */
+static void count_events(fsecs_test_funct f, void *argp, stats_t *stats)
+{
+    int i, k;
+
+    f(argp);
+    perf_start();
+    for (i = 0; i < PERF_RUNS; i++)
+	f(argp);
+    perf_stop(stats->events);
+    for (k = 0; k < PERF_EVENTS; k++)
+	if (stats->events[k] >= 0)
+	    stats->events[k] /= PERF_RUNS;
+}
+
+/*
+ * pin_cpu - Keep the driver on the CPU it is running on, so that the
+ *    samples do not pay for migrations and each other's cold caches
+ */
+static void pin_cpu(void)
+{
+    cpu_set_t set;
+    int cpu = sched_getcpu();
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu < 0 ? 0 : cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	fprintf(stderr, "Warning: could not pin to CPU %d: %s\n",
+		cpu, strerror(errno));
+    else if (verbose)
+	printf("Pinned to CPU %d\n", cpu < 0 ? 0 : cpu);
+}
+
+/*
+ * eval_mm_bench - Run the speed test BENCH_WARMUP times untimed, then
+ *    take bench_samples timed runs, and summarize them in stats: mean,
+ *    median, standard deviation and a percentile bootstrap interval of
+ *    the mean. As many runs with the cache cleared give the cold median.
+ */
+static void eval_mm_bench(speed_t *params, stats_t *stats)
+{
+    int n = bench_samples, i, j;
+    double *x, *boot, sum, var;
+    unsigned int seed = 1;
+
+    if ((x = (double *) malloc(n * sizeof(double))) == NULL ||
+	(boot = (double *) malloc(BENCH_BOOT * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_bench");
+
+    for (i = 0; i < BENCH_WARMUP; i++)
+	eval_mm_speed(params);
+    sum = 0;
+    for (i = 0; i < n; i++) {
+	x[i] = fsecs_sample(eval_mm_speed, params, 0);
+	sum += x[i];
+    }
+    stats->mean = sum / n;
+    var = 0;
+    for (i = 0; i < n; i++)
+	var += (x[i] - stats->mean) * (x[i] - stats->mean);
+    stats->stddev = sqrt(var / (n - 1));
+
+    /* Means of BENCH_BOOT resamples of n, drawn with replacement */
+    for (j = 0; j < BENCH_BOOT; j++) {
+	sum = 0;
+	for (i = 0; i < n; i++)
+	    sum += x[rand_r(&seed) % n];
+	boot[j] = sum / n;
+    }
+    qsort(boot, BENCH_BOOT, sizeof(double), cmp_double);
+    stats->ci_lo = boot[(int)(0.025 * BENCH_BOOT)];
+    stats->ci_hi = boot[(int)(0.975 * BENCH_BOOT) - 1];
+
+    qsort(x, n, sizeof(double), cmp_double);
+    stats->median = (x[(n - 1) / 2] + x[n / 2]) / 2;
+
+    for (i = 0; i < n; i++)
+	x[i] = fsecs_sample(eval_mm_speed, params, 1);
+    qsort(x, n, sizeof(double), cmp_double);
+    stats->cold = (x[(n - 1) / 2] + x[n / 2]) / 2;
+
+    free(x);
+    free(boot);
+}
+
+/*
+ * eval_pool_bench - Check that pool objects are aligned, inside the
+ *    heap and disjoint, then time a pool against mm_malloc/mm_free on
+ *    the same sequence of requests.
+ */
+static void eval_pool_bench(int objsize)
+{
+    poolbench_t bench;
+    range_t *ranges = NULL;
+    mm_pool_t *pool;
+    double pool_secs, mm_secs, ops;
+    int i, j, tmp;
+
+    bench.objsize = objsize;
+    bench.nobjs = POOL_OBJS;
+    bench.rounds = POOL_ROUNDS;
+    if ((bench.order = (int *) malloc(POOL_OBJS * sizeof(int))) == NULL ||
+	(bench.objs = (void **) malloc(POOL_OBJS * sizeof(void *))) == NULL)
+	unix_error("malloc failed in eval_pool_bench");
+
+    /* Free in a fixed pseudo-random order, the hard case for coalescing */
+    srand(1);
+    for (i = 0; i < POOL_OBJS; i++)
+	bench.order[i] = i;
+    for (i = POOL_OBJS - 1; i > 0; i--) {
+	j = rand() % (i + 1);
+	tmp = bench.order[i];
+	bench.order[i] = bench.order[j];
+	bench.order[j] = tmp;
+    }
+
+    /* One validated round */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_pool_bench");
+    if ((pool = mm_pool_create(objsize, 0)) == NULL)
+	app_error("mm_pool_create failed in eval_pool_bench");
+    for (i = 0; i < POOL_OBJS; i++) {
+	if ((bench.objs[i] = mm_pool_get(pool)) == NULL) {
+	    malloc_error(0, i, "mm_pool_get failed.");
+	    return;
+	}
+	if (add_range(&ranges, bench.objs[i], objsize, 0, i) == 0)
+	    return;
+	memset(bench.objs[i], i & 0xFF, objsize);
+    }
+    clear_ranges(&ranges);
+    mm_pool_destroy(pool);
+
+    pool_secs = fsecs(eval_pool_speed, &bench);
+    mm_secs = fsecs(eval_pool_mm_speed, &bench);
+    ops = 2.0 * POOL_OBJS * POOL_ROUNDS;
+
+    printf("Pool benchmark: %d objects of %d bytes, %.0f ops\n",
+	   POOL_OBJS, objsize, ops);
+    printf("%-22s%10.6f secs%8.0f Kops\n", "mm_malloc/mm_free:",
+	   mm_secs, (ops/1e3)/mm_secs);
+    printf("%-22s%10.6f secs%8.0f Kops\n", "mm_pool_get/put:",
+	   pool_secs, (ops/1e3)/pool_secs);
+    printf("Speedup %.1fx\n", mm_secs/pool_secs);
+
+    free(bench.order);
+    free(bench.objs);
+}
+
+/*
+ * eval_pool_speed - Pool side of the pool benchmark, timed by fsecs()
+ */
+static void eval_pool_speed(void *ptr)
+{
+    poolbench_t *bench = (poolbench_t *)ptr;
+    mm_pool_t *pool;
+    int i, r;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_pool_speed");
+    if ((pool = mm_pool_create(bench->objsize, 0)) == NULL)
+	app_error("mm_pool_create failed in eval_pool_speed");
+
+    for (r = 0; r < bench->rounds; r++) {
+	for (i = 0; i < bench->nobjs; i++)
+	    if ((bench->objs[i] = mm_pool_get(pool)) == NULL)
+		app_error("mm_pool_get failed in eval_pool_speed");
+	for (i = 0; i < bench->nobjs; i++)
+	    mm_pool_put(pool, bench->objs[bench->order[i]]);
+    }
+    mm_pool_destroy(pool);
+}
+
+/*
+ * eval_pool_mm_speed - mm_malloc side of the pool benchmark, timed
+ *    by fsecs()
+ */
+static void eval_pool_mm_speed(void *ptr)
+{
+    poolbench_t *bench = (poolbench_t *)ptr;
+    int i, r;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_pool_mm_speed");
+
+    for (r = 0; r < bench->rounds; r++) {
+	for (i = 0; i < bench->nobjs; i++)
+	    if ((bench->objs[i] = mm_malloc(bench->objsize)) == NULL)
+		app_error("mm_malloc failed in eval_pool_mm_speed");
+	for (i = 0; i < bench->nobjs; i++)
+	    mm_free(bench->objs[bench->order[i]]);
+    }
+}
+
+/*
+ * eval_fit_bench - Time a search for the first free block that fits,
+ *    over free lists of FIT_MIN_BLOCKS to FIT_MAX_BLOCKS blocks: a
+ *    pointer chase through a list whose nodes are scattered like free
+ *    blocks in a heap, against each fitscan kernel over a packed array.
+ */
+static void eval_fit_bench(void)
+{
+    fitbench_t bench;
+    char *nodes;
+    size_t *order, i, j, tmp;
+    int kind;
+    double secs;
+
+    if ((nodes = (char *) malloc(FIT_MAX_BLOCKS * FIT_NODE_SIZE)) == NULL ||
+	(order = (size_t *) malloc(FIT_MAX_BLOCKS * sizeof(size_t))) == NULL ||
+	(bench.sizes = (uint32_t *) malloc(FIT_MAX_BLOCKS * sizeof(uint32_t)))
+	== NULL)
+	unix_error("malloc failed in eval_fit_bench");
+
+    printf("Free-block search: ns per search, only the last block fits\n");
+    printf("%8s%12s", "blocks", "list");
+    for (kind = 0; kind < FIT_KERNELS; kind++)
+	printf("%12s", fit_scan_name(kind));
+    printf("\n");
+
+    srand(1);
+    for (bench.n = FIT_MIN_BLOCKS; bench.n <= FIT_MAX_BLOCKS; bench.n *= 10) {
+	/* Link the nodes in a shuffled order, as a LIFO list would be */
+	for (i = 0; i < bench.n; i++)
+	    order[i] = i;
+	for (i = bench.n - 1; i > 0; i--) {
+	    j = rand() % (i + 1);
+	    tmp = order[i];
+	    order[i] = order[j];
+	    order[j] = tmp;
+	}
+	bench.list = NULL;
+	for (i = bench.n; i-- > 0; ) {
+	    fitnode_t *node = (fitnode_t *)(nodes + order[i] * FIT_NODE_SIZE);
+	    node->hdr = (i == bench.n - 1) ? 4096 : 16 + 8*(i % 64);
+	    bench.sizes[i] = node->hdr;
+	    node->next = bench.list;
+	    bench.list = node;
+	}
+
+	bench.reps = FIT_RUN_BLOCKS / bench.n;
+	printf("%8lu", (unsigned long)bench.n);
+	for (kind = -1; kind < FIT_KERNELS; kind++) {
+	    if (kind < 0)
+		bench.scan = NULL;
+	    else if ((bench.scan = fit_scan_kernel(kind)) == NULL) {
+		printf("%12s", "-");
+		continue;
+	    }
+	    secs = fsecs(eval_fit_speed, &bench);
+	    if (bench.found != (size_t)bench.reps * (bench.n - 1))
+		app_error("wrong block found in eval_fit_bench");
+	    printf("%12.1f", secs * 1e9 / bench.reps);
+	}
+	printf("\n");
+    }
+
+    free(nodes);
+    free(order);
+    free(bench.sizes);
+}
+
+/*
+ * eval_fit_speed - One timed run of the search benchmark, called by
+ *    fsecs(). Searches for a 4096-byte block bench->reps times.
+ */
+static void eval_fit_speed(void *ptr)
+{
+    fitbench_t *bench = (fitbench_t *)ptr;
+    fitnode_t *node;
+    size_t i, found = 0;
+    int r;
+
+    for (r = 0; r < bench->reps; r++) {
+	if (bench->scan != NULL)
+	    found += bench->scan(bench->sizes, bench->n, 4096);
+	else {
+	    for (i = 0, node = bench->list; node->hdr < 4096; node = node->next)
+		i++;
+	    found += i;
+	}
+    }
+    bench->found = found;
+}
+
+/*
+ * eval_shared_bench - Fork 1, 2, 4, ... up to workers processes on
+ *    one shared heap. Each one passes the buffers it allocates to the
+ *    next in a ring, which checks and frees them, so most frees are
+ *    of another process's blocks. Reports the throughput, the remote
+ *    frees, damaged buffers and the heap check after each run.
+ */
+static void eval_shared_bench(int workers)
+{
+    mm_heap_t *h;
+    inbox_t *boxes;
+    struct timespec t0, t1;
+    long remote, bad, k;
+    double secs, ops;
+    int n, i, status, failed, check;
+    pid_t *pids;
+
+    if ((h = mm_heap_share(MAX_HEAP)) == NULL)
+	app_error("mm_heap_share failed (tags engine only)");
+    if ((boxes = (inbox_t *) mm_heap_malloc(h, workers * sizeof(inbox_t))) == NULL)
+	app_error("mm_heap_malloc failed in eval_shared_bench");
+    mm_heap_set_root(h, boxes);
+    if ((pids = (pid_t *) malloc(workers * sizeof(pid_t))) == NULL)
+	unix_error("malloc failed in eval_shared_bench");
+
+    printf("Shared heap: %d mallocs per worker of up to %d bytes, "
+	   "passed to the next worker\n", SHARED_OPS, SHARED_MAXSIZE);
+    printf("%8s%12s%10s%14s%8s%8s\n",
+	   "workers", "secs", "Kops", "remote frees", "bad", "check");
+    for (n = 1; ; n = (n * 2 < workers) ? n * 2 : workers) {
+	memset(boxes, 0, n * sizeof(inbox_t));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+	    if ((pids[i] = fork()) < 0)
+		unix_error("fork failed in eval_shared_bench");
+	    if (pids[i] == 0)
+		shared_worker(mm_heap_fd(h), i, n);
+	}
+	failed = 0;
+	for (i = 0; i < n; i++) {
+	    if (waitpid(pids[i], &status, 0) < 0)
+		unix_error("waitpid failed in eval_shared_bench");
+	    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failed++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	/* the buffers still in flight are freed by yet another process */
+	remote = 0;
+	bad = 0;
+	for (i = 0; i < n; i++) {
+	    for (k = boxes[i].head; k < boxes[i].tail; k++)
+		mm_heap_free(h, (char *)boxes + boxes[i].slot[k % SHARED_RING]);
+	    remote += boxes[i].remote;
+	    bad += boxes[i].bad;
+	}
+	check = mm_heap_checkheap(h, 0);
+	if (failed || bad || check) {
+	    printf("ERROR: %d workers failed, %ld bad buffers, %d heap problems\n",
+		   failed, bad, check);
+	    errors++;
+	}
+
+	ops = 2.0 * n * SHARED_OPS;
+	printf("%8d%12.6f%10.0f%14ld%8ld%8d\n",
+	       n, secs, (ops/1e3)/secs, remote, bad, check);
+	if (n == workers)
+	    break;
+    }
+
+    mm_heap_free(h, boxes);
+    mm_heap_close(h);
+    free(pids);
+}
+
+/*
+ * shared_worker - One worker of the shared-heap benchmark. It maps the
+ *    heap afresh with mm_heap_attach, so its addresses differ from its
+ *    parent's, and exits when done.
+ */
+static void shared_worker(int fd, int id, int n)
+{
+    mm_heap_t *h;
+    inbox_t *boxes, *in, *out;
+    unsigned char *p;
+    long head, tail;
+    int i, k, size;
+
+    if ((h = mm_heap_attach(fd)) == NULL)
+	_exit(1);
+    boxes = (inbox_t *) mm_heap_root(h);
+    in = &boxes[id];
+    out = &boxes[(id + 1) % n];
+    srand(id + 1);
+
+    for (i = 0; i < SHARED_OPS; i++) {
+	/* take delivery: check each buffer and free it */
+	tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+	for (head = in->head; head < tail; head++) {
+	    p = (unsigned char *)boxes + in->slot[head % SHARED_RING];
+	    size = *(int *)p;
+	    for (k = sizeof(int); k < size; k++) {
+		if (p[k] != (unsigned char)(size + k)) {
+		    in->bad++;
+		    break;
+		}
+	    }
+	    mm_heap_free(h, p);
+	    if (out != in)   /* with one worker, it is its own producer */
+		in->remote++;
+	}
+	__atomic_store_n(&in->head, head, __ATOMIC_RELEASE);
+
+	/* fill a buffer and pass it on, or drop it if the next is behind */
+	size = sizeof(int) + rand() % SHARED_MAXSIZE;
+	if ((p = (unsigned char *) mm_heap_malloc(h, size)) == NULL)
+	    _exit(1);
+	*(int *)p = size;
+	for (k = sizeof(int); k < size; k++)
+	    p[k] = (unsigned char)(size + k);
+	tail = out->tail;
+	if (tail - __atomic_load_n(&out->head, __ATOMIC_ACQUIRE) < SHARED_RING) {
+	    out->slot[tail % SHARED_RING] = (char *)p - (char *)boxes;
+	    __atomic_store_n(&out->tail, tail + 1, __ATOMIC_RELEASE);
+	} else
+	    mm_heap_free(h, p);
+    }
+    mm_heap_close(h);
+    _exit(0);
+}
+
+/*
+ * eval_heaps_bench - Exercise independent heaps (mm_heap_create): two
+ *    heaps used in turn, a heap filled to its maxsize, and heaps
+ *    created and destroyed in a loop.
+ */
+static void eval_heaps_bench(void)
+{
+    heaps_interleave();
+    heaps_fill();
+    heaps_cycle();
+}
+
+/*
+ * heaps_interleave - Spread random mallocs and frees over two heaps,
+ *    checking the contents of every block before it is freed and each
+ *    heap with mm_heap_checkheap along the way. The blocks of the two
+ *    heaps must also lie in disjoint extents of memory.
+ */
+static void heaps_interleave(void)
+{
+    mm_heap_t *h[2];
+    unsigned char *p[2][HEAPS_SLOTS];
+    int size[2][HEAPS_SLOTS];
+    char *lo[2], *hi[2];
+    int i, j, k, s, bad, check;
+
+    for (j = 0; j < 2; j++) {
+	if ((h[j] = mm_heap_create(HEAPS_SIZE)) == NULL)
+	    app_error("mm_heap_create failed in heaps_interleave");
+	lo[j] = hi[j] = NULL;
+    }
+    memset(p, 0, sizeof(p));
+    bad = check = 0;
+
+    srand(1);
+    for (i = 0; i < HEAPS_OPS; i++) {
+	j = rand() % 2;
+	s = rand() % HEAPS_SLOTS;
+	if (p[j][s] != NULL) {
+	    for (k = 0; k < size[j][s]; k++) {
+		if (p[j][s][k] != HEAPS_BYTE(j, s, k)) {
+		    bad++;
+		    break;
+		}
+	    }
+	    mm_heap_free(h[j], p[j][s]);
+	    p[j][s] = NULL;
+	}
+	else {
+	    size[j][s] = 1 + rand() % HEAPS_MAXSIZE;
+	    if ((p[j][s] = mm_heap_malloc(h[j], size[j][s])) == NULL) {
+		malloc_error(0, i, "mm_heap_malloc failed.");
+		break;
+	    }
+	    if (!IS_ALIGNED(p[j][s])) {
+		malloc_error(0, i, "mm_heap_malloc returned an unaligned block.");
+		mm_heap_free(h[j], p[j][s]);
+		p[j][s] = NULL;
+		break;
+	    }
+	    for (k = 0; k < size[j][s]; k++)
+		p[j][s][k] = HEAPS_BYTE(j, s, k);
+	    if (lo[j] == NULL || (char *)p[j][s] < lo[j])
+		lo[j] = (char *)p[j][s];
+	    if (hi[j] == NULL || (char *)p[j][s] + size[j][s] > hi[j])
+		hi[j] = (char *)p[j][s] + size[j][s];
+	}
+	if ((i + 1) % HEAPS_CHECK == 0)
+	    check += mm_heap_checkheap(h[0], 0) + mm_heap_checkheap(h[1], 0);
+    }
+
+    /* check and free what is left, then check both heaps once more */
+    for (j = 0; j < 2; j++) {
+	for (s = 0; s < HEAPS_SLOTS; s++) {
+	    if (p[j][s] == NULL)
+		continue;
+	    for (k = 0; k < size[j][s]; k++) {
+		if (p[j][s][k] != HEAPS_BYTE(j, s, k)) {
+		    bad++;
+		    break;
+		}
+	    }
+	    mm_heap_free(h[j], p[j][s]);
+	}
+	check += mm_heap_checkheap(h[j], 0);
+    }
+
+    printf("Two heaps of %d KB, %d requests of up to %d bytes in turn:\n",
+	   HEAPS_SIZE / 1024, HEAPS_OPS, HEAPS_MAXSIZE);
+    printf("  %d damaged blocks, %d heap problems, extents %s\n", bad, check,
+	   (hi[0] > lo[1] && hi[1] > lo[0]) ? "OVERLAP" : "disjoint");
+    if (bad || check || (hi[0] > lo[1] && hi[1] > lo[0]))
+	errors++;
+
+    mm_heap_destroy(h[0]);
+    mm_heap_destroy(h[1]);
+}
+
+/*
+ * heaps_fill - Fill one heap with HEAPS_FILL-byte blocks until
+ *    mm_heap_malloc fails, then check that the full heap is intact,
+ *    that a free in it makes room again and that a second heap is
+ *    unaffected.
+ */
+static void heaps_fill(void)
+{
+    mm_heap_t *full, *other;
+    void **blocks;
+    int n, max = HEAPS_SIZE / HEAPS_FILL;
+    int check, refill = 0, spare;
+
+    if ((full = mm_heap_create(HEAPS_SIZE)) == NULL ||
+	(other = mm_heap_create(HEAPS_SIZE)) == NULL)
+	app_error("mm_heap_create failed in heaps_fill");
+    if ((blocks = (void **) malloc(max * sizeof(void *))) == NULL)
+	unix_error("malloc failed in heaps_fill");
+
+    for (n = 0; n < max; n++)
+	if ((blocks[n] = mm_heap_malloc(full, HEAPS_FILL)) == NULL)
+	    break;
+    check = mm_heap_checkheap(full, 0);
+    spare = mm_heap_malloc(other, HEAPS_FILL) != NULL;
+    if (n > 0) {
+	mm_heap_free(full, blocks[n / 2]);
+	refill = mm_heap_malloc(full, HEAPS_FILL) != NULL;
+    }
+    check += mm_heap_checkheap(full, 0) + mm_heap_checkheap(other, 0);
+
+    printf("Heap of %d KB filled with %d blocks of %d bytes (%.1f%% payload):\n",
+	   HEAPS_SIZE / 1024, n, HEAPS_FILL, 100.0 * n * HEAPS_FILL / HEAPS_SIZE);
+    printf("  %d heap problems, malloc after a free %s, other heap %s\n",
+	   check, refill ? "ok" : "FAILED", spare ? "ok" : "FAILED");
+    if (n == max || n == 0 || check || !refill || !spare) {
+	if (n == max)
+	    printf("ERROR: mm_heap_malloc never failed in a full heap\n");
+	errors++;
+    }
+
+    mm_heap_destroy(full);
+    mm_heap_destroy(other);
+    free(blocks);
+}
+
+/*
+ * heaps_cycle - Create a heap, allocate n blocks in it and time freeing
+ *    them one by one; allocate them again and time mm_heap_destroy,
+ *    which releases the heap without visiting them. mincore then
+ *    checks that the heap's pages are no longer mapped.
+ */
+static void heaps_cycle(void)
+{
+    mm_heap_t *h;
+    void **blocks;
+    struct timespec t0, t1;
+    double free_ns, destroy_ns;
+    unsigned char vec;
+    char *page;
+    int n, c, i, mapped;
+
+    if ((blocks = (void **) malloc(HEAPS_MAX_BLOCKS * sizeof(void *))) == NULL)
+	unix_error("malloc failed in heaps_cycle");
+
+    printf("Heaps of %d MB created and destroyed %d times per row:\n",
+	   HEAPS_CYCLE_SIZE / (1<<20), HEAPS_CYCLES);
+    printf("%10s%18s%18s%10s\n", "blocks", "free each (us)", "destroy (us)",
+	   "mapped");
+    for (n = HEAPS_MIN_BLOCKS; n <= HEAPS_MAX_BLOCKS; n *= 10) {
+	free_ns = destroy_ns = 0;
+	mapped = 0;
+	for (c = 0; c < HEAPS_CYCLES; c++) {
+	    if ((h = mm_heap_create(HEAPS_CYCLE_SIZE)) == NULL)
+		app_error("mm_heap_create failed in heaps_cycle");
+	    if (!heaps_alloc(h, blocks, n)) {
+		mm_heap_destroy(h);
+		free(blocks);
+		return;
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    for (i = 0; i < n; i++)
+		mm_heap_free(h, blocks[i]);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    free_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	    if (!heaps_alloc(h, blocks, n)) {
+		mm_heap_destroy(h);
+		free(blocks);
+		return;
+	    }
+	    page = (char *)((size_t)blocks[0] & ~(mem_pagesize() - 1));
+
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    mm_heap_destroy(h);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    destroy_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	    if (mincore(page, 1, &vec) == 0)
+		mapped++;
+	}
+	printf("%10d%18.1f%18.1f%10d\n", n, free_ns / HEAPS_CYCLES / 1e3,
+	       destroy_ns / HEAPS_CYCLES / 1e3, mapped);
+	if (mapped) {
+	    printf("ERROR: mm_heap_destroy left %d heaps mapped\n", mapped);
+	    errors++;
+	}
+    }
+    free(blocks);
+}
+
+/*
+ * heaps_alloc - Allocate n ALIGNMENT-byte blocks from h for heaps_cycle
+ */
+static int heaps_alloc(mm_heap_t *h, void **blocks, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if ((blocks[i] = mm_heap_malloc(h, ALIGNMENT)) == NULL) {
+	    malloc_error(0, i, "mm_heap_malloc failed.");
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_stream - Replay a trace once, as it is read, rather than
+ *    loading it first. The block table is indexed by the stream's
+ *    slots, so it grows with the blocks live at once; only the time
+ *    spent in the allocator counts toward the throughput, not the
+ *    time spent waiting for the reader. With -V a progress line
+ *    every STREAM_REPORT requests shows the driver's memory so far.
+ */
+static void eval_mm_stream(char *path)
+{
+    tstream_t *ts;
+    traceop_t *ops;
+    char **blocks = NULL, *p;
+    int *sizes = NULL;
+    int n, slots = 0, nslots = 0, i, index, size;
+    long long total_size = 0, max_total_size = 0;
+    double nops = 0, secs = 0, util, table, next_report = STREAM_REPORT;
+    struct timespec t0, t1;
+    struct rusage ru;
+
+    if ((ts = tstream_open(path, STREAM_CHUNK)) == NULL) {
+	sprintf(msg, "Could not open %s in eval_mm_stream", path);
+	unix_error(msg);
+    }
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stream");
+
+    while ((ops = tstream_next(ts, &n, &slots)) != NULL) {
+	/* make room for the slots this chunk uses */
+	if (slots > nslots) {
+	    nslots = (slots > 2 * nslots) ? slots : 2 * nslots;
+	    blocks = (char **) realloc(blocks, nslots * sizeof(char *));
+	    sizes = (int *) realloc(sizes, nslots * sizeof(int));
+	    if (blocks == NULL || sizes == NULL)
+		unix_error("realloc failed in eval_mm_stream");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+	    index = ops[i].index;
+	    switch (ops[i].type) {
+	    case ALLOC: /* mm_malloc */
+		size = ops[i].size;
+		if ((p = (char *) mm_malloc(size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_stream");
+		blocks[index] = p;
+		sizes[index] = size;
+		total_size += size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		size = ops[i].size;
+		if ((p = (char *) mm_realloc(blocks[index], size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_stream");
+		blocks[index] = p;
+		total_size += size - sizes[index];
+		sizes[index] = size;
+		break;
+
+	    case FREE: /* mm_free */
+		mm_free(blocks[index]);
+		total_size -= sizes[index];
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream");
+	    }
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	nops += n;
+
+	if (verbose > 1 && nops >= next_report) {
+	    printf("%12.0f ops %10.0f Kops %5.1f%% util %8.1f MB driver\n",
+		   nops, (nops/1e3)/secs,
+		   100.0 * max_total_size / (mem_heappeak() + mm_metasize()),
+		   (tstream_bytes(ts) + nslots * (sizeof(char *) + sizeof(int)))
+		   / 1e6);
+	    next_report += STREAM_REPORT;
+	}
+    }
+    if (tstream_error(ts) != NULL) {
+	sprintf(msg, "%s: %s", path, tstream_error(ts));
+	app_error(msg);
+    }
+
+    util = (double)max_total_size / (double)(mem_heappeak() + mm_metasize());
+    table = nslots * (sizeof(char *) + sizeof(int));
+    getrusage(RUSAGE_SELF, &ru);
+    printf("Streamed %s in chunks of %d requests:\n", path, STREAM_CHUNK);
+    printf("%12s%6s%10s%8s%12s%14s%12s%10s\n", "ops", "util", "secs",
+	   "Kops", "wait secs", "live blocks", "driver MB", "RSS MB");
+    printf("%12.0f%5.0f%%%10.6f%8.0f%12.6f%14d%12.2f%10.1f\n",
+	   nops, util * 100.0, secs, (nops/1e3)/secs, tstream_waited(ts),
+	   slots, (tstream_bytes(ts) + table) / 1e6, ru.ru_maxrss / 1e3);
+
+    tstream_close(ts);
+    free(blocks);
+    free(sizes);
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, j, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = (char *) realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case RNEW: /* regions are emulated with malloc/free */
+	    trace->region_blocks[trace->ops[i].index] = -1;
+	    break;
+
+	case RALLOC:
+	    if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    region_link(trace, trace->block_regions[trace->ops[i].index],
+			trace->ops[i].index);
+	    break;
+
+	case RFREE:
+	    for (j = trace->region_blocks[trace->ops[i].index]; j >= 0;
+		 j = trace->next_block[j])
+		free(trace->blocks[j]);
+	    break;
 
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i, j;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = (char *) malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = (char *) realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
+
+	    trace->blocks[index] = newp;
+	    break;
+
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    free(block);
+	    break;
+
+	case RNEW: /* regions are emulated with malloc/free */
+	    trace->region_blocks[trace->ops[i].index] = -1;
+	    break;
+
+	case RALLOC:
+	    index = trace->ops[i].index;
+	    if ((p = (char *) malloc(trace->ops[i].size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    region_link(trace, trace->block_regions[index], index);
+	    break;
+
+	case RFREE:
+	    for (j = trace->region_blocks[trace->ops[i].index]; j >= 0;
+		 j = trace->next_block[j])
+		free(trace->blocks[j]);
+	    break;
+	}
+    }
+}
+
+/***************************************************************
+ * Results files (--json) and comparison with a baseline (--baseline)
+ ***************************************************************/
+
+#ifndef BUILD_CFLAGS
+#define BUILD_CFLAGS "unknown"  /* set by the Makefile */
+#endif
+
+/*
+ * json_string - Write s to f as a JSON string
+ */
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fputc('\\', f);
+	if ((unsigned char)*s >= ' ')
+	    fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * cpu_model - The CPU's model name from /proc/cpuinfo, else the
+ *     machine type uname reports
+ */
+static void cpu_model(char *buf, size_t len)
+{
+    static const char *keys[] = {"model name", "Model", "cpu model", NULL};
+    char line[MAXLINE], *p;
+    struct utsname u;
+    FILE *f;
+    int k;
+
+    if ((f = fopen("/proc/cpuinfo", "r")) != NULL) {
+	while (fgets(line, sizeof(line), f) != NULL) {
+	    for (k = 0; keys[k] != NULL; k++) {
+		if (strncmp(line, keys[k], strlen(keys[k])) == 0 &&
+		    (p = strchr(line, ':')) != NULL) {
+		    for (p++; *p == ' ' || *p == '\t'; p++)
+			;
+		    p[strcspn(p, "\n")] = '\0';
+		    snprintf(buf, len, "%s", p);
+		    fclose(f);
+		    return;
+		}
+	    }
+	}
+	fclose(f);
+    }
+    snprintf(buf, len, "%s", uname(&u) == 0 ? u.machine : "unknown");
+}
+
+/*
+ * write_json - Write every field of each trace's stats and the
+ *     environment they were measured in to path, one line per trace
+ */
+static void write_json(char *path, int n, char **names, stats_t *stats,
+		       double perfindex)
+{
+    char cpu[MAXLINE];
+    const statfield_t *sf;
+    FILE *f;
+    size_t k;
+    double v;
+    int i, j;
+
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error(path);
+    cpu_model(cpu, sizeof(cpu));
+    fprintf(f, "{\n \"env\": {\"cpu\": ");
+    json_string(f, cpu);
+    fprintf(f, ", \"compiler\": ");
+#ifdef __clang__
+    json_string(f, "clang " __clang_version__);
+#else
+    json_string(f, "gcc " __VERSION__);
+#endif
+    fprintf(f, ", \"cflags\": ");
+    json_string(f, BUILD_CFLAGS);
+#ifdef DEBUG
+    fprintf(f, ", \"variant\": \"debug\"");
+#else
+    fprintf(f, ", \"variant\": \"release\"");
+#endif
+    fprintf(f, ", \"engine\": \"%s\", \"timer\": \"%s\", \"samples\": %d},\n",
+	    mm_engine_name(), USE_FCYC ? "fcyc" : USE_ITIMER ? "itimer" :
+	    "gettod", bench_samples);
+    fprintf(f, " \"perfindex\": %.3f,\n \"traces\": [\n", perfindex);
+    for (i = 0; i < n; i++) {
+	fprintf(f, "  {\"name\": ");
+	json_string(f, names[i]);
+	for (k = 0; k < sizeof(stat_fields) / sizeof(stat_fields[0]); k++) {
+	    sf = &stat_fields[k];
+	    fprintf(f, ", \"%s\": ", sf->name);
+	    if (sf->is_int)
+		fprintf(f, "%d", *(int *)((char *)&stats[i] + sf->offset));
+	    else if (sf->count == 1)
+		fprintf(f, "%.9g", *(double *)((char *)&stats[i] + sf->offset));
+	    else {
+		for (j = 0; j < sf->count; j++) {
+		    v = ((double *)((char *)&stats[i] + sf->offset))[j];
+		    fprintf(f, "%s", j ? ", " : "[");
+		    /* An event that was not counted is null, not 0 */
+		    if (sf->offset == offsetof(stats_t, events) &&
+			(!counters || v < 0))
+			fprintf(f, "null");
+		    else
+			fprintf(f, "%.9g", v);
+		}
+		fprintf(f, "]");
+	    }
+	}
+	fprintf(f, "}%s\n", i < n - 1 ? "," : "");
+    }
+    fprintf(f, " ]\n}\n");
+    fclose(f);
+}
+
+/*
+ * The baseline is read back with a small recursive descent parser, so
+ * that the same document reads whatever its layout or key order.
+ * Anything that is not JSON is an error.
+ */
+typedef struct {
+    const char *p;      /* next character */
+    const char *start;  /* the whole document */
+    const char *path;
+} json_t;
+
+/*
+ * json_fail - Report a syntax error at the current position and exit
+ */
+static void json_fail(json_t *js, const char *what)
+{
+    char msg[MAXLINE];
+
+    snprintf(msg, sizeof(msg), "%s: %s at byte %ld", js->path, what,
+	     (long)(js->p - js->start));
+    app_error(msg);
+}
+
+/*
+ * json_ws - Step past white space
+ */
+static void json_ws(json_t *js)
+{
+    while (*js->p == ' ' || *js->p == '\t' || *js->p == '\n' ||
+	   *js->p == '\r')
+	js->p++;
+}
+
+/*
+ * json_expect - Step past the character c, after any white space
+ */
+static void json_expect(json_t *js, char c)
+{
+    char what[32];
+
+    json_ws(js);
+    if (*js->p != c) {
+	snprintf(what, sizeof(what), "expected '%c'", c);
+	json_fail(js, what);
+    }
+    js->p++;
+}
+
+/*
+ * json_more - Between the items of an object or array (the opening
+ *     bracket already read, and i items so far): step past the ','
+ *     before the next item and return 1, or past the closing bracket
+ *     close and return 0
+ */
+static int json_more(json_t *js, char close, int i)
+{
+    json_ws(js);
+    if (*js->p == close) {
+	js->p++;
+	return 0;
+    }
+    if (i > 0)
+	json_expect(js, ',');
+    return 1;
+}
+
+/*
+ * json_read_string - Read a string into buf (truncated to len bytes),
+ *     or just step past it if buf is NULL. \u escapes read as '?'.
+ */
+static void json_read_string(json_t *js, char *buf, size_t len)
+{
+    size_t n = 0;
+    char c;
+
+    json_expect(js, '"');
+    while ((c = *js->p++) != '"') {
+	if (c == '\0') {
+	    js->p--;
+	    json_fail(js, "unterminated string");
+	}
+	if (c == '\\') {
+	    switch (c = *js->p++) {
+	    case 'n': c = '\n'; break;
+	    case 't': c = '\t'; break;
+	    case 'r': c = '\r'; break;
+	    case 'b': c = '\b'; break;
+	    case 'f': c = '\f'; break;
+	    case '"': case '\\': case '/': break;
+	    case 'u':
+		if (strspn(js->p, "0123456789abcdefABCDEF") < 4)
+		    json_fail(js, "bad \\u escape");
+		js->p += 4;
+		c = '?';
+		break;
+	    default:
+		js->p--;
+		json_fail(js, "bad escape");
+	    }
+	}
+	if (buf != NULL && n + 1 < len)
+	    buf[n++] = c;
+    }
+    if (buf != NULL && len > 0)
+	buf[n] = '\0';
+}
+
+/*
+ * json_read_number - Read a number; null reads as 0
+ */
+static double json_read_number(json_t *js)
+{
+    char *end;
+    double v;
+
+    json_ws(js);
+    if (strncmp(js->p, "null", 4) == 0) {
+	js->p += 4;
+	return 0;
+    }
+    v = strtod(js->p, &end);
+    if (end == js->p)
+	json_fail(js, "expected a number");
+    js->p = end;
+    return v;
+}
+
+/*
+ * json_key - Read the key of an object member and the ':' after it
+ */
+static void json_key(json_t *js, char *key, size_t len)
+{
+    json_read_string(js, key, len);
+    json_expect(js, ':');
+}
+
+/*
+ * json_skip - Step past a value of any type
+ */
+static void json_skip(json_t *js)
+{
+    static const char *words[] = {"true", "false", "null", NULL};
+    int i, k;
+
+    json_ws(js);
+    switch (*js->p) {
+    case '{':
+	js->p++;
+	for (i = 0; json_more(js, '}', i); i++) {
+	    json_read_string(js, NULL, 0);
+	    json_expect(js, ':');
+	    json_skip(js);
+	}
+	return;
+    case '[':
+	js->p++;
+	for (i = 0; json_more(js, ']', i); i++)
+	    json_skip(js);
+	return;
+    case '"':
+	json_read_string(js, NULL, 0);
+	return;
+    }
+    for (k = 0; words[k] != NULL; k++) {
+	if (strncmp(js->p, words[k], strlen(words[k])) == 0) {
+	    js->p += strlen(words[k]);
+	    return;
+	}
+    }
+    json_read_number(js);
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * read_baseline - Read the traces of a file write_json wrote into
+ *     base (at most BASE_TRACES) and its samples per trace into
+ *     *samples. Returns the number of traces.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static int read_baseline(char *path, base_t *base, int *samples)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* malloc */
-	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+    char key[MAXLINE], *buf;
+    base_t *b;
+    json_t js;
+    FILE *f;
+    long size;
+    int n = 0, i, j, k;
+
+    if ((f = fopen(path, "r")) == NULL)
+	unix_error(path);
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 ||
+	fseek(f, 0, SEEK_SET) < 0)
+	unix_error(path);
+    if ((buf = malloc(size + 1)) == NULL)
+	unix_error("malloc failed in read_baseline");
+    if (fread(buf, 1, size, f) != (size_t)size)
+	unix_error(path);
+    buf[size] = '\0';
+    fclose(f);
+
+    js.p = js.start = buf;
+    js.path = path;
+    *samples = 0;
+    json_expect(&js, '{');
+    for (i = 0; json_more(&js, '}', i); i++) {
+	json_key(&js, key, sizeof(key));
+	if (strcmp(key, "env") == 0) {
+	    json_expect(&js, '{');
+	    for (j = 0; json_more(&js, '}', j); j++) {
+		json_key(&js, key, sizeof(key));
+		if (strcmp(key, "samples") == 0)
+		    *samples = (int)json_read_number(&js);
+		else
+		    json_skip(&js);
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
-
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+	} else if (strcmp(key, "traces") == 0) {
+	    json_expect(&js, '[');
+	    for (j = 0; json_more(&js, ']', j); j++) {
+		if (n == BASE_TRACES)
+		    json_fail(&js, "too many traces");
+		b = &base[n++];
+		memset(b, 0, sizeof(*b));
+		json_expect(&js, '{');
+		for (k = 0; json_more(&js, '}', k); k++) {
+		    json_key(&js, key, sizeof(key));
+		    if (strcmp(key, "name") == 0)
+			json_read_string(&js, b->name, sizeof(b->name));
+		    else if (strcmp(key, "valid") == 0)
+			b->valid = (int)json_read_number(&js);
+		    else if (strcmp(key, "ops") == 0)
+			b->ops = json_read_number(&js);
+		    else if (strcmp(key, "secs") == 0)
+			b->secs = json_read_number(&js);
+		    else if (strcmp(key, "util") == 0)
+			b->util = json_read_number(&js);
+		    else if (strcmp(key, "mean") == 0)
+			b->mean = json_read_number(&js);
+		    else if (strcmp(key, "stddev") == 0)
+			b->stddev = json_read_number(&js);
+		    else
+			json_skip(&js);
+		}
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
+	} else
+	    json_skip(&js);
+    }
+    json_ws(&js);
+    if (*js.p != '\0')
+	json_fail(&js, "text after the document");
+    free(buf);
+    return n;
+}
 
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+/*
+ * betacf - Continued fraction of the incomplete beta function, by
+ *     the modified Lentz method
+ */
+static double betacf(double a, double b, double x)
+{
+    double c = 1, d, h, aa, del;
+    int m;
+
+#define BETA_TINY(v) do { if (fabs(v) < 1e-300) (v) = 1e-300; } while (0)
+    d = 1 - (a + b) * x / (a + 1);
+    BETA_TINY(d);
+    d = 1 / d;
+    h = d;
+    for (m = 1; m <= 300; m++) {
+	aa = m * (b - m) * x / ((a + 2*m - 1) * (a + 2*m));
+	d = 1 + aa * d;
+	BETA_TINY(d);
+	c = 1 + aa / c;
+	BETA_TINY(c);
+	d = 1 / d;
+	h *= d * c;
+	aa = -(a + m) * (a + b + m) * x / ((a + 2*m) * (a + 2*m + 1));
+	d = 1 + aa * d;
+	BETA_TINY(d);
+	c = 1 + aa / c;
+	BETA_TINY(c);
+	d = 1 / d;
+	del = d * c;
+	h *= del;
+	if (fabs(del - 1) < 1e-12)
 	    break;
-
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
-	}
     }
-
-    return 1;
+#undef BETA_TINY
+    return h;
 }
 
 /*
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ * betai - The regularized incomplete beta function I_x(a, b)
  */
-static void eval_libc_speed(void *ptr)
+static double betai(double a, double b, double x)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    double bt;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = (char *) malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
+    if (x <= 0)
+	return 0;
+    if (x >= 1)
+	return 1;
+    bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+	     a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2))
+	return bt * betacf(a, b, x) / a;
+    return 1 - bt * betacf(b, a, 1 - x) / b;
+}
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
+/*
+ * welch_p - Two-sided p-value of Welch's t-test that two samples,
+ *     given by mean, standard deviation and size, have the same mean
+ */
+static double welch_p(double m1, double s1, int n1,
+		      double m2, double s2, int n2)
+{
+    double v1 = s1 * s1 / n1, v2 = s2 * s2 / n2, t, df;
 
-	    trace->blocks[index] = newp;
-	    break;
+    if (v1 + v2 == 0)
+	return m1 == m2 ? 1 : 0;
+    t = (m1 - m2) / sqrt(v1 + v2);
+    df = (v1 + v2) * (v1 + v2) / (v1 * v1 / (n1 - 1) + v2 * v2 / (n2 - 1));
+    return betai(df / 2, 0.5, df / (df + t * t));
+}
 
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
+/*
+ * compare_baseline - Compare each trace with the one of the same file
+ *     name in the baseline at path. A trace regresses if its util falls
+ *     by more than base_threshold percent, or its throughput does and,
+ *     when both runs took samples (-b), Welch's test finds the
+ *     difference significant at BASE_ALPHA. A trace the baseline does
+ *     not have fails too, and so does the whole run if no trace could
+ *     be compared. Returns the number of failures.
+ */
+static int compare_baseline(char *path, int n, char **names, stats_t *stats)
+{
+    static base_t base[BASE_TRACES];
+    int nbase, bsamples, i, k, bad = 0, tested, matched = 0;
+    double kops0, kops1, dkops, dutil, p;
+    const char *name, *verdict;
+
+    nbase = read_baseline(path, base, &bsamples);
+    tested = bsamples >= 2 && bench_samples >= 2;
+    printf("Against the baseline in %s (regression above %.1f%%", path,
+	   base_threshold);
+    if (tested)
+	printf(", p < %.2f", BASE_ALPHA);
+    printf("):\n");
+    printf("%5s%-22s%10s%10s%9s%8s%7s%7s%8s  %s\n", "trace", "  name",
+	   "base Kops", "Kops", "change", "p", "util0", "util", "change",
+	   "");
+    for (i = 0; i < n; i++) {
+	name = strrchr(names[i], '/') ? strrchr(names[i], '/') + 1 : names[i];
+	for (k = 0; k < nbase; k++) {
+	    const char *bn = strrchr(base[k].name, '/');
+
+	    if (strcmp(bn ? bn + 1 : base[k].name, name) == 0)
+		break;
 	}
+	if (k == nbase || !base[k].valid || !stats[i].valid) {
+	    printf("%2d   %-22s%10s%10s%9s%8s%7s%7s%8s  %s\n", i, name, "-",
+		   "-", "-", "-", "-", "-", "-",
+		   k == nbase ? "NOT IN BASELINE" :
+		   !stats[i].valid ? "INVALID" : "invalid in baseline");
+	    if (k == nbase || (base[k].valid && !stats[i].valid))
+		bad++;
+	    continue;
+	}
+	matched++;
+
+	/* Throughput from the sample means if both runs have them */
+	if (tested) {
+	    kops0 = base[k].ops / base[k].mean / 1e3;
+	    kops1 = stats[i].ops / stats[i].mean / 1e3;
+	    p = welch_p(base[k].mean, base[k].stddev, bsamples,
+			stats[i].mean, stats[i].stddev, bench_samples);
+	} else {
+	    kops0 = base[k].ops / base[k].secs / 1e3;
+	    kops1 = stats[i].ops / stats[i].secs / 1e3;
+	    p = 0;
+	}
+	dkops = 100 * (kops1 - kops0) / kops0;
+	dutil = base[k].util > 0 ?
+	    100 * (stats[i].util - base[k].util) / base[k].util : 0;
+
+	verdict = "";
+	if (-dutil > base_threshold)
+	    verdict = "UTIL REGRESSION";
+	else if (-dkops > base_threshold && p < BASE_ALPHA)
+	    verdict = "THROUGHPUT REGRESSION";
+	else if (-dkops > base_threshold)
+	    verdict = "slower, not significant";
+	else if (dkops > base_threshold && p < BASE_ALPHA)
+	    verdict = "faster";
+	bad += verdict[0] == 'U' || verdict[0] == 'T';
+
+	printf("%2d   %-22s%10.0f%10.0f%8.1f%%", i, name, kops0, kops1, dkops);
+	if (tested)
+	    printf("%8.3f", p);
+	else
+	    printf("%8s", "-");
+	printf("%6.0f%%%6.0f%%%7.1f%%  %s\n", base[k].util * 100,
+	       stats[i].util * 100, dutil, verdict);
+    }
+    if (!tested)
+	printf("Without -b samples in both runs throughput is compared"
+	       " without a significance test\n");
+    printf("%d trace%s regressed or could not be compared\n", bad,
+	   bad == 1 ? "" : "s");
+    if (matched == 0) {
+	printf("No trace matches a valid trace of the baseline\n");
+	bad++;
     }
+    return bad;
 }
 
 /*************************************
@@ -939,52 +4309,443 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double vsecs = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n",
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%9s%10s\n",
+	   "trace", " valid", "util", "ops", "secs", "Kops", "check");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n",
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%9.0f%10.6f\n",
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].vsecs);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    vsecs += stats[i].vsecs;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n",
+	    printf("%2d%10s%6s%8s%10s%9s%10s\n",
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n",
+	printf("%12s%5.0f%%%8.0f%10.6f%9.0f%10.6f\n",
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops,
 	       secs,
-	       (ops/1e3)/secs);
+	       (ops/1e3)/secs,
+	       vsecs);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n",
+	printf("%12s%6s%8s%10s%9s%10s\n",
 	       "Total       ",
 	       "-",
 	       "-",
 	       "-",
+	       "-",
 	       "-");
     }
 
+    if (counters) {
+	printf("Hardware events per request (L1d, LLC, dTLB, branch: misses):\n");
+	printevents(n, stats);
+    }
+}
+
+/*
+ * printevents - Print the hardware events of each trace's speed test
+ *     per request, and its instructions per cycle
+ */
+static void printevents(int n, stats_t *stats)
+{
+    double ops = 0, sum[PERF_EVENTS] = {0};
+    double *ev;
+    int i, k;
+
+/* Print one row: events ev over ops requests, "-" where uncounted */
+#define EVENT_ROW(ev, ops) do {						\
+	for (k = 0; k < PERF_EVENTS; k++) {				\
+	    if ((ev)[k] < 0)						\
+		printf("%8s", "-");					\
+	    else							\
+		printf(k < PERF_L1D_MISSES ? "%8.0f" : "%8.3f",		\
+		       (ev)[k] / (ops));				\
+	    if (k == PERF_INSTRUCTIONS) {				\
+		if ((ev)[PERF_CYCLES] > 0 && (ev)[PERF_INSTRUCTIONS] >= 0) \
+		    printf("%6.2f", (ev)[PERF_INSTRUCTIONS] /		\
+			   (ev)[PERF_CYCLES]);				\
+		else							\
+		    printf("%6s", "-");					\
+	    }								\
+	}								\
+	printf("\n");							\
+    } while (0)
+
+    printf("%5s%7s", "trace", " valid");
+    for (k = 0; k < PERF_EVENTS; k++) {
+	printf("%8s", perf_event_name[k]);
+	if (k == PERF_INSTRUCTIONS)
+	    printf("%6s", "IPC");
+    }
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s", i, "no");
+	    for (k = 0; k < PERF_EVENTS; k++)
+		printf(k == PERF_INSTRUCTIONS ? "%8s%6s" : "%8s", "-", "-");
+	    printf("\n");
+	    continue;
+	}
+	ev = stats[i].events;
+	printf("%2d%10s", i, "yes");
+	EVENT_ROW(ev, stats[i].ops);
+	ops += stats[i].ops;
+	for (k = 0; k < PERF_EVENTS; k++)
+	    sum[k] = (sum[k] < 0 || ev[k] < 0) ? -1 : sum[k] + ev[k];
+    }
+    if (ops > 0) {
+	printf("%12s", "Total       ");
+	EVENT_ROW(sum, ops);
+    }
+#undef EVENT_ROW
+}
+
+/*
+ * printlimits - prints the peak heap size, the number of pressure
+ *     callbacks, and the requests that succeeded on the retry after the
+ *     callback released the ballast, for each trace replayed under a
+ *     heap limit
+ */
+static void printlimits(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%10s%10s%10s\n", "trace", " valid", "peak(KB)",
+	   "pressure", "retried");
+    for (i=0; i < n; i++) {
+	printf("%2d%10s%10.0f%10d%10d\n",
+	       i,
+	       stats[i].valid ? "yes" : "no",
+	       stats[i].peak/1024.0,
+	       stats[i].pressure,
+	       stats[i].retries);
+    }
+}
+
+/*
+ * printdefer - prints util and 99th percentile mm_free latency with
+ *     eager and with deferred frees, for each trace
+ */
+static void printdefer(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%9s%12s%12s\n", "trace", " valid",
+	   "util-e", "util-d", "p99-e(ns)", "p99-d(ns)");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%8.0f%%%8.0f%%%12.0f%12.0f\n",
+		   i,
+		   "yes",
+		   stats[i].util_eager*100.0,
+		   stats[i].util*100.0,
+		   stats[i].p99_eager,
+		   stats[i].p99);
+	}
+	else {
+	    printf("%2d%10s%9s%9s%12s%12s\n", i, "no", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printreorder - Print util and allocation spread without and with
+ *     address-ordered free blocks
+ */
+static void printreorder(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%9s%12s%12s%9s%9s\n", "trace", " valid",
+	   "util-u", "util-a", "spread-u", "spread-a", "near-u", "near-a");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%8.0f%%%8.0f%%%12.0f%12.0f%8.0f%%%8.0f%%\n",
+		   i,
+		   "yes",
+		   stats[i].util_unordered*100.0,
+		   stats[i].util*100.0,
+		   stats[i].spread_unordered,
+		   stats[i].spread,
+		   stats[i].near_unordered*100.0,
+		   stats[i].near*100.0);
+	}
+	else {
+	    printf("%2d%10s%9s%9s%12s%12s%9s%9s\n", i, "no",
+		   "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printclasses - Print the internal fragmentation of the geometric and
+ *     the generated size classes, and util without and with the latter
+ */
+static void printclasses(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%9s%9s%9s\n", "trace", " valid",
+	   "frag-geo", "frag-gen", "util", "util-c");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%8.1f%%%8.1f%%%8.0f%%%8.0f%%\n",
+		   i,
+		   "yes",
+		   stats[i].frag_geo*100.0,
+		   stats[i].frag_gen*100.0,
+		   stats[i].util*100.0,
+		   stats[i].util_classes*100.0);
+	}
+	else {
+	    printf("%2d%10s%9s%9s%9s%9s\n", i, "no", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printreserve - Print the p99.9 request latency without and with a
+ *     heap reserved and prefaulted up front, what reserving cost, and
+ *     how far the heap grew and how often it faulted despite it
+ */
+static void printreserve(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%13s%11s%11s%11s%10s%8s\n", "trace", " valid",
+	   "reserve(KB)", "setup(us)", "p999(us)", "p999-r(us)", "grew(KB)",
+	   "faults");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%13.0f%11.1f%11.1f%11.1f%10.0f%8.0f\n",
+		   i,
+		   "yes",
+		   stats[i].reserved/1024.0,
+		   stats[i].setup/1e3,
+		   stats[i].tail/1e3,
+		   stats[i].tail_reserved/1e3,
+		   stats[i].grown/1024.0,
+		   stats[i].faults);
+	}
+	else {
+	    printf("%2d%10s%13s%11s%11s%11s%10s%8s\n",
+		   i, "no", "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printpersist - Print how many crash points of each persistent heap
+ *     fell inside the allocator and how many recovered cleanly, and how
+ *     long recovering took next to rebuilding
+ */
+static void printpersist(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%7s%7s%8s%7s%13s%12s\n", "trace", " valid",
+	   "crashes", "in-mm", "clean", "broken", "lost", "rebuild(us)",
+	   "reopen(us)");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%9d%7d%7d%8d%7d%13.0f%12.1f\n",
+		   i,
+		   "yes",
+		   stats[i].crashes,
+		   stats[i].in_mm,
+		   stats[i].clean,
+		   stats[i].broken,
+		   stats[i].bad_blocks,
+		   stats[i].rebuild/1e3,
+		   stats[i].reopen/1e3);
+	}
+	else {
+	    printf("%2d%10s%9s%7s%7s%8s%7s%13s%12s\n", i, "no",
+		   "-", "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printlatency - Print the latency percentiles of each request type
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *op_name[LAT_OPS] = {"malloc", "free", "realloc"};
+    int i, k;
+
+    printf("%5s%7s%9s%9s%9s%9s%9s%11s\n", "trace", " valid", "op",
+	   "count", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s%9s%9s%9s%9s%9s%11s\n", i, "no",
+		   "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (k = 0; k < LAT_OPS; k++) {
+	    if (stats[i].lat_count[k] == 0)
+		continue;
+	    printf("%2d%10s%9s%9.0f%9.0f%9.0f%9.0f%11.0f\n",
+		   i,
+		   "yes",
+		   op_name[k],
+		   stats[i].lat_count[k],
+		   stats[i].lat[k][0],
+		   stats[i].lat[k][1],
+		   stats[i].lat[k][2],
+		   stats[i].lat[k][3]);
+	}
+    }
+}
+
+/*
+ * printtimeline - Print the slowest and fastest window of each trace,
+ *     where the slowest one ended and the free blocks at that point
+ */
+static void printtimeline(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%10s%10s%10s%10s%10s\n", "trace", " valid", "windows",
+	   "min Kops", "max Kops", "slowest", "free", "max free");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%9d%10.0f%10.0f%10d%10.0f%10.0f\n",
+		   i,
+		   "yes",
+		   stats[i].windows,
+		   stats[i].kops_min,
+		   stats[i].kops_max,
+		   stats[i].slow_op,
+		   stats[i].slow_free,
+		   stats[i].max_free);
+	}
+	else {
+	    printf("%2d%10s%9s%10s%10s%10s%10s%10s\n", i, "no",
+		   "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printbench - Print the summary of each trace's samples in us, and
+ *     flag the traces whose coefficient of variation is over bench_cv
+ */
+static void printbench(int n, stats_t *stats)
+{
+    int i, noisy = 0;
+    double cv;
+
+    printf("%5s%7s%9s%9s%9s%7s%9s%9s%9s%7s\n", "trace", " valid",
+	   "mean", "median", "stddev", "CV%", "CI lo", "CI hi", "cold", "");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    cv = 100 * stats[i].stddev / stats[i].mean;
+	    printf("%2d%10s%9.1f%9.1f%9.2f%7.2f%9.1f%9.1f%9.1f%7s\n",
+		   i,
+		   "yes",
+		   stats[i].mean * 1e6,
+		   stats[i].median * 1e6,
+		   stats[i].stddev * 1e6,
+		   cv,
+		   stats[i].ci_lo * 1e6,
+		   stats[i].ci_hi * 1e6,
+		   stats[i].cold * 1e6,
+		   cv > bench_cv ? "noisy" : "");
+	    noisy += cv > bench_cv;
+	}
+	else {
+	    printf("%2d%10s%9s%9s%9s%7s%9s%9s%9s\n", i, "no",
+		   "-", "-", "-", "-", "-", "-", "-");
+	}
+    }
+    if (noisy)
+	printf("%d of %d traces above %.1f%% CV: take more samples or quiet the machine\n",
+	       noisy, n, bench_cv);
+}
+
+/*
+ * printhandles - Print util with raw blocks, with handles and with
+ *     handles plus incremental compaction
+ */
+static void printhandles(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%9s%9s%11s\n", "trace", " valid",
+	   "util", "util-h", "util-hc", "moved(KB)");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%8.0f%%%8.0f%%%8.0f%%%11.0f\n",
+		   i,
+		   "yes",
+		   stats[i].util*100.0,
+		   stats[i].util_handle*100.0,
+		   stats[i].util_compact*100.0,
+		   stats[i].moved/1024.0);
+	}
+	else {
+	    printf("%2d%10s%9s%9s%9s%11s\n", i, "no", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * pressure_callback - Count the heap's calls for memory and release
+ *     the ballast the correctness run holds, if it still does, so the
+ *     heap retries the request.
+ */
+static int pressure_callback(mm_heap_t *h, size_t need, void *arg)
+{
+    (void)need;
+    (void)arg;
+    pressure_calls++;
+    if (ballast == NULL)
+	return 0;
+    mm_heap_free(h, ballast);
+    ballast = NULL;
+    ballast_freed++;
+    return 1;
+}
+
+/*
+ * need_feature - Exit with an error if the flag was used but the
+ *     engine lacks the feature it measures
+ */
+static void need_feature(int used, int feature, const char *flag)
+{
+    char msg[MAXLINE];
+
+    if (used && !(mm_engine_features() & feature)) {
+	snprintf(msg, sizeof(msg), "%s: the %s engine does not implement "
+		 "this feature; use the tags engine", flag, mm_engine_name());
+	app_error(msg);
+    }
 }
 
 /*
@@ -1019,14 +4780,42 @@ void malloc_error(int tracenum, int opnum, const char *msg)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcRFHISCT] [-A <n>] [-b <n>] [-d <file>] [-f <file>] [-t <dir>] [-D <ms>] [-L <bytes>] [-n <pct>] [-o <file>] [-P <size>] [-p <file>] [-r <bytes>] [-s <file>] [-w <n>] [-W <n>]\n");
+    fprintf(stderr, "               [--json <file>] [--baseline <file>] [--threshold <pct>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <n>     Address-order free blocks every <n> frees.\n");
+    fprintf(stderr, "\t-b <n>     Benchmark: pin to a CPU, warm up, take <n> samples per trace.\n");
+    fprintf(stderr, "\t-c         Count hardware events of the speed tests (with -v).\n");
+    fprintf(stderr, "\t-C         Compare generated and geometric size classes.\n");
+    fprintf(stderr, "\t-d <file>  Dump the -T latency histograms to <file>.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Defer frees; compare with eager frees.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Also replay through handles, with compaction.\n");
+    fprintf(stderr, "\t-I         Exercise independent heaps (mm_heap_create/destroy).\n");
+    fprintf(stderr, "\t-D <ms>    Purge free pages after <ms> ms; report RSS.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L <bytes> Replay the traces under a soft heap limit,\n");
+    fprintf(stderr, "\t           holding <bytes>/%d to release under pressure.\n", BALLAST_DIV);
+    fprintf(stderr, "\t-n <pct>   Flag -b traces whose CV is above <pct> (default 2).\n");
+    fprintf(stderr, "\t-o <file>  Write the -w samples to <file> (.json or CSV).\n");
+    fprintf(stderr, "\t-p <file>  Crash and recover a persistent heap in <file>.\n");
+    fprintf(stderr, "\t-P <size>  Benchmark a pool of <size>-byte objects.\n");
+    fprintf(stderr, "\t-r <bytes> Compare request latency with a prefaulted heap\n");
+    fprintf(stderr, "\t           of <bytes> (0 = each trace's peak heap size).\n");
+    fprintf(stderr, "\t-R         Replay region ops with mm_malloc/mm_free.\n");
+    fprintf(stderr, "\t-s <file>  Replay <file> as it is read, in bounded memory.\n");
+    fprintf(stderr, "\t-S         Benchmark list versus packed free-block search.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Time every request; print latency percentiles.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-w <n>     Sample throughput and free blocks every <n> requests.\n");
+    fprintf(stderr, "\t-W <n>     Benchmark a heap shared by 1 to <n> processes.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--json <file>      Write every result and the environment to <file>.\n");
+    fprintf(stderr, "\t--baseline <file>  Compare with the --json results in <file>; exit 1\n");
+    fprintf(stderr, "\t                   if util or throughput regressed.\n");
+    fprintf(stderr, "\t--threshold <pct>  Regressions above <pct> percent count (default 5).\n");
 }
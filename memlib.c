@@ -1,7 +1,13 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            Each simulated heap is a mem_t backed by its own anonymous
+ *            mapping, so independent heaps can coexist and a heap can
+ *            be thrown away with a single munmap. A heap can also be
+ *            backed by a range of a file, which keeps it across runs
+ *            and lets several processes share it.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,31 +21,179 @@
 #include "config.h"
 
 /* private variables */
-char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_t mem;            /* the default heap used by mem_sbrk & co. */
 
-/* 
+/*
+ * map_heap - reserve maxsize bytes of address space for m, plus extra
+ *    bytes past the end for the caller's use
+ */
+static int map_heap(mem_t *m, size_t maxsize, size_t extra)
+{
+    void *p = mmap(NULL, maxsize + extra, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (p == MAP_FAILED)
+	return -1;
+    m->start_brk = (char *)p;
+    m->max_addr = m->start_brk + maxsize;  /* max legal heap address */
+    m->brk = m->start_brk;                 /* heap is empty initially */
+    m->peak_brk = m->brk;
+    m->file = NULL;
+    return 0;
+}
+
+/*
+ * save_brk - record the brk and peak of a file-backed heap in its header
+ */
+static inline void save_brk(mem_t *m)
+{
+    if (m->file != NULL) {
+	m->file->brk = m->brk - m->start_brk;
+	m->file->peak = m->peak_brk - m->start_brk;
+    }
+}
+
+/*
+ * load_brk - pick up the brk and peak of a file-backed heap from its
+ *    header, where another process mapping the same file may have
+ *    moved them
+ */
+static inline void load_brk(mem_t *m)
+{
+    if (m->file != NULL) {
+	m->brk = m->start_brk + m->file->brk;
+	m->peak_brk = m->start_brk + m->file->peak;
+    }
+}
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (map_heap(&mem, MAX_HEAP, 0) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem.start_brk, mem.max_addr - mem.start_brk);
+}
+
+/*
+ * mem_default - return the heap that the plain mem_* functions use
+ */
+mem_t *mem_default(void)
+{
+    return &mem;
+}
+
+/*
+ * mem_create - make an independent heap of at most maxsize bytes
+ *    (MAX_HEAP if 0). The mem_t lives just past the heap's storage,
+ *    so mem_destroy releases both at once.
+ */
+mem_t *mem_create(size_t maxsize)
+{
+    mem_t tmp, *m;
+
+    if (maxsize == 0)
+	maxsize = MAX_HEAP;
+    maxsize = (maxsize + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (map_heap(&tmp, maxsize, sizeof(mem_t)) < 0)
+	return NULL;
+    m = (mem_t *)tmp.max_addr;
+    *m = tmp;
+    return m;
+}
+
+/*
+ * mem_destroy - unmap a heap made by mem_create
+ */
+void mem_destroy(mem_t *m)
+{
+    munmap(m->start_brk, (m->max_addr - m->start_brk) + sizeof(mem_t));
+}
+
+/*
+ * mem_file_size - bytes of file that a file-backed heap of maxsize
+ *    bytes occupies, header page included
+ */
+size_t mem_file_size(size_t maxsize)
+{
+    return mem_pagesize() +
+	((maxsize + mem_pagesize() - 1) & ~(mem_pagesize() - 1));
+}
+
+/*
+ * mem_map_file - map the heap stored at offset (page-aligned) in the
+ *    open file fd, which must already span mem_file_size(maxsize) bytes
+ *    from there. With create set the range becomes a new, empty heap;
+ *    otherwise it must hold a valid header, and is reopened with the
+ *    brk it had. A bad header fails rather than being reset, since the
+ *    heap may be live in another process. Stores go straight to the
+ *    file, so the heap survives the process.
+ */
+mem_t *mem_map_file(int fd, off_t offset, size_t maxsize, int create)
+{
+    size_t len = mem_file_size(maxsize);
+    struct mem_file *f;
+    mem_t *m;
+    char *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (p == MAP_FAILED)
+	return NULL;
+    if ((m = (mem_t *) malloc(sizeof(mem_t))) == NULL) {
+	munmap(p, len);
+	return NULL;
+    }
+    f = (struct mem_file *)p;
+    m->start_brk = p + mem_pagesize();
+    m->max_addr = p + len;
+    if (create) {
+	f->maxsize = len - mem_pagesize();
+	f->brk = f->peak = 0;
+	f->magic = MEM_FILE_MAGIC;
+    }
+    else if (f->magic != MEM_FILE_MAGIC || f->maxsize != len - mem_pagesize()
+	     || f->brk > f->maxsize || f->peak > f->maxsize) {
+	munmap(p, len);
+	free(m);
+	return NULL;
+    }
+    m->brk = m->start_brk + f->brk;
+    m->peak_brk = m->start_brk + f->peak;
+    m->file = f;
+    return m;
+}
+
+/*
+ * mem_unmap_file - unmap a heap made by mem_map_file; its contents stay
+ *    in the file
+ */
+void mem_unmap_file(mem_t *m)
+{
+    munmap(m->file, m->max_addr - (char *)m->file);
+    free(m);
+}
+
+/*
+ * mem_sync_r - write a file-backed heap back to its file now, rather
+ *    than whenever the kernel gets round to it
+ */
+int mem_sync_r(mem_t *m)
+{
+    if (m->file == NULL)
+	return 0;
+    load_brk(m);
+    return msync(m->file, m->brk - (char *)m->file, MS_SYNC);
 }
 
 /*
@@ -47,24 +201,42 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_reset_brk_r(&mem);
+}
+
+void mem_reset_brk_r(mem_t *m)
+{
+    m->brk = m->start_brk;
+    m->peak_brk = m->brk;
+    save_brk(m);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, though never below its start;
+ *    the peak size is not affected.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(int incr)
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_r(&mem, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+void *mem_sbrk_r(mem_t *m, int incr)
+{
+    char *old_brk;
+
+    load_brk(m);
+    old_brk = m->brk;
+    if ((m->brk + incr) < m->start_brk || (m->brk + incr) > m->max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    m->brk += incr;
+    if (m->brk > m->peak_brk)
+	m->peak_brk = m->brk;
+    save_brk(m);
     return (void *)old_brk;
 }
 
@@ -73,23 +245,78 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_r(&mem);
+}
+
+void *mem_heap_lo_r(mem_t *m)
+{
+    return (void *)m->start_brk;
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_r(&mem);
+}
+
+void *mem_heap_hi_r(mem_t *m)
+{
+    load_brk(m);
+    return (void *)(m->brk - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_heapsize_r(&mem);
+}
+
+size_t mem_heapsize_r(mem_t *m)
+{
+    load_brk(m);
+    return (size_t)(m->brk - m->start_brk);
+}
+
+/*
+ * mem_heappeak() - returns the largest heap size, in bytes, since the
+ *    heap was last reset
+ */
+size_t mem_heappeak()
+{
+    return mem_heappeak_r(&mem);
+}
+
+size_t mem_heappeak_r(mem_t *m)
+{
+    load_brk(m);
+    return (size_t)(m->peak_brk - m->start_brk);
+}
+
+/*
+ * mem_prefault - make the pages spanning [lo, lo+len) resident and
+ *    writable now rather than at first touch. MADV_POPULATE_WRITE does
+ *    it in one call where the kernel has it (Linux 5.14); otherwise
+ *    each page is written once, with the byte it already holds.
+ */
+int mem_prefault(void *lo, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *p = (char *)((size_t)lo & ~(pagesize - 1));
+    char *end = (char *)lo + len;
+
+    if (len == 0)
+	return 0;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, end - p, MADV_POPULATE_WRITE) == 0)
+	return 0;
+#endif
+    for (; p < end; p += pagesize)
+	*(volatile char *)p = *(volatile char *)p;
+    return 0;
 }
 
 /*
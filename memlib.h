@@ -1,11 +1,57 @@
 #include <unistd.h>
+#include <sys/types.h>
 
-void mem_init(void);               
+/*
+ * One simulated heap. The plain mem_* functions operate on a default
+ * instance set up by mem_init; the _r variants operate on instances
+ * made by mem_create, so several heaps can live in one process.
+ */
+typedef struct mem {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap plus one */
+    char *max_addr;   /* largest legal heap address */
+    char *peak_brk;   /* highest brk since the last reset */
+    struct mem_file *file; /* header page of a file-backed heap, or NULL */
+} mem_t;
+
+/*
+ * A file-backed heap occupies one page of header plus its storage in
+ * a file, from some page-aligned offset on. The header records the brk
+ * and peak as offsets, so mapping the same range again, anywhere in
+ * any process, brings the heap back as it was. Processes that map it
+ * at the same time see each other's brk, as it is read back from the
+ * header on every call.
+ */
+struct mem_file {
+    size_t magic;     /* MEM_FILE_MAGIC once the header is valid */
+    size_t maxsize;   /* bytes of storage after the header page */
+    size_t brk;       /* brk - start_brk */
+    size_t peak;      /* peak_brk - start_brk */
+};
+#define MEM_FILE_MAGIC 0x6d656d66UL  /* "memf", fits a 32-bit size_t */
+
+void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heappeak(void);
 size_t mem_pagesize(void);
+int mem_prefault(void *lo, size_t len);
+
+mem_t *mem_default(void);
+mem_t *mem_create(size_t maxsize);
+void mem_destroy(mem_t *m);
+void *mem_sbrk_r(mem_t *m, int incr);
+void mem_reset_brk_r(mem_t *m);
+void *mem_heap_lo_r(mem_t *m);
+void *mem_heap_hi_r(mem_t *m);
+size_t mem_heapsize_r(mem_t *m);
+size_t mem_heappeak_r(mem_t *m);
 
+size_t mem_file_size(size_t maxsize);
+mem_t *mem_map_file(int fd, off_t offset, size_t maxsize, int create);
+void mem_unmap_file(mem_t *m);
+int mem_sync_r(mem_t *m);
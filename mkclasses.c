@@ -0,0 +1,304 @@
+/*
+ * mkclasses.c - generate size classes from the request sizes of traces
+ *
+ * Reads one or more trace files, builds the histogram of their
+ * malloc and realloc request sizes (rounded up to ALIGNMENT) and
+ * writes sizeclass.h, the size-class table that mm.c compiles in.
+ *
+ * The classes are the ones that minimize the internal fragmentation
+ * of the traces' requests: every class is the largest size it serves,
+ * and a dynamic program over the distinct sizes picks the class
+ * boundaries. Peaks in the histogram therefore become classes of their
+ * own whenever that saves enough bytes. Requests above the size limit
+ * are left to the general allocator and ignored.
+ *
+ * usage: mkclasses [-n classes] [-m maxsize] tracefile...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#define MAXLINE    1024     /* max string size */
+#define DEF_CLASSES  32     /* classes generated by default */
+#define DEF_MAXSIZE  (1<<14)/* largest request given a class, by default */
+#define NPEAKS        8     /* most frequent sizes listed in the header */
+
+/* Round n up to a multiple of ALIGNMENT */
+#define ALIGN(n) (((n) + (ALIGNMENT-1)) & ~(unsigned long)(ALIGNMENT-1))
+
+typedef unsigned long long u64;
+
+static unsigned long *hist;  /* requests of each aligned size / ALIGNMENT */
+static unsigned long maxsize = DEF_MAXSIZE;
+static unsigned long requests = 0;  /* all requests read */
+static unsigned long counted = 0;   /* those at most maxsize bytes */
+
+static void usage(void);
+static void app_error(const char *msg);
+
+/*
+ * read_trace - add the request sizes of one trace file to hist
+ */
+static void read_trace(const char *path)
+{
+    FILE *f;
+    char type[MAXLINE];
+    int hdr[4], i;
+    unsigned int rid, index, size;
+
+    if ((f = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    for (i = 0; i < 4; i++)
+	if (fscanf(f, "%d", &hdr[i]) != 1)
+	    app_error("bad trace file header");
+
+    while (fscanf(f, "%s", type) != EOF) {
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(f, "%u %u", &index, &size) != 2)
+		app_error("bad alloc/realloc request");
+	    requests++;
+	    if (size > 0 && size <= maxsize) {
+		hist[ALIGN(size) / ALIGNMENT]++;
+		counted++;
+	    }
+	    break;
+	case 'f':
+	case 'n':
+	case 'd':
+	    if (fscanf(f, "%u", &index) != 1)
+		app_error("bad free/region request");
+	    break;
+	case 'b':
+	    /* region blocks are carved out of chunks, not malloc'd */
+	    if (fscanf(f, "%u %u %u", &rid, &index, &size) != 3)
+		app_error("bad region alloc request");
+	    break;
+	default:
+	    fprintf(stderr, "Bogus type character (%c) in %s\n", type[0], path);
+	    exit(1);
+	}
+    }
+    fclose(f);
+}
+
+/*
+ * choose - pick at most k classes for the d distinct sizes v[] with
+ *     counts c[], writing them to classes[] in increasing order.
+ *     Returns the number of classes and sets *waste to the bytes of
+ *     internal fragmentation they leave.
+ *
+ *     cost[j][i] is the least waste for v[0..i] using j+1 classes, the
+ *     last being v[i]; from[j][i] is where that last class starts.
+ */
+static int choose(const unsigned long *v, const unsigned long *c, int d,
+		  int k, unsigned long *classes, u64 *waste)
+{
+    u64 *n, *s, *cost, best, w;
+    int *from, i, j, m, arg;
+
+    if (k < 1 || d < 1)
+	return 0;
+    if (k > d)
+	k = d;
+    n = (u64 *) calloc(d + 1, sizeof(u64));
+    s = (u64 *) calloc(d + 1, sizeof(u64));
+    cost = (u64 *) malloc((size_t)k * d * sizeof(u64));
+    from = (int *) malloc((size_t)k * d * sizeof(int));
+    if (n == NULL || s == NULL || cost == NULL || from == NULL)
+	app_error("out of memory");
+
+    /* prefix sums: requests and requested bytes of v[0..i-1] */
+    for (i = 0; i < d; i++) {
+	n[i+1] = n[i] + c[i];
+	s[i+1] = s[i] + (u64)c[i] * v[i];
+    }
+
+    /* waste of serving v[a..b] with the class v[b] */
+#define WASTE(a, b) ((u64)v[b] * (n[(b)+1] - n[a]) - (s[(b)+1] - s[a]))
+
+    for (i = 0; i < d; i++) {
+	cost[i] = WASTE(0, i);
+	from[i] = 0;
+    }
+    for (j = 1; j < k; j++) {
+	for (i = 0; i < d; i++) {
+	    best = cost[(j-1)*d + i];
+	    arg = -1;
+	    for (m = j; m <= i; m++) {
+		w = cost[(j-1)*d + m-1] + WASTE(m, i);
+		if (w < best) {
+		    best = w;
+		    arg = m;
+		}
+	    }
+	    cost[j*d + i] = best;
+	    from[j*d + i] = arg;
+	}
+    }
+#undef WASTE
+
+    /* walk back from the top class; arg -1 means one class fewer */
+    *waste = cost[(k-1)*d + d-1];
+    m = 0;
+    for (j = k-1, i = d-1; i >= 0 && j >= 0; j--) {
+	arg = from[j*d + i];
+	if (arg < 0)
+	    continue;
+	classes[m++] = v[i];
+	i = arg - 1;
+    }
+    /* the walk found them from the top down */
+    for (j = 0; j < m/2; j++) {
+	unsigned long t = classes[j];
+	classes[j] = classes[m-1-j];
+	classes[m-1-j] = t;
+    }
+
+    free(n);
+    free(s);
+    free(cost);
+    free(from);
+    return m;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long *v, *c, *classes, peaks[NPEAKS], t;
+    char buf[MAXLINE], prev[MAXLINE];
+    u64 waste = 0, bytes;
+    int nclasses = DEF_CLASSES, d, i, j, m, npeaks, col;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "n:m:h")) != EOF) {
+	switch (ch) {
+	case 'n':
+	    nclasses = atoi(optarg);
+	    break;
+	case 'm':
+	    maxsize = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc || nclasses < 1 || maxsize < ALIGNMENT) {
+	usage();
+	exit(1);
+    }
+    maxsize = ALIGN(maxsize);
+
+    if ((hist = (unsigned long *) calloc(maxsize/ALIGNMENT + 1,
+					 sizeof(unsigned long))) == NULL)
+	app_error("out of memory");
+    for (i = optind; i < argc; i++)
+	read_trace(argv[i]);
+    if (counted == 0)
+	app_error("no requests to build classes from");
+
+    /* the distinct sizes that were requested, in increasing order */
+    v = (unsigned long *) malloc((maxsize/ALIGNMENT + 1) * sizeof(unsigned long));
+    c = (unsigned long *) malloc((maxsize/ALIGNMENT + 1) * sizeof(unsigned long));
+    classes = (unsigned long *) malloc(nclasses * sizeof(unsigned long));
+    if (v == NULL || c == NULL || classes == NULL)
+	app_error("out of memory");
+    d = 0;
+    bytes = 0;
+    for (i = 1; i <= (int)(maxsize/ALIGNMENT); i++) {
+	if (hist[i]) {
+	    v[d] = (unsigned long)i * ALIGNMENT;
+	    c[d] = hist[i];
+	    bytes += (u64)v[d] * c[d];
+	    d++;
+	}
+    }
+
+    /* the peaks: most frequent sizes, by insertion into a short list */
+    npeaks = 0;
+    for (i = 0; i < d; i++) {
+	for (j = npeaks; j > 0 && hist[peaks[j-1]/ALIGNMENT] < c[i]; j--)
+	    if (j < NPEAKS)
+		peaks[j] = peaks[j-1];
+	if (j < NPEAKS) {
+	    peaks[j] = v[i];
+	    if (npeaks < NPEAKS)
+		npeaks++;
+	}
+    }
+
+    m = choose(v, c, d, nclasses, classes, &waste);
+
+    printf("/*\n");
+    printf(" * sizeclass.h - size classes generated by mkclasses; do not edit.\n");
+    printf(" * Regenerate with \"make classes\".\n");
+    printf(" *\n");
+    printf(" * Traces:");
+    col = 10;
+    for (i = optind; i < argc; i++) {
+	if (col + strlen(argv[i]) + 1 > 72) {
+	    printf("\n *        ");
+	    col = 10;
+	}
+	printf(" %s", argv[i]);
+	col += strlen(argv[i]) + 1;
+    }
+    printf("\n");
+    printf(" * Requests: %lu of %lu at most %lu bytes, %d distinct sizes\n",
+	   counted, requests, maxsize, d);
+    printf(" * Peaks (size x requests):");
+    for (i = 0; i < npeaks; i++) {
+	t = peaks[i];
+	sprintf(buf, "%lu x %lu", t, hist[t/ALIGNMENT]);
+	if (i % 4 == 0)
+	    printf("\n *     %s", buf);
+	else
+	    printf("%*s%s", 18 - (int)strlen(prev), "", buf);
+	strcpy(prev, buf);
+    }
+    printf("\n");
+    printf(" * Internal fragmentation: %.2f%% of the class bytes\n",
+	   100.0 * waste / (double)(bytes + waste));
+    printf(" */\n");
+    printf("#ifndef __SIZECLASS_H_\n");
+    printf("#define __SIZECLASS_H_\n\n");
+    printf("#define SIZE_CLASSES   %d\n", m);
+    printf("#define SIZE_CLASS_MAX %lu\n\n", classes[m-1]);
+    printf("static const unsigned int size_class[SIZE_CLASSES] = {");
+    for (i = 0; i < m; i++)
+	printf("%s%lu,", (i % 8) ? " " : "\n    ", classes[i]);
+    printf("\n};\n\n");
+    printf("#endif /* __SIZECLASS_H_ */\n");
+
+    free(v);
+    free(c);
+    free(classes);
+    free(hist);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mkclasses [-h] [-n <classes>] [-m <maxsize>] <tracefile>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Generate at most n classes (default %d).\n",
+	    DEF_CLASSES);
+    fprintf(stderr, "\t-m <size>  Ignore requests above size bytes (default %d).\n",
+	    DEF_MAXSIZE);
+}
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "mkclasses: %s\n", msg);
+    exit(1);
+}
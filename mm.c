@@ -1,9 +1,20 @@
+#define _GNU_SOURCE         // memfd_create
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mm.h"
 #include "memlib.h"
+#include "fitscan.h"
+#include "sizeclass.h"
 #include "assert.h"
 
 team_t team = {
@@ -19,6 +30,40 @@ team_t team = {
   ""
 };
 
+//
+// Allocator engine, chosen at build time (make ENGINE=BITMAP):
+//
+//   ENGINE_TAGS    boundary tags and an explicit free list (default)
+//   ENGINE_BITMAP  no inline headers; block state in a side-table bitmap
+//   ENGINE_BUDDY   binary buddy system with per-order free lists
+//
+#define ENGINE_TAGS   0
+#define ENGINE_BITMAP 1
+#define ENGINE_BUDDY  2
+
+#ifndef MM_ENGINE
+#define MM_ENGINE ENGINE_TAGS
+#endif
+
+static int heap_init(mm_heap_t *h);
+static int heap_lock(mm_heap_t *h);
+static void heap_unlock(mm_heap_t *h);
+static int heap_shared(mm_heap_t *h);
+
+//
+// A handle is a slot in its heap's handle table that holds the current
+// address of a relocatable block. Free slots are chained through bp.
+// Each engine says how to tie a block to its slot.
+//
+struct mm_hslot {
+  void *bp;                 // the block, or the next free slot
+  int locks;                // mm_hlock nesting depth
+};
+
+static void handle_attach(mm_heap_t *h, void *bp, struct mm_hslot *s);
+static void handle_detach(mm_heap_t *h, void *bp);
+static size_t handles_metasize(mm_heap_t *h);
+
 
 /////////////////////////////////////////////////////////////////////////////
 // Constants and macros
@@ -33,6 +78,13 @@ team_t team = {
 #define DSIZE       sizeof(double)       /* doubleword size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
+#define PURGE_MIN  (1<<14)  /* free blocks this big are tracked for purging */
+#define DECAY_TICK  256     /* mallocs between decay checks */
+#define QUICK_MAX   512     /* largest block kept on a quick list (bytes) */
+#define QUICK_LEN    32     /* blocks per quick list before a drain */
+#define QUICK_DRAIN   4     /* newest blocks coalesced when a list overflows */
+#define QUICK_LISTS (QUICK_MAX/8 + 1)
+#define REORDER_STEPS 1024  /* compare-exchanges per automatic reorder */
 
 #define NEXT_PTR(bp) *((void**) bp)
 #define SET_PTR(bp, val) ((*(FL_Pointer*)(bp)) = (val) )
@@ -42,7 +94,6 @@ typedef int bool;
 #define true  (1)
 #define false (0)
 
-static char *heap_listp;  /* pointer to first block */
 typedef struct CLNode * FL_Pointer;
 
 
@@ -162,322 +213,3100 @@ static inline void* PREV_BLKP(void *bp){
 }
 
 
+#if MM_ENGINE == ENGINE_TAGS
+
 /////////////////////////////////////////////////////////////////////////////
 //
-// Global Variables
+// Heap instances
+//
+// Everything the allocator knows about one heap lives in a struct
+// mm_heap, so independent heaps can coexist in a process. The plain
+// mm_* entry points operate on default_heap, which grows in memlib's
+// default heap; mm_heap_create makes heaps in their own memlib region.
 //
 
+struct mm_heap {
+  mem_t *mem;               // memlib heap this heap grows into
+  char *base;               // its first byte; free index offsets start here
+  char *heap_listp;         // pointer to first block
+  mem_t *index;             // memlib region holding the free index
+  uint32_t *free_sizes;     // free index: size of each free block
+  uint32_t *free_offs;      // free index: offset of each free block
+  size_t nfree;             // free blocks in the index
+  size_t peak_free;         // most free blocks since heap_init
+  size_t limit;             // soft limit on the heap size (0 = none)
+  mm_pressure_fn pressure;  // called when growth would cross the limit
+  void *pressure_arg;       // passed back to pressure
+  long decay_ms;            // purge dirty pages this old (0 = never)
+  long now;                 // clock reading at the last decay tick (ms)
+  int ticks;                // mallocs since the last decay tick
+  struct CLNode dirty;      // dirty big free blocks, oldest first
+  int deferred;             // mm_free defers small blocks to quick lists
+  int quick_count;          // blocks on all quick lists
+  void *quick[QUICK_LISTS]; // freed, not yet coalesced blocks by size/8
+  int quick_len[QUICK_LISTS];
+  mem_t *handles;           // memlib region holding the handle table
+  struct mm_hslot *hslots;  // free handle slots
+  char *compact_bp;         // where the next mm_compact resumes (or NULL)
+  int reorder_every;        // reorder after this many frees (0 = never)
+  int reorder_frees;        // frees since the last automatic reorder
+  size_t reorder_gap;       // gap of the comb-sort pass under way (0 = none)
+  size_t reorder_pos;       // next index entry that pass compares
+  int reorder_swapped;      // that pass has swapped entries
+  int reorder_dirty;        // entries were added or removed since
+  int classes;              // round requests up to their size class
+  size_t root;              // offset of the root object + 1 (0 = none)
+  struct mm_file *file;     // header page of a persistent heap, or NULL
+  int fd;                   // and its file
+  int shared;               // processes share the heap (see heap_lock)
+  int broken;               // a process died mid-update and left it corrupt
+};
 
-struct CLNode free_list;
+// Bytes at the bottom of a heap made by mm_heap_create or mm_heap_open
+#define HEAP_HDR (DSIZE * ((sizeof(struct mm_heap) + DSIZE-1) / DSIZE))
 
 //
-// function prototypes for internal helper routines
-//
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
-static void printblock(void *bp);
-static void checkblock(void *bp);
-
+// The free index
 //
-// mm_init - Initialize the memory manager
+// Free blocks are not linked through the heap. Instead the heap keeps
+// two packed arrays, each starting on a cache line: the sizes of its
+// free blocks and, at the same positions, their offsets from the start
+// of the heap, so the index stays valid wherever the heap is mapped. A
+// free block remembers its position in its first payload word. find_fit is
+// then a vector scan of the size array (see fitscan.c) rather than a
+// pointer chase with a header load per block. Removal moves the last
+// entry into the hole, so the index stays dense.
 //
-int mm_init(void)
-{
-  CL_init(&free_list);
 
-  // Create empty heap
-  if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1){
-    return -1;
-  }
+#define INDEX_ALIGN 64      // cache line the index arrays start on
 
-  //alignment padding
-  PUT(heap_listp, 0);
-  // prologue header
-  PUT(heap_listp + (WSIZE), PACK(DSIZE, 1));
-  //prologue footer
-  PUT(heap_listp + (DSIZE), PACK(DSIZE, 1));
-  //epilogue header
-  PUT(heap_listp + (3*WSIZE), PACK(0, 1));
-  heap_listp += (DSIZE);
+static inline size_t *SLOTP(void *bp) {
+  return (size_t *)bp;
+}
 
-  //extend empty heap with free block of CHUNKSIZE byes
-  if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
-    return -1;
-  }
-  return 0;
+static inline void *FREE_BLKP(mm_heap_t *h, size_t i) {
+  return h->base + h->free_offs[i];
 }
 
-//
-// extend_heap - Extend heap with free block and return its block pointer
-//
-static void *extend_heap(size_t words)
+static inline uint32_t OFFSET(mm_heap_t *h, void *bp) {
+  return (char *)bp - h->base;
+}
+
+// Room for one index entry per minimum-sized block of a heap of maxsize
+// bytes; the pages are only touched as the index grows
+static size_t index_cap(size_t maxsize)
 {
-  char *bp;
-  size_t size;
+  size_t cap = maxsize / (2*DSIZE);
 
-  //Allocate even number of words to maintain alignment
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  return (cap + INDEX_ALIGN-1) & ~(size_t)(INDEX_ALIGN-1);
+}
 
-  if ((void*)(bp = mem_sbrk(size)) == (void*) -1){
-    return NULL;
+static void index_attach(mm_heap_t *h, mem_t *index, size_t cap)
+{
+  h->index = index;
+  h->free_sizes = mem_heap_lo_r(index);
+  h->free_offs = h->free_sizes + cap;
+}
+
+static inline void index_add(mm_heap_t *h, void *bp, size_t size)
+{
+  size_t i = h->nfree++;
+
+  h->free_sizes[i] = size;
+  h->free_offs[i] = OFFSET(h, bp);
+  *SLOTP(bp) = i;
+  h->reorder_dirty = true;
+  if (h->nfree > h->peak_free){
+    h->peak_free = h->nfree;
   }
+}
 
-  //Initialize free block header/footer and epilogue header
-  //free block header
-  PUT(HDRP(bp), PACK(size,0));
-  //free block footer
-  PUT(FTRP(bp), PACK(size,0));
-  //new epilogue header
-  PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));
-  //Coalesce if previous block was free
+static inline void index_remove(mm_heap_t *h, void *bp)
+{
+  size_t i = *SLOTP(bp);
+  size_t last = --h->nfree;
+
+  h->free_sizes[i] = h->free_sizes[last];
+  h->free_offs[i] = h->free_offs[last];
+  *SLOTP(FREE_BLKP(h, i)) = i;
+  h->reorder_dirty = true;
+}
 
-  return coalesce(bp);
+// The free block bp now starts at nbp and is size bytes long
+static inline void index_update(mm_heap_t *h, void *bp, void *nbp, size_t size)
+{
+  size_t i = *SLOTP(bp);
+
+  h->free_sizes[i] = size;
+  h->free_offs[i] = OFFSET(h, nbp);
+  *SLOTP(nbp) = i;
 }
 
+//
+// Address order
+//
+// Entries are appended as blocks become free and moved around as
+// others are removed, so consecutive fits land all over the heap.
+// mm_heap_reorder puts the index back in address order a bounded
+// number of compare-exchange steps at a time. Merge sort would need
+// the index to hold still between calls; the steps of a comb sort stay
+// valid however the index changes meanwhile, and the passes simply
+// carry on. While the index is in address order, find_fit is address-
+// ordered first fit. Adds and removes stay O(1) and put their entries
+// out of place again; under mm_heap_set_reorder a changed index starts
+// a new pass, so the order is restored a few steps per free rather
+// than kept exact at the cost of every call.
+//
 
 //
-// Practice problem 9.8
+// mm_heap_set_reorder - Reorder automatically, REORDER_STEPS at a time,
+// every n frees (0 turns it off)
 //
-// find_fit - Find a fit for a block with asize bytes
+void mm_heap_set_reorder(mm_heap_t *h, int n)
+{
+  h->reorder_every = n;
+  h->reorder_frees = 0;
+}
+
 //
-static void *find_fit(size_t asize)
+// heap_reorder - Do up to steps compare-exchanges of address-order
+// sorting. Returns 0 once the index is sorted and unchanged since.
+//
+static int heap_reorder(mm_heap_t *h, size_t steps)
 {
-  FL_Pointer ptr;
-  for (ptr = free_list.next; ptr != &free_list; ptr = ptr->next){
-    if ( (asize <= GET_SIZE(HDRP(ptr)))) {
-      return ptr;
+  size_t i, j;
+  uint32_t size, off;
+
+  for (; steps > 0; steps--){
+    if (h->reorder_gap == 0){
+      if (!h->reorder_dirty || h->nfree < 2){
+        return 0;
+      }
+      // the end-of-pass step below picks the first real gap
+      h->reorder_dirty = false;
+      h->reorder_gap = h->nfree;
+      h->reorder_pos = h->nfree;
+    }
+
+    i = h->reorder_pos;
+    j = i + h->reorder_gap;
+    if (j >= h->nfree){
+      // pass done; a gap-1 pass without a swap means sorted
+      if (h->reorder_gap == 1 && !h->reorder_swapped){
+        h->reorder_gap = 0;
+        continue;
+      }
+      h->reorder_gap = h->reorder_gap * 10 / 13;
+      if (h->reorder_gap == 9 || h->reorder_gap == 10){
+        h->reorder_gap = 11;
+      }
+      if (h->reorder_gap == 0){
+        h->reorder_gap = 1;
+      }
+      h->reorder_pos = 0;
+      h->reorder_swapped = false;
+      continue;
+    }
+
+    if (h->free_offs[i] > h->free_offs[j]){
+      size = h->free_sizes[i];
+      off = h->free_offs[i];
+      h->free_sizes[i] = h->free_sizes[j];
+      h->free_offs[i] = h->free_offs[j];
+      h->free_sizes[j] = size;
+      h->free_offs[j] = off;
+      *SLOTP(FREE_BLKP(h, i)) = i;
+      *SLOTP(FREE_BLKP(h, j)) = j;
+      h->reorder_swapped = true;
     }
+    h->reorder_pos++;
   }
+  return h->reorder_gap != 0 || h->reorder_dirty;
+}
 
-  return NULL;
+//
+// The payload of a free block of at least PURGE_MIN bytes. While decay
+// purging is on, such a block is either on the heap's dirty list,
+// stamped with the time it became free, or clean: its interior pages
+// have been handed back to the OS with madvise.
+//
+struct bigfree {
+  size_t slot;              // free index position, as in every free block
+  struct CLNode dirty;      // dirty list links, unless clean
+  long stamp;               // h->now when the block became dirty
+  int clean;                // interior pages have been purged
+};
+
+static inline struct bigfree *DIRTY_BLKP(FL_Pointer node) {
+  return (struct bigfree *)((char *)node - offsetof(struct bigfree, dirty));
 }
 
 //
-// mm_free - Free a block
+// function prototypes for internal helper routines
 //
-void mm_free(void *bp)
-{
-  //assert( ! is_on_free_list(bp) );
+static void *extend_heap(mm_heap_t *h, size_t words);
+static void *grow(mm_heap_t *h, size_t asize);
+static size_t top_free(mm_heap_t *h);
+static void dirty_note(mm_heap_t *h, void *bp);
+static void dirty_forget(mm_heap_t *h, void *bp, size_t size);
+static void decay_tick(mm_heap_t *h, long age);
+static long now_ms(void);
+static void *sort_blocks(void *list);
+static void quick_drain(mm_heap_t *h, int i);
+static void place(mm_heap_t *h, void *bp, size_t asize);
+static void *find_fit(mm_heap_t *h, size_t asize);
+static void *coalesce(mm_heap_t *h, void *bp);
+static void printblock(void *bp);
+static int checkblock(void *bp);
+static int heap_check(mm_heap_t *h, int verbose);
 
-  size_t size = GET_SIZE(HDRP(bp));
+//
+// mm_heap_create - Make an independent heap of at most maxsize bytes
+// (memlib's default maximum if 0). The heap's own bookkeeping sits at
+// the bottom of its memlib region, so it needs no other storage.
+//
+mm_heap_t *mm_heap_create(size_t maxsize)
+{
+  mem_t *mem;
+  mm_heap_t *h;
 
-  PUT(HDRP(bp), PACK(size,0));
-  PUT(FTRP(bp), PACK(size,0));
-  coalesce(bp);
-  //assert( is_on_free_list(bp) );
+  if ((mem = mem_create(maxsize)) == NULL){
+    return NULL;
+  }
+  h = mem_sbrk_r(mem, HEAP_HDR);
+  if (h == (void *)-1){
+    mem_destroy(mem);
+    return NULL;
+  }
+  h->mem = mem;
+  if (heap_init(h) < 0){
+    mem_destroy(mem);
+    return NULL;
+  }
+  return h;
 }
 
 //
-// coalesce - boundary tag coalescing. Return ptr to coalesced block
+// mm_heap_destroy - Release a heap and every block in it at once
 //
-static void *coalesce(void *bp)
+void mm_heap_destroy(mm_heap_t *h)
 {
-  FL_Pointer prev = PREV_BLKP(bp);
-  FL_Pointer next = NEXT_BLKP(bp);
-
-  size_t prev_alloc = GET_ALLOC(FTRP(prev));
-  size_t next_alloc = GET_ALLOC(HDRP(next));
-  size_t size = GET_SIZE(HDRP(bp));
+  mem_t *mem = h->mem;
 
-  //CASE 1 : Both neighbors are allocated
-  if (prev_alloc && next_alloc) {
-    // we need to add free list node here b/c we do not do it in mm_free
-    CL_append(&free_list, bp);
+  if (h->file != NULL){
+    mm_heap_close(h);
+    return;
+  }
+  mem_destroy(h->index);
+  if (h->handles != NULL){
+    mem_destroy(h->handles);
   }
+  mem_destroy(mem);
+}
 
-  //CASE 2 : Only next free
-  else if (prev_alloc && !next_alloc) {
+/////////////////////////////////////////////////////////////////////////////
+//
+// Persistent heaps
+//
+// A persistent heap lives in a file: a header page, then the free index
+// and then the heap proper, each a file-backed memlib region. The heap
+// starts with its struct mm_heap, like any heap from mm_heap_create.
+// Nothing stored in the file is an address: tags hold sizes, the index
+// holds offsets from h->base and free blocks hold their index slot. So
+// reopening only has to refresh the pointers in the struct. The
+// settings kept there start over, and blocks that sat on quick lists
+// when the process died stay allocated.
+//
 
-    // unlink node thats next, b/c our current position will be beggining of new free node
-    CL_unlink(next);
-    CL_append(&free_list, bp);
+#define MM_FILE_MAGIC "mmheap2"
 
-    size += GET_SIZE(HDRP(next));
-    PUT(HDRP(bp), PACK(size,0));
-    PUT(FTRP(bp), PACK(size,0));
+struct mm_file {
+  char magic[8];            // MM_FILE_MAGIC, written last on creation
+  int engine;               // MM_ENGINE of the build that made it
+  int wsize;                // its tag width
+  size_t maxsize;           // bytes of heap storage
+  int shared;               // made by mm_heap_share
+  pthread_mutex_t lock;     // serializes the processes of a shared heap
+};
+
+// How heap_map maps a file
+#define HEAP_OPEN   0       // mm_heap_open: create, or reopen after a run
+#define HEAP_SHARE  1       // mm_heap_share: create for sharing
+#define HEAP_ATTACH 2       // mm_heap_attach: join a heap in use
+
+static int lock_init(struct mm_file *f);
+static int view_add(mm_heap_t *h, mem_t *mem, mem_t *index, size_t cap,
+                    struct mm_file *f, int fd);
+
+//
+// heap_map - Map the heap kept in the open file fd, making a new one
+// with room for maxsize bytes if the file is empty. The file and fd
+// belong to the heap from then on, or are closed on failure.
+//
+static mm_heap_t *heap_map(int fd, size_t maxsize, int how)
+{
+  size_t pagesize = mem_pagesize(), cap, isize;
+  struct mm_file *f = MAP_FAILED;
+  mem_t *index = NULL, *mem = NULL;
+  struct stat st;
+  mm_heap_t *h;
+  int fresh;
+
+  if (fd < 0 || fstat(fd, &st) < 0){
+    goto fail;
+  }
+  fresh = (st.st_size == 0);
+  if (fresh && (how == HEAP_ATTACH
+                || maxsize == 0 || maxsize > UINT32_MAX - pagesize)){
+    goto fail;
+  }
+  if (fresh && ftruncate(fd, pagesize) < 0){
+    goto fail;
+  }
+  f = mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (f == MAP_FAILED){
+    goto fail;
+  }
+  if (!fresh){
+    if (memcmp(f->magic, MM_FILE_MAGIC, sizeof(f->magic)) != 0
+        || f->engine != MM_ENGINE || f->wsize != WSIZE
+        || (how == HEAP_ATTACH && !f->shared)){
+      goto fail;
+    }
+    maxsize = f->maxsize;
   }
 
-  //CASE 3 : Only prev free
-  else if (!prev_alloc && next_alloc){
-    size += GET_SIZE(HDRP(prev));
+  cap = index_cap(mem_file_size(maxsize) - pagesize);
+  isize = mem_file_size(cap * 2 * sizeof(uint32_t));
+  if (fresh
+      && ftruncate(fd, pagesize + isize + mem_file_size(maxsize)) < 0){
+    goto fail;
+  }
+  // only a new file gets fresh headers: an attach must not reset the
+  // brk of a heap other processes are using
+  if ((index = mem_map_file(fd, pagesize, cap * 2 * sizeof(uint32_t),
+                            fresh)) == NULL
+      || (mem = mem_map_file(fd, pagesize + isize, maxsize, fresh)) == NULL){
+    goto fail;
+  }
 
-    // no need to make new here b/c one exists at prev_node
-    PUT(FTRP(bp), PACK(size,0));
-    PUT(HDRP(prev), PACK(size,0));
-    bp = prev;
+  if (how == HEAP_ATTACH){
+    // the heap is in use: its pointers are loaded under the lock
+    h = mem_heap_lo_r(mem);
+    if (view_add(h, mem, index, cap, f, fd) < 0){
+      goto fail;
+    }
+    return h;
   }
 
-  //CASE 4 : both neighbors unallocated
-  else {
-    size += GET_SIZE(HDRP(prev))
-      + GET_SIZE(FTRP(next));
+  if (fresh){
+    if ((h = mem_sbrk_r(mem, HEAP_HDR)) == (void *)-1){
+      goto fail;
+    }
+    memset(h, 0, HEAP_HDR);
+    h->mem = mem;
+    index_attach(h, index, cap);
+    if (heap_init(h) < 0){
+      goto fail;
+    }
+    h->shared = (how == HEAP_SHARE);
+  } else {
+    h = mem_heap_lo_r(mem);
+    h->mem = mem;
+    index_attach(h, index, cap);
+    h->base = mem_heap_lo_r(mem);
+    h->heap_listp = h->base + HEAP_HDR + DSIZE;
+    h->limit = 0;
+    h->pressure = NULL;
+    h->decay_ms = 0;
+    h->ticks = 0;
+    CL_init(&h->dirty);
+    h->deferred = false;
+    h->quick_count = 0;
+    memset(h->quick, 0, sizeof(h->quick));
+    memset(h->quick_len, 0, sizeof(h->quick_len));
+    h->handles = NULL;
+    h->hslots = NULL;
+    h->compact_bp = NULL;
+    h->reorder_every = 0;
+    h->reorder_frees = 0;
+    h->reorder_gap = 0;
+    h->reorder_dirty = true;
+    h->classes = false;
+    h->shared = f->shared;
+  }
+  h->file = f;
+  h->fd = fd;
 
-    // unlink node that is above us, we can ignore the one below us because that
-    // will serve ad the head for this free block
-    CL_unlink(next);
-    PUT(HDRP(prev), PACK(size,0));
-    PUT(FTRP(next), PACK(size,0));
-    bp = prev;
+  // reopening starts a new session, so a lock left held goes too
+  if (h->shared && (lock_init(f) < 0
+                    || view_add(h, mem, index, cap, f, fd) < 0)){
+    goto fail;
+  }
 
+  if (fresh){
+    f->engine = MM_ENGINE;
+    f->wsize = WSIZE;
+    f->maxsize = maxsize;
+    f->shared = h->shared;
+    memcpy(f->magic, MM_FILE_MAGIC, sizeof(f->magic));
   }
+  return h;
 
-  return bp;
+ fail:
+  if (mem != NULL){
+    mem_unmap_file(mem);
+  }
+  if (index != NULL){
+    mem_unmap_file(index);
+  }
+  if (f != MAP_FAILED){
+    munmap(f, pagesize);
+  }
+  if (fd >= 0){
+    close(fd);
+  }
+  return NULL;
 }
 
 //
-// mm_malloc - Allocate a block with at least size bytes of payload
+// mm_heap_open - Reopen the persistent heap in the file at path, or make
+// a new one with room for maxsize bytes if the file is empty or missing.
+// Fails with NULL if the file holds something else.
 //
-void *mm_malloc(size_t size)
+mm_heap_t *mm_heap_open(const char *path, size_t maxsize)
 {
-  //adjusted block size
-  size_t asize;
-  //ammount to extend heap if the new block doesnt fit
-  size_t extendsize;
-  char *bp;
-
+  return heap_map(open(path, O_RDWR | O_CREAT, 0644), maxsize, HEAP_OPEN);
+}
 
-  //ignore spurious requests
-  if (size == 0){
-    return NULL;
-  }
+//
+// mm_heap_sync - Write a persistent heap back to its file now
+//
+int mm_heap_sync(mm_heap_t *h)
+{
+  int rc = -1;
 
-  //adjust block size to include overhead and alignment reqs
-  if (size <= DSIZE){
-    asize = 2*DSIZE;
+  if (heap_lock(h) < 0){
+    return -1;
   }
-  else{
-    //round size up to nearest mult of DSIZE then add DSIZE
-    asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+  if (h->file != NULL && mem_sync_r(h->index) == 0 && mem_sync_r(h->mem) == 0){
+    rc = msync(h->file, mem_pagesize(), MS_SYNC);
   }
+  heap_unlock(h);
+  return rc;
+}
 
-  //search the free list for a fit
-  if ((bp = find_fit(asize)) != NULL){
-//    assert( is_on_free_list(bp) );
-    place(bp, asize);
-//    assert( ! is_on_free_list(bp) );
-    return bp;
-  }
+/////////////////////////////////////////////////////////////////////////////
+//
+// Shared heaps
+//
+// mm_heap_share puts a persistent heap in a memfd (or an unlinked POSIX
+// shared memory object) that other processes map as well, either by
+// inheriting it across fork or by passing the fd to mm_heap_attach,
+// which maps it wherever there is room. The blocks and the free index
+// hold only sizes and offsets, but the struct mm_heap caches a few
+// addresses that differ from one mapping to the next. Each process
+// keeps its own in a view, and heap_lock copies them into the struct
+// once it holds the heap's lock, a process-shared robust mutex in the
+// file header. The pointers stored in the struct are therefore only
+// good to the lock holder, which is why decay purging, deferred frees,
+// the pressure callback and handles, all of them address-based, are
+// not available on shared heaps.
+//
 
-  // No fit found. Get more memory and place the block
-  extendsize =  MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize/WSIZE)) == NULL){
-    return NULL;
-  }
+#define MM_VIEWS 16         // shared heaps one process can have mapped
 
-  // assert( is_on_free_list(bp) );
-  place(bp, asize);
-  // assert( ! is_on_free_list(bp) );
-  return bp;
+struct mm_view {
+  mm_heap_t *h;             // the heap where this process maps it, or NULL
+  mem_t *mem;               // this process's memlib regions for it
+  mem_t *index;
+  size_t cap;               // index entries
+  struct mm_file *file;     // its header page
+  int fd;                   // and file
+};
 
-}
+static struct mm_view views[MM_VIEWS];
 
-static void place(void *bp, size_t asize)
+//
+// lock_init - Make the lock of a shared heap: it works across processes,
+// nests, and is handed to the next locker if its holder dies
+//
+static int lock_init(struct mm_file *f)
 {
-  size_t csize = GET_SIZE(HDRP(bp));
-
+  pthread_mutexattr_t attr;
+  int rc;
 
-  if ((csize - asize) >= (2*DSIZE)){
-    CL_unlink(bp);
-    PUT(HDRP(bp), PACK(asize, 1));
-    PUT(FTRP(bp), PACK(asize, 1));
-    bp = NEXT_BLKP(bp);
-    PUT(HDRP(bp), PACK(csize - asize, 0));
-    PUT(FTRP(bp), PACK(csize - asize, 0));
-    CL_append(&free_list, bp);
+  if (pthread_mutexattr_init(&attr) != 0){
+    return -1;
   }
+  rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)
+    || pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)
+    || pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)
+    || pthread_mutex_init(&f->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return rc ? -1 : 0;
+}
 
-  else{
-    CL_unlink(bp);
-    PUT(HDRP(bp), PACK(csize,1));
-    PUT(FTRP(bp), PACK(csize,1));
+static int view_add(mm_heap_t *h, mem_t *mem, mem_t *index, size_t cap,
+                    struct mm_file *f, int fd)
+{
+  struct mm_view *v;
+
+  for (v = views; v < views + MM_VIEWS; v++){
+    if (v->h == NULL){
+      v->h = h;
+      v->mem = mem;
+      v->index = index;
+      v->cap = cap;
+      v->file = f;
+      v->fd = fd;
+      return 0;
+    }
   }
+  return -1;
 }
 
-void *mm_realloc(void *ptr, size_t size)
+static struct mm_view *view_find(mm_heap_t *h)
 {
-  void *newp;
-  size_t copySize;
+  struct mm_view *v;
 
-  newp = mm_malloc(size);
-  if (newp == NULL) {
-    printf("ERROR: mm_malloc failed in mm_realloc\n");
-    exit(1);
-  }
-  copySize = GET_SIZE(HDRP(ptr));
-  if (size < copySize) {
-    copySize = size;
+  for (v = views; v < views + MM_VIEWS; v++){
+    if (v->h == h){
+      return v;
+    }
   }
-  memcpy(newp, ptr, copySize);
-  mm_free(ptr);
-  return newp;
+  return NULL;
 }
 
 //
-// mm_checkheap - Check the heap for consistency
+// heap_lock - Take a shared heap's lock and load this process's
+// addresses into it; a no-op on private heaps. When the last holder
+// died, the heap is checked first: if that process left it in pieces
+// the heap is marked broken, and from then on every lock fails.
 //
-void mm_checkheap(int verbose)
+static int heap_lock(mm_heap_t *h)
 {
-  //
-  // This provided implementation assumes you're using the structure
-  // of the sample solution in the text. If not, omit this code
-  // and provide your own mm_checkheap
-  //
-  void *bp = heap_listp;
+  struct mm_view *v;
+  int rc;
 
-  if (verbose) {
-    printf("Heap (%p):\n", heap_listp);
+  if (!h->shared){
+    return 0;
   }
-
-  if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
-    printf("Bad prologue header\n");
+  v = view_find(h);
+  rc = pthread_mutex_lock(&v->file->lock);
+  if (rc == EOWNERDEAD){
+    pthread_mutex_consistent(&v->file->lock);
+  } else if (rc != 0){
+    return -1;
   }
-  checkblock(heap_listp);
 
-  for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-    if (verbose)  {
-      printblock(bp);
-    }
-    checkblock(bp);
-  }
+  h->mem = v->mem;
+  h->base = mem_heap_lo_r(v->mem);
+  h->heap_listp = h->base + HEAP_HDR + DSIZE;
+  index_attach(h, v->index, v->cap);
+  h->file = v->file;
+  h->fd = v->fd;
 
-  if (verbose) {
-    printblock(bp);
+  if (rc == EOWNERDEAD && heap_check(h, 0) != 0){
+    h->broken = true;
   }
-
-  if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
-    printf("Bad epilogue header\n");
+  if (h->broken){
+    pthread_mutex_unlock(&v->file->lock);
+    return -1;
   }
+  return 0;
 }
 
-static void printblock(void *bp)
+static void heap_unlock(mm_heap_t *h)
 {
-  size_t hsize, halloc, fsize, falloc;
+  if (h->shared){
+    pthread_mutex_unlock(&h->file->lock);
+  }
+}
+
+static int heap_shared(mm_heap_t *h)
+{
+  return h->shared;
+}
+
+//
+// mm_heap_share - Make a heap with room for maxsize bytes that forked
+// children share, and that other processes can map with mm_heap_attach
+//
+mm_heap_t *mm_heap_share(size_t maxsize)
+{
+  static int serial = 0;
+  char name[64];
+  int fd = -1;
+
+#ifdef MFD_CLOEXEC
+  fd = memfd_create("mm_heap", 0);
+#endif
+  if (fd < 0){
+    // no memfd: a shared memory object nobody else can open by name
+    snprintf(name, sizeof(name), "/mm_heap.%ld.%d", (long)getpid(), serial++);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0){
+      shm_unlink(name);
+    }
+  }
+  return heap_map(fd, maxsize, HEAP_SHARE);
+}
+
+//
+// mm_heap_attach - Map the shared heap in fd, which another process
+// made with mm_heap_share. The heap keeps its own copy of fd.
+//
+mm_heap_t *mm_heap_attach(int fd)
+{
+  return heap_map(dup(fd), 0, HEAP_ATTACH);
+}
+
+//
+// mm_heap_fd - The file of a persistent or shared heap, or -1
+//
+int mm_heap_fd(mm_heap_t *h)
+{
+  struct mm_view *v;
+
+  if (h->shared && (v = view_find(h)) != NULL){
+    return v->fd;
+  }
+  return h->file != NULL ? h->fd : -1;
+}
+
+//
+// mm_heap_close - Coalesce the deferred blocks, so they are not lost to
+// the file, and unmap a persistent heap. The file keeps the heap. A
+// shared heap stays mapped in the other processes.
+//
+void mm_heap_close(mm_heap_t *h)
+{
+  struct mm_view *v;
+  struct mm_file *f;
+  mem_t *mem, *index;
+  int fd;
+
+  if (h->shared){
+    v = view_find(h);
+    mem = v->mem;
+    index = v->index;
+    f = v->file;
+    fd = v->fd;
+    v->h = NULL;
+  } else {
+    mm_heap_flush(h);
+    if (h->handles != NULL){
+      mem_destroy(h->handles);
+    }
+    mem = h->mem;
+    index = h->index;
+    f = h->file;
+    fd = h->fd;
+  }
+  mem_unmap_file(index);
+  mem_unmap_file(mem);
+  munmap(f, mem_pagesize());
+  close(fd);
+}
+
+//
+// mm_heap_set_limit - Keep the heap at or below bytes (0 removes the limit).
+// Growth that would cross the limit first shrinks to the bare minimum,
+// then asks the pressure callback to release memory, and only then
+// makes the allocation fail with NULL.
+//
+void mm_heap_set_limit(mm_heap_t *h, size_t bytes)
+{
+  h->limit = bytes;
+}
+
+//
+// mm_heap_set_pressure_callback - Register fn to be called, with the number
+// of bytes the heap is short, when growth would cross the soft limit.
+// fn returns nonzero if it released memory and the request should be
+// retried.
+//
+void mm_heap_set_pressure_callback(mm_heap_t *h, mm_pressure_fn fn, void *arg)
+{
+  if (h->shared){
+    return;
+  }
+  h->pressure = fn;
+  h->pressure_arg = arg;
+}
+
+//
+// mm_heap_set_decay - Purge the pages of big free blocks once they have
+// been free for ms milliseconds (0 turns purging off). Ages are
+// checked every DECAY_TICK mallocs, so the hot path stays syscall-free.
+//
+void mm_heap_set_decay(mm_heap_t *h, long ms)
+{
+  size_t i;
+  int was_on = h->decay_ms != 0;
+
+  if (h->shared){
+    return;
+  }
+  h->decay_ms = ms;
+  if (ms == 0 || was_on || h->heap_listp == NULL){
+    return;
+  }
+
+  // Blocks freed while purging was off carry no stamp yet
+  CL_init(&h->dirty);
+  h->now = now_ms();
+  for (i = 0; i < h->nfree; i++){
+    dirty_note(h, FREE_BLKP(h, i));
+  }
+}
+
+//
+// mm_heap_purge - Purge every dirty big free block now, whatever its age
+//
+void mm_heap_purge(mm_heap_t *h)
+{
+  if (h->decay_ms){
+    decay_tick(h, 0);
+  }
+}
+
+//
+// mm_heap_set_deferred - In deferred mode mm_free only pushes blocks of up
+// to QUICK_MAX bytes on a per-size quick list, which mm_malloc reuses
+// for requests of exactly that size. A list that overflows has its
+// QUICK_DRAIN newest blocks coalesced; mm_flush, or a fit that fails,
+// coalesces every list in one address-ordered batch.
+//
+void mm_heap_set_deferred(mm_heap_t *h, int on)
+{
+  if (h->shared){
+    return;
+  }
+  if (!on && h->heap_listp != NULL){
+    mm_heap_flush(h);
+  }
+  h->deferred = on;
+}
+
+//
+// mm_heap_set_classes - In class mode every request is rounded up to
+// its size class (see sizeclass.h), so a block freed by one request
+// fits the next request of the same class exactly.
+//
+void mm_heap_set_classes(mm_heap_t *h, int on)
+{
+  h->classes = on;
+}
+
+//
+// mm_heap_flush - Coalesce every block waiting on a quick list
+//
+void mm_heap_flush(mm_heap_t *h)
+{
+  void *batch = NULL;
+  void *bp, *next;
+  size_t size;
+  int i;
+
+  if (h->quick_count == 0){
+    return;
+  }
+
+  // Gather all quick lists into one batch
+  for (i = 0; i < QUICK_LISTS; i++){
+    for (bp = h->quick[i]; bp != NULL; bp = next){
+      next = NEXT_PTR(bp);
+      NEXT_PTR(bp) = batch;
+      batch = bp;
+    }
+    h->quick[i] = NULL;
+    h->quick_len[i] = 0;
+  }
+  h->quick_count = 0;
+
+  // In address order, each block merges into the one freed before it
+  for (bp = sort_blocks(batch); bp != NULL; bp = next){
+    next = NEXT_PTR(bp);
+    size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size,0));
+    PUT(FTRP(bp), PACK(size,0));
+    coalesce(h, bp);
+  }
+}
+
+//
+// quick_drain - Coalesce the QUICK_DRAIN newest blocks of quick list i,
+// so an overflowing list costs its mm_free a few merges, not a flush
+// of every list. The newest blocks are the ones still in cache.
+//
+static void quick_drain(mm_heap_t *h, int i)
+{
+  void *batch = NULL;
+  void *bp, *next;
+  size_t size;
+  int k;
+
+  for (k = 0; k < QUICK_DRAIN; k++){
+    bp = h->quick[i];
+    h->quick[i] = NEXT_PTR(bp);
+    NEXT_PTR(bp) = batch;
+    batch = bp;
+  }
+  h->quick_len[i] -= QUICK_DRAIN;
+  h->quick_count -= QUICK_DRAIN;
+
+  for (bp = sort_blocks(batch); bp != NULL; bp = next){
+    next = NEXT_PTR(bp);
+    size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size,0));
+    PUT(FTRP(bp), PACK(size,0));
+    coalesce(h, bp);
+  }
+}
+
+//
+// sort_blocks - Merge sort a list of blocks, linked through their first
+// payload word, by address
+//
+static void *sort_blocks(void *list)
+{
+  void *slow, *fast, *a, *b;
+  void *head = NULL;
+  void **tail = &head;
+
+  if (list == NULL || NEXT_PTR(list) == NULL){
+    return list;
+  }
+
+  // Split in half
+  slow = list;
+  for (fast = NEXT_PTR(list); fast != NULL && NEXT_PTR(fast) != NULL;
+       fast = NEXT_PTR(NEXT_PTR(fast))){
+    slow = NEXT_PTR(slow);
+  }
+  b = NEXT_PTR(slow);
+  NEXT_PTR(slow) = NULL;
+  a = sort_blocks(list);
+  b = sort_blocks(b);
+
+  // Merge
+  while (a != NULL && b != NULL){
+    if ((char *)a < (char *)b){
+      *tail = a;
+      a = NEXT_PTR(a);
+    } else {
+      *tail = b;
+      b = NEXT_PTR(b);
+    }
+    tail = (void **)*tail;
+  }
+  *tail = (a != NULL) ? a : b;
+  return head;
+}
+
+//
+// mm_heap_metasize - Bytes of the free index at its largest. Boundary
+// tags themselves live next to the payloads.
+//
+size_t mm_heap_metasize(mm_heap_t *h)
+{
+  return h->peak_free * 2 * sizeof(uint32_t)
+    + handles_metasize(h);
+}
+
+//
+// free_stats - Count the blocks in the free index and on the quick
+// lists, and the bytes they hold
+//
+static void free_stats(mm_heap_t *h, size_t *blocks, size_t *bytes)
+{
+  size_t i, sum = 0;
+
+  for (i = 0; i < h->nfree; i++){
+    sum += h->free_sizes[i];
+  }
+  for (i = 0; i < QUICK_LISTS; i++){
+    sum += (size_t)h->quick_len[i] * i * DSIZE;
+  }
+  *blocks = h->nfree + h->quick_count;
+  *bytes = sum;
+}
+
+//
+// heap_init - Lay down the prologue and epilogue and the first free block
+//
+static int heap_init(mm_heap_t *h)
+{
+  char *heap_listp;
+  size_t cap;
+
+  if (h->index == NULL){
+    cap = index_cap(h->mem->max_addr - h->mem->start_brk);
+    if ((h->index = mem_create(cap * 2 * sizeof(uint32_t))) == NULL){
+      return -1;
+    }
+    index_attach(h, h->index, cap);
+  }
+  h->base = mem_heap_lo_r(h->mem);
+  h->root = 0;
+  h->nfree = 0;
+  h->peak_free = 0;
+  h->compact_bp = NULL;
+  h->reorder_frees = 0;
+  h->reorder_gap = 0;
+  h->reorder_dirty = false;
+  CL_init(&h->dirty);
+  h->ticks = 0;
+  h->quick_count = 0;
+  memset(h->quick, 0, sizeof(h->quick));
+  memset(h->quick_len, 0, sizeof(h->quick_len));
+  if (h->decay_ms){
+    h->now = now_ms();
+  }
+
+  // Create empty heap
+  if ((heap_listp = mem_sbrk_r(h->mem, 4*WSIZE)) == (void *)-1){
+    return -1;
+  }
+
+  //alignment padding
+  PUT(heap_listp, 0);
+  // prologue header
+  PUT(heap_listp + (WSIZE), PACK(DSIZE, 1));
+  //prologue footer
+  PUT(heap_listp + (DSIZE), PACK(DSIZE, 1));
+  //epilogue header
+  PUT(heap_listp + (3*WSIZE), PACK(0, 1));
+  h->heap_listp = heap_listp + (DSIZE);
+
+  //extend empty heap with free block of CHUNKSIZE byes
+  if (extend_heap(h, CHUNKSIZE/WSIZE) == NULL){
+    return -1;
+  }
+  return 0;
+}
+
+//
+// extend_heap - Extend heap with free block and return its block pointer
+//
+static void *extend_heap(mm_heap_t *h, size_t words)
+{
+  char *bp;
+  size_t size;
+
+  //Allocate even number of words to maintain alignment
+  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+
+  if ((void*)(bp = mem_sbrk_r(h->mem, size)) == (void*) -1){
+    return NULL;
+  }
+
+  //Initialize free block header/footer and epilogue header
+  //free block header
+  PUT(HDRP(bp), PACK(size,0));
+  //free block footer
+  PUT(FTRP(bp), PACK(size,0));
+  //new epilogue header
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));
+  //Coalesce if previous block was free
+
+  return coalesce(h, bp);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Decay purging
+//
+// Freed pages stay resident until they are reused. Rather than calling
+// madvise on every mm_free, big free blocks are queued on a dirty list
+// in the order they became free, and every DECAY_TICK mallocs the ones
+// older than decay_ms have their interior pages purged. A block leaves
+// the dirty list when it is allocated or merged into a neighbour; the
+// merged block is queued again as dirty.
+//
+
+static long now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//
+// dirty_note - bp has just become a free block of its current size
+//
+static void dirty_note(mm_heap_t *h, void *bp)
+{
+  struct bigfree *b = bp;
+
+  if (h->decay_ms == 0 || GET_SIZE(HDRP(bp)) < PURGE_MIN){
+    return;
+  }
+  b->stamp = h->now;
+  b->clean = false;
+  CL_append(h->dirty.prev, &b->dirty);
+}
+
+//
+// dirty_forget - The free block bp, of size bytes, is going away
+//
+static void dirty_forget(mm_heap_t *h, void *bp, size_t size)
+{
+  struct bigfree *b = bp;
+
+  if (h->decay_ms == 0 || size < PURGE_MIN || b->clean){
+    return;
+  }
+  CL_unlink(&b->dirty);
+}
+
+//
+// decay_tick - Purge the dirty blocks that have been free for at least
+// age ms, oldest first. The block's own metadata and its footer stay
+// resident.
+//
+static void decay_tick(mm_heap_t *h, long age)
+{
+  size_t pagesize = mem_pagesize();
+  struct bigfree *b;
+  char *lo, *hi;
+
+  h->ticks = 0;
+  h->now = now_ms();
+  while (h->dirty.next != &h->dirty){
+    b = DIRTY_BLKP(h->dirty.next);
+    if (b->stamp + age > h->now){
+      break;
+    }
+    lo = (char *)(((size_t)(b + 1) + pagesize-1) & ~(pagesize-1));
+    hi = (char *)((size_t)FTRP(b) & ~(pagesize-1));
+    if (lo < hi){
+      madvise(lo, hi - lo, MADV_DONTNEED);
+    }
+    CL_unlink(&b->dirty);
+    b->clean = true;
+  }
+}
+
+//
+// top_free - Size of the free block at the top of the heap, if any
+//
+static size_t top_free(mm_heap_t *h)
+{
+  void *last = PREV_BLKP((char *)mem_heap_hi_r(h->mem) + 1);
+
+  return GET_ALLOC(HDRP(last)) ? 0 : GET_SIZE(HDRP(last));
+}
+
+//
+// grow - Extend the heap so that a block of asize bytes fits and return
+// that block. Below the soft limit the heap grows by at least CHUNKSIZE.
+// Near it, only by what the free block at the top is missing. If even
+// that crosses the limit, dirty pages are purged and the pressure
+// callback may free memory, after which the request is retried once.
+// The caller has already coalesced the quick lists, and trimming
+// cannot help: the limit is on the heap size, and the top free block
+// already counts towards the request.
+//
+static void *grow(mm_heap_t *h, size_t asize)
+{
+  size_t extendsize = MAX(asize, CHUNKSIZE);
+  size_t heapsize = mem_heapsize_r(h->mem);
+  void *bp;
+
+  if (h->limit == 0 || heapsize + extendsize <= h->limit){
+    return extend_heap(h, extendsize/WSIZE);
+  }
+
+  extendsize = asize - top_free(h);
+  if (heapsize + extendsize <= h->limit){
+    return extend_heap(h, extendsize/WSIZE);
+  }
+
+  // Give back what pages we can before asking the application
+  if (h->decay_ms){
+    decay_tick(h, 0);
+  }
+  if (h->pressure == NULL
+      || !h->pressure(h, heapsize + extendsize - h->limit, h->pressure_arg)){
+    return NULL;
+  }
+  // in deferred mode what the callback freed waits on the quick lists
+  mm_heap_flush(h);
+  if ((bp = find_fit(h, asize)) != NULL){
+    return bp;
+  }
+  extendsize = asize - top_free(h);
+  if (mem_heapsize_r(h->mem) + extendsize <= h->limit){
+    return extend_heap(h, extendsize/WSIZE);
+  }
+  return NULL;
+}
+
+//
+// heap_reserve - Extend the heap by what the free block at its top
+// lacks to hold a bytes-byte request, without the CHUNKSIZE rounding
+// of grow and without calling on the pressure callback
+//
+static int heap_reserve(mm_heap_t *h, size_t bytes, int flags)
+{
+  size_t asize = DSIZE * ((bytes + (DSIZE) + (DSIZE-1)) / DSIZE);
+  size_t top = top_free(h);
+  char *bp;
+
+  if (asize > top){
+    if (h->limit && mem_heapsize_r(h->mem) + (asize - top) > h->limit){
+      return -1;
+    }
+    if (extend_heap(h, (asize - top)/WSIZE) == NULL){
+      return -1;
+    }
+  }
+
+  if (flags & MM_PREFAULT){
+    // the top block, from its header to the epilogue
+    bp = PREV_BLKP((char *)mem_heap_hi_r(h->mem) + 1);
+    mem_prefault(HDRP(bp), GET_SIZE(HDRP(bp)) + WSIZE);
+  }
+  return 0;
+}
+
+//
+// Practice problem 9.8
+//
+// find_fit - Find a fit for a block with asize bytes
+//
+static void *find_fit(mm_heap_t *h, size_t asize)
+{
+  size_t i = fit_scan(h->free_sizes, h->nfree, asize);
+
+  return i < h->nfree ? FREE_BLKP(h, i) : NULL;
+}
+
+//
+// heap_free - Free a block
+//
+static void heap_free(mm_heap_t *h, void *bp)
+{
+  //assert( ! is_on_free_list(bp) );
+
+  size_t size = GET_SIZE(HDRP(bp));
+
+  // Deferred: the block stays marked allocated until the next flush
+  if (h->deferred && size <= QUICK_MAX){
+    NEXT_PTR(bp) = h->quick[size/DSIZE];
+    h->quick[size/DSIZE] = bp;
+    h->quick_count++;
+    if (++h->quick_len[size/DSIZE] > QUICK_LEN){
+      quick_drain(h, size/DSIZE);
+    }
+    return;
+  }
+
+  PUT(HDRP(bp), PACK(size,0));
+  PUT(FTRP(bp), PACK(size,0));
+  coalesce(h, bp);
+  //assert( is_on_free_list(bp) );
+
+  if (h->reorder_every && ++h->reorder_frees >= h->reorder_every){
+    h->reorder_frees = 0;
+    heap_reorder(h, REORDER_STEPS);
+  }
+}
+
+//
+// coalesce - boundary tag coalescing. Return ptr to coalesced block
+//
+static void *coalesce(mm_heap_t *h, void *bp)
+{
+  FL_Pointer prev = PREV_BLKP(bp);
+  FL_Pointer next = NEXT_BLKP(bp);
+
+  size_t prev_alloc = GET_ALLOC(FTRP(prev));
+  size_t next_alloc = GET_ALLOC(HDRP(next));
+  size_t size = GET_SIZE(HDRP(bp));
+
+  //CASE 1 : Both neighbors are allocated
+  if (prev_alloc && next_alloc) {
+    // we need to add an index entry here b/c we do not do it in mm_free
+    index_add(h, bp, size);
+  }
+
+  //CASE 2 : Only next free
+  else if (prev_alloc && !next_alloc) {
+
+    // next's entry now describes us, b/c our current position will be beggining of new free node
+    dirty_forget(h, next, GET_SIZE(HDRP(next)));
+    size += GET_SIZE(HDRP(next));
+    index_update(h, next, bp, size);
+
+    PUT(HDRP(bp), PACK(size,0));
+    PUT(FTRP(bp), PACK(size,0));
+  }
+
+  //CASE 3 : Only prev free
+  else if (!prev_alloc && next_alloc){
+    dirty_forget(h, prev, GET_SIZE(HDRP(prev)));
+    size += GET_SIZE(HDRP(prev));
+
+    // no need to make new here b/c one exists at prev_node
+    index_update(h, prev, prev, size);
+    PUT(FTRP(bp), PACK(size,0));
+    PUT(HDRP(prev), PACK(size,0));
+    bp = prev;
+  }
+
+  //CASE 4 : both neighbors unallocated
+  else {
+    dirty_forget(h, prev, GET_SIZE(HDRP(prev)));
+    dirty_forget(h, next, GET_SIZE(HDRP(next)));
+    size += GET_SIZE(HDRP(prev))
+      + GET_SIZE(FTRP(next));
+
+    // drop the entry above us, we can ignore the one below us because that
+    // will serve ad the head for this free block
+    index_remove(h, next);
+    index_update(h, prev, prev, size);
+    PUT(HDRP(prev), PACK(size,0));
+    PUT(FTRP(next), PACK(size,0));
+    bp = prev;
+
+  }
+
+  // the compaction cursor may not point into the middle of a block
+  if (h->compact_bp > (char *)bp && h->compact_bp < (char *)bp + size){
+    h->compact_bp = bp;
+  }
+  dirty_note(h, bp);
+  return bp;
+}
+
+//
+// heap_malloc - Allocate a block with at least size bytes of payload
+//
+static void *heap_malloc(mm_heap_t *h, size_t size)
+{
+  //adjusted block size
+  size_t asize;
+  char *bp;
+
+
+  //ignore spurious requests
+  if (size == 0){
+    return NULL;
+  }
+
+  if (h->decay_ms && ++h->ticks >= DECAY_TICK){
+    decay_tick(h, h->decay_ms);
+  }
+
+  if (h->classes){
+    size = mm_size_class(size);
+  }
+
+  //adjust block size to include overhead and alignment reqs
+  if (size <= DSIZE){
+    asize = 2*DSIZE;
+  }
+  else{
+    //round size up to nearest mult of DSIZE then add DSIZE
+    asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+  }
+
+  //reuse a deferred block of exactly this size
+  if (h->quick_count && asize <= QUICK_MAX
+      && (bp = h->quick[asize/DSIZE]) != NULL){
+    h->quick[asize/DSIZE] = NEXT_PTR(bp);
+    h->quick_len[asize/DSIZE]--;
+    h->quick_count--;
+    return bp;
+  }
+
+  //search the free list for a fit
+  bp = find_fit(h, asize);
+  if (bp == NULL && h->quick_count){
+    // coalesce the deferred blocks and look again
+    mm_heap_flush(h);
+    bp = find_fit(h, asize);
+  }
+  if (bp != NULL){
+//    assert( is_on_free_list(bp) );
+    place(h, bp, asize);
+//    assert( ! is_on_free_list(bp) );
+    return bp;
+  }
+
+  // No fit found. Get more memory and place the block
+  if ((bp = grow(h, asize)) == NULL){
+    return NULL;
+  }
+
+  // assert( is_on_free_list(bp) );
+  place(h, bp, asize);
+  // assert( ! is_on_free_list(bp) );
+  return bp;
+
+}
+
+static void place(mm_heap_t *h, void *bp, size_t asize)
+{
+  size_t csize = GET_SIZE(HDRP(bp));
+
+
+  dirty_forget(h, bp, csize);
+  if ((csize - asize) >= (2*DSIZE)){
+    PUT(HDRP(bp), PACK(asize, 1));
+    PUT(FTRP(bp), PACK(asize, 1));
+    // the remainder takes over bp's index entry
+    index_update(h, bp, NEXT_BLKP(bp), csize - asize);
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(csize - asize, 0));
+    PUT(FTRP(bp), PACK(csize - asize, 0));
+    dirty_note(h, bp);
+  }
+
+  else{
+    index_remove(h, bp);
+    PUT(HDRP(bp), PACK(csize,1));
+    PUT(FTRP(bp), PACK(csize,1));
+  }
+}
+
+static void *heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+  void *newp;
+  size_t copySize;
+
+  // On failure the old block is left alone, as with realloc(3)
+  newp = heap_malloc(h, size);
+  if (newp == NULL) {
+    return NULL;
+  }
+  copySize = GET_SIZE(HDRP(ptr));
+  if (size < copySize) {
+    copySize = size;
+  }
+  memcpy(newp, ptr, copySize);
+  heap_free(h, ptr);
+  return newp;
+}
+
+//
+// heap_check - Check the heap for consistency; returns the number
+// of problems found
+//
+static int heap_check(mm_heap_t *h, int verbose)
+{
+  //
+  // This provided implementation assumes you're using the structure
+  // of the sample solution in the text. If not, omit this code
+  // and provide your own mm_checkheap
+  //
+  char *heap_listp = h->heap_listp;
+  void *bp = heap_listp;
+  char *hi = (char *)mem_heap_hi_r(h->mem) + 1;
+  size_t i, nfree = 0;
+  int errors = 0;
+
+  if (verbose) {
+    printf("Heap (%p):\n", heap_listp);
+  }
+
+  if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
+    printf("Bad prologue header\n");
+    errors++;
+  }
+  errors += checkblock(heap_listp);
+
+  // a corrupt size must not walk us off the heap
+  for (bp = heap_listp; (char *)bp <= hi && GET_SIZE(HDRP(bp)) > 0;
+       bp = NEXT_BLKP(bp)) {
+    if (verbose)  {
+      printblock(bp);
+    }
+    errors += checkblock(bp);
+    if (!GET_ALLOC(HDRP(bp))) {
+      nfree++;
+    }
+  }
+  if ((char *)bp > hi) {
+    printf("Error: blocks run past the brk\n");
+    return errors + 1;
+  }
+
+  if (verbose) {
+    printblock(bp);
+  }
+
+  if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
+    printf("Bad epilogue header\n");
+    errors++;
+  }
+
+  for (i = 0; i < h->nfree; i++) {
+    bp = FREE_BLKP(h, i);
+    if (GET_ALLOC(HDRP(bp)) || *SLOTP(bp) != i
+        || h->free_sizes[i] != GET_SIZE(HDRP(bp))) {
+      printf("Error: free index entry %lu (%p) is stale\n",
+             (unsigned long)i, bp);
+      errors++;
+    }
+  }
+  if (nfree != h->nfree) {
+    printf("Error: %lu free blocks but %lu in the index\n",
+           (unsigned long)nfree, (unsigned long)h->nfree);
+    errors++;
+  }
+  return errors;
+}
+
+static void printblock(void *bp)
+{
+  size_t hsize, halloc, fsize, falloc;
+
+  hsize = GET_SIZE(HDRP(bp));
+  halloc = GET_ALLOC(HDRP(bp));
+  fsize = GET_SIZE(FTRP(bp));
+  falloc = GET_ALLOC(FTRP(bp));
+
+  if (hsize == 0) {
+    printf("%p: EOL\n", bp);
+    return;
+  }
+
+  printf("%p: header: [%d:%c] footer: [%d:%c]\n",
+      bp,
+      (int) hsize, (halloc ? 'a' : 'f'),
+      (int) fsize, (falloc ? 'a' : 'f'));
+}
+
+static int checkblock(void *bp)
+{
+  int errors = 0;
+
+  if ((size_t)bp % 8) {
+    printf("Error: %p is not doubleword aligned\n", bp);
+    errors++;
+  }
+  if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+    printf("Error: header does not match footer\n");
+    errors++;
+  }
+  return errors;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Handles and compaction
+//
+// A handle block is an ordinary allocated block whose first DSIZE bytes
+// point back to its handle slot; its header and footer carry HANDLE_BIT.
+// mm_heap_compact walks the heap from h->compact_bp and, whenever a free
+// block is followed by an unlocked handle block, slides that block down
+// over the hole, so free space bubbles towards the top where it merges
+// and can be trimmed. Raw blocks and locked handles stay put.
+//
+
+#define HANDLE_BIT 0x2
+#define HANDLE_HDR DSIZE    // back pointer in front of a handle payload
+
+static inline int IS_HANDLE(void *bp) {
+  return GET(HDRP(bp)) & HANDLE_BIT;
+}
+
+static void handle_attach(mm_heap_t *h, void *bp, struct mm_hslot *s)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  (void)h;   // the side-table engines need the heap
+
+  *(struct mm_hslot **)bp = s;
+  PUT(HDRP(bp), PACK(size,1) | HANDLE_BIT);
+  PUT(FTRP(bp), PACK(size,1) | HANDLE_BIT);
+}
+
+static void handle_detach(mm_heap_t *h, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  (void)h;   // the side-table engines need the heap
+
+  PUT(HDRP(bp), PACK(size,1));
+  PUT(FTRP(bp), PACK(size,1));
+}
+
+//
+// trim - Give the free block at the top of the heap back to memlib,
+// all but CHUNKSIZE bytes of it
+//
+static void trim(mm_heap_t *h)
+{
+  char *end = (char *)mem_heap_hi_r(h->mem) + 1;
+  size_t size = top_free(h);
+  size_t cut;
+  void *bp;
+
+  if (size <= CHUNKSIZE + 2*DSIZE){
+    return;
+  }
+  cut = (size - CHUNKSIZE) & ~(DSIZE-1);
+  bp = PREV_BLKP(end);
+  dirty_forget(h, bp, size);
+  index_update(h, bp, bp, size - cut);
+  PUT(HDRP(bp), PACK(size - cut,0));
+  PUT(FTRP(bp), PACK(size - cut,0));
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));
+  dirty_note(h, bp);
+  mem_sbrk_r(h->mem, -(int)cut);
+}
+
+//
+// heap_compact - Slide unlocked handle blocks down over the holes
+// below them, doing about budget bytes of work (bytes moved, plus
+// DSIZE for each block stepped over). A pass that reaches the top of
+// the heap trims it; the next call starts a new pass at the bottom.
+//
+static size_t heap_compact(mm_heap_t *h, size_t budget)
+{
+  size_t moved = 0, work = 0;
+  size_t fsize, nsize;
+  struct mm_hslot *s;
+  char *bp, *next;
+
+  // deferred blocks are still marked allocated and would pin the holes
+  mm_heap_flush(h);
+
+  bp = h->compact_bp ? h->compact_bp : NEXT_BLKP(h->heap_listp);
+  while (work < budget){
+    if (GET_SIZE(HDRP(bp)) == 0){
+      trim(h);
+      h->compact_bp = NULL;
+      return moved;
+    }
+    next = NEXT_BLKP(bp);
+    if (GET_ALLOC(HDRP(bp)) || !IS_HANDLE(next)
+        || (*(struct mm_hslot **)next)->locks){
+      bp = next;
+      work += DSIZE;
+      continue;
+    }
+
+    // bp is free and next can move: swap their places
+    fsize = GET_SIZE(HDRP(bp));
+    nsize = GET_SIZE(HDRP(next));
+    s = *(struct mm_hslot **)next;
+    dirty_forget(h, bp, fsize);
+    index_remove(h, bp);
+    memmove(bp, next, nsize - DSIZE);
+    PUT(HDRP(bp), PACK(nsize,1) | HANDLE_BIT);
+    PUT(FTRP(bp), PACK(nsize,1) | HANDLE_BIT);
+    s->bp = bp;
+
+    next = NEXT_BLKP(bp);
+    PUT(HDRP(next), PACK(fsize,0));
+    PUT(FTRP(next), PACK(fsize,0));
+    h->compact_bp = next;
+    bp = coalesce(h, next);
+    moved += nsize;
+    work += nsize;
+  }
+  h->compact_bp = bp;
+  return moved;
+}
+
+//
+// Entry points
+//
+// The public calls take the heap's lock around the internal ones; on
+// private heaps heap_lock does nothing.
+//
+
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+  void *bp;
+
+  if (heap_lock(h) < 0){
+    return NULL;
+  }
+  bp = heap_malloc(h, size);
+  heap_unlock(h);
+  return bp;
+}
+
+void mm_heap_free(mm_heap_t *h, void *bp)
+{
+  // on a broken heap the block is lost
+  if (heap_lock(h) < 0){
+    return;
+  }
+  heap_free(h, bp);
+  heap_unlock(h);
+}
+
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+  void *newp;
+
+  if (heap_lock(h) < 0){
+    return NULL;
+  }
+  newp = heap_realloc(h, ptr, size);
+  heap_unlock(h);
+  return newp;
+}
+
+int mm_heap_checkheap(mm_heap_t *h, int verbose)
+{
+  int errors;
+
+  if (heap_lock(h) < 0){
+    printf("Shared heap broken by a dead process\n");
+    return 1;
+  }
+  errors = heap_check(h, verbose);
+  heap_unlock(h);
+  return errors;
+}
+
+int mm_heap_reserve(mm_heap_t *h, size_t bytes, int flags)
+{
+  int rc;
+
+  if (heap_lock(h) < 0){
+    return -1;
+  }
+  rc = heap_reserve(h, bytes, flags);
+  heap_unlock(h);
+  return rc;
+}
+
+int mm_heap_reorder(mm_heap_t *h, size_t steps)
+{
+  int rc;
+
+  if (heap_lock(h) < 0){
+    return 0;
+  }
+  rc = heap_reorder(h, steps);
+  heap_unlock(h);
+  return rc;
+}
+
+void mm_heap_freestats(mm_heap_t *h, size_t *blocks, size_t *bytes)
+{
+  *blocks = *bytes = 0;
+  if (heap_lock(h) < 0){
+    return;
+  }
+  free_stats(h, blocks, bytes);
+  heap_unlock(h);
+}
+
+//
+// A shared heap has no handle blocks to move, and its compact_bp would
+// be some process's address, so compaction comes down to the trim
+//
+size_t mm_heap_compact(mm_heap_t *h, size_t budget)
+{
+  if (!h->shared){
+    return heap_compact(h, budget);
+  }
+  if (heap_lock(h) == 0){
+    trim(h);
+    heap_unlock(h);
+  }
+  return 0;
+}
+
+#elif MM_ENGINE == ENGINE_BITMAP
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Side-table engine
+//
+// Payloads carry no header or footer. The heap is cut into DSIZE-byte
+// granules, and a metadata area of its own, indexed by
+// (addr - h->base) / DSIZE, holds two bitmaps:
+//
+//   alloc   set for every granule inside an allocated block
+//   start   set for the first granule of every allocated block
+//
+// Free space is just the runs of clear alloc bits, so freeing needs no
+// coalescing and find_fit scans 64 granules per word instead of
+// chasing free-list pointers through payload cache lines. A block's
+// size is implied: it ends at the next start bit or clear alloc bit,
+// whichever comes first.
+//
+
+typedef uint64_t bitword_t;
+#define BITS 64                 // granules per bitmap word
+#define NOFIT ((size_t)-1)      // find_fit/grow found no room
+
+static inline size_t MIN_SZ(size_t x, size_t y) {
+  return x < y ? x : y;
+}
+
+struct mm_heap {
+  mem_t *mem;               // memlib heap the payloads live in
+  mem_t *meta;              // memlib heap holding both bitmaps
+  char *base;               // address of granule 0
+  bitword_t *alloc;         // alloc bitmap
+  bitword_t *start;         // start bitmap
+  size_t ngran;             // granules between base and the brk
+  size_t hint;              // no granule below this one is free
+  size_t rover;             // next fit resumes its search here
+  size_t limit;             // soft limit on the heap size (0 = none)
+  mm_pressure_fn pressure;  // called when growth would cross the limit
+  void *pressure_arg;       // passed back to pressure
+  mem_t *handles;           // memlib region holding the handle table
+  struct mm_hslot *hslots;  // free handle slots
+  size_t root;              // offset of the root object + 1 (0 = none)
+};
+
+static inline int TESTBIT(const bitword_t *map, size_t i) {
+  return (map[i / BITS] >> (i % BITS)) & 1;
+}
+
+//
+// set_bits/clear_bits - Set or clear bits [lo, hi) of map, hi > lo
+//
+static void set_bits(bitword_t *map, size_t lo, size_t hi)
+{
+  size_t w = lo / BITS, last = (hi - 1) / BITS;
+  bitword_t first_mask = ~(bitword_t)0 << (lo % BITS);
+  bitword_t last_mask = ~(bitword_t)0 >> (BITS - 1 - (hi - 1) % BITS);
+
+  if (w == last){
+    map[w] |= first_mask & last_mask;
+    return;
+  }
+  map[w++] |= first_mask;
+  while (w < last){
+    map[w++] = ~(bitword_t)0;
+  }
+  map[w] |= last_mask;
+}
+
+static void clear_bits(bitword_t *map, size_t lo, size_t hi)
+{
+  size_t w = lo / BITS, last = (hi - 1) / BITS;
+  bitword_t first_mask = ~(bitword_t)0 << (lo % BITS);
+  bitword_t last_mask = ~(bitword_t)0 >> (BITS - 1 - (hi - 1) % BITS);
+
+  if (w == last){
+    map[w] &= ~(first_mask & last_mask);
+    return;
+  }
+  map[w++] &= ~first_mask;
+  while (w < last){
+    map[w++] = 0;
+  }
+  map[w] &= ~last_mask;
+}
+
+//
+// next_set/next_clear - Index of the first set (clear) bit of map in
+// [i, end), or end if there is none
+//
+static size_t next_set(const bitword_t *map, size_t i, size_t end)
+{
+  size_t w = i / BITS;
+  bitword_t word;
+
+  if (i >= end){
+    return end;
+  }
+  word = map[w] & (~(bitword_t)0 << (i % BITS));
+  while (word == 0){
+    if (++w * BITS >= end){
+      return end;
+    }
+    word = map[w];
+  }
+  i = w * BITS + __builtin_ctzll(word);
+  return i < end ? i : end;
+}
+
+static size_t next_clear(const bitword_t *map, size_t i, size_t end)
+{
+  size_t w = i / BITS;
+  bitword_t word;
+
+  if (i >= end){
+    return end;
+  }
+  word = ~map[w] & (~(bitword_t)0 << (i % BITS));
+  while (word == 0){
+    if (++w * BITS >= end){
+      return end;
+    }
+    word = ~map[w];
+  }
+  i = w * BITS + __builtin_ctzll(word);
+  return i < end ? i : end;
+}
+
+//
+// block_len - Granules in the allocated block starting at granule g
+//
+static size_t block_len(mm_heap_t *h, size_t g)
+{
+  size_t next = next_set(h->start, g + 1, h->ngran);
+
+  return next_clear(h->alloc, g, next) - g;
+}
+
+//
+// top_free - Clear granules between the last allocated one and the brk
+//
+static size_t top_free(mm_heap_t *h)
+{
+  size_t i = h->ngran, w;
+  bitword_t word;
+
+  while (i > 0){
+    w = (i - 1) / BITS;
+    word = h->alloc[w] & (~(bitword_t)0 >> (BITS - 1 - (i - 1) % BITS));
+    if (word){
+      return h->ngran - (w * BITS + BITS - __builtin_clzll(word));
+    }
+    i = w * BITS;
+  }
+  return h->ngran;
+}
+
+//
+// extend - Grow the heap by n granules, which start out free
+//
+static int extend(mm_heap_t *h, size_t n)
+{
+  if (mem_sbrk_r(h->mem, n * DSIZE) == (void *)-1){
+    return -1;
+  }
+  h->ngran += n;
+  return 0;
+}
+
+//
+// first_run - First run of n clear granules that starts in [g, end)
+//
+static size_t first_run(mm_heap_t *h, size_t g, size_t end, size_t n)
+{
+  size_t e;
+
+  for (g = next_clear(h->alloc, g, end); g < end;
+       g = next_clear(h->alloc, e, end)){
+    e = next_set(h->alloc, g, MIN_SZ(h->ngran, g + n));
+    if (e - g >= n){
+      return g;
+    }
+  }
+  return NOFIT;
+}
+
+//
+// find_fit - Next fit: search from the rover to the top of the heap,
+// then wrap around to the hint. Scanning address-ordered bitmaps from
+// the bottom every time would walk the same small holes over and over.
+//
+static size_t find_fit(mm_heap_t *h, size_t n)
+{
+  size_t g;
+
+  h->hint = next_clear(h->alloc, h->hint, h->ngran);
+  if (h->rover < h->hint){
+    h->rover = h->hint;
+  }
+  if ((g = first_run(h, h->rover, h->ngran, n)) == NOFIT
+      && (g = first_run(h, h->hint, h->rover, n)) == NOFIT){
+    return NOFIT;
+  }
+  h->rover = g + n;
+  return g;
+}
+
+//
+// grow - Extend the heap so that n granules fit at its top and return
+// the first of them. The soft limit is handled as in the boundary-tag
+// engine: below it the heap grows by at least CHUNKSIZE, near it only
+// by what the top run is missing, and past it the pressure callback
+// gets one chance to free memory.
+//
+static size_t grow(mm_heap_t *h, size_t n)
+{
+  size_t need = n - top_free(h);
+  size_t chunk = need > CHUNKSIZE/DSIZE ? need : CHUNKSIZE/DSIZE;
+  size_t heapsize = mem_heapsize_r(h->mem);
+  size_t g;
+
+  if (h->limit == 0 || heapsize + chunk * DSIZE <= h->limit){
+    return extend(h, chunk) < 0 ? NOFIT : h->ngran - chunk - (n - need);
+  }
+  if (heapsize + need * DSIZE <= h->limit){
+    return extend(h, need) < 0 ? NOFIT : h->ngran - n;
+  }
+
+  if (h->pressure == NULL
+      || !h->pressure(h, heapsize + need * DSIZE - h->limit, h->pressure_arg)){
+    return NOFIT;
+  }
+  if ((g = find_fit(h, n)) != NOFIT){
+    return g;
+  }
+  need = n - top_free(h);
+  if (mem_heapsize_r(h->mem) + need * DSIZE <= h->limit && extend(h, need) == 0){
+    return h->ngran - n;
+  }
+  return NOFIT;
+}
+
+//
+// mm_heap_reserve - Extend the heap by what its top run of clear
+// granules lacks to hold a bytes-byte request. Prefaulting covers the
+// run and the bitmap words that describe it.
+//
+int mm_heap_reserve(mm_heap_t *h, size_t bytes, int flags)
+{
+  size_t n = (bytes + DSIZE-1) / DSIZE;
+  size_t top = top_free(h), g;
+
+  if (n > top){
+    if (h->limit && mem_heapsize_r(h->mem) + (n - top) * DSIZE > h->limit){
+      return -1;
+    }
+    if (extend(h, n - top) < 0){
+      return -1;
+    }
+    top = n;
+  }
+
+  if (flags & MM_PREFAULT){
+    g = h->ngran - top;
+    mem_prefault(h->base + g * DSIZE, top * DSIZE);
+    mem_prefault(h->alloc + g / BITS, (top / BITS + 2) * sizeof(bitword_t));
+    mem_prefault(h->start + g / BITS, (top / BITS + 2) * sizeof(bitword_t));
+  }
+  return 0;
+}
+
+//
+// mm_heap_metasize - Bytes of both bitmaps that cover the heap at its peak
+//
+size_t mm_heap_metasize(mm_heap_t *h)
+{
+  size_t peak = (mem_heappeak_r(h->mem) + DSIZE-1) / DSIZE;
+
+  return 2 * ((peak + BITS-1) / BITS) * sizeof(bitword_t)
+    + handles_metasize(h);
+}
+
+//
+// mm_heap_freestats - Count the runs of clear granules, each of which
+// is one free block to first_run, and the bytes they cover
+//
+void mm_heap_freestats(mm_heap_t *h, size_t *blocks, size_t *bytes)
+{
+  size_t g, e;
+
+  *blocks = *bytes = 0;
+  for (g = next_clear(h->alloc, 0, h->ngran); g < h->ngran;
+       g = next_clear(h->alloc, e, h->ngran)){
+    e = next_set(h->alloc, g, h->ngran);
+    (*blocks)++;
+    *bytes += (e - g) * DSIZE;
+  }
+}
+
+//
+// heap_init - Map the bitmaps on first use (or clear the part a previous
+// run touched) and start the heap with CHUNKSIZE bytes of free space
+//
+static int heap_init(mm_heap_t *h)
+{
+  char *lo = mem_heap_lo_r(h->mem);
+  size_t words = ((h->mem->max_addr - lo) / DSIZE + BITS-1) / BITS;
+
+  if (h->meta == NULL){
+    if ((h->meta = mem_create(2 * words * sizeof(bitword_t))) == NULL){
+      return -1;
+    }
+    h->alloc = mem_heap_lo_r(h->meta);
+    h->start = h->alloc + words;
+  } else {
+    words = (h->ngran + BITS-1) / BITS;
+    memset(h->alloc, 0, words * sizeof(bitword_t));
+    memset(h->start, 0, words * sizeof(bitword_t));
+  }
+  h->base = (char *)mem_heap_hi_r(h->mem) + 1;
+  h->ngran = 0;
+  h->hint = 0;
+  h->rover = 0;
+  h->root = 0;
+  return extend(h, CHUNKSIZE/DSIZE);
+}
+
+//
+// mm_heap_malloc - Allocate a block with at least size bytes of payload
+//
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+  size_t n, g;
+
+  if (size == 0){
+    return NULL;
+  }
+  n = (size + DSIZE-1) / DSIZE;
+  if ((g = find_fit(h, n)) == NOFIT && (g = grow(h, n)) == NOFIT){
+    return NULL;
+  }
+  set_bits(h->alloc, g, g + n);
+  h->start[g / BITS] |= (bitword_t)1 << (g % BITS);
+  return h->base + g * DSIZE;
+}
+
+//
+// mm_heap_free - Free a block by clearing its bits
+//
+void mm_heap_free(mm_heap_t *h, void *bp)
+{
+  size_t g = ((char *)bp - h->base) / DSIZE;
+  size_t n = block_len(h, g);
+
+  h->start[g / BITS] &= ~((bitword_t)1 << (g % BITS));
+  clear_bits(h->alloc, g, g + n);
+  if (g < h->hint){
+    h->hint = g;
+  }
+}
+
+//
+// mm_heap_realloc - Shrink in place, grow in place into free granules
+// (or the top of the heap) that follow, and only otherwise copy
+//
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+  size_t g = ((char *)ptr - h->base) / DSIZE;
+  size_t oldn = block_len(h, g);
+  size_t n = size ? (size + DSIZE-1) / DSIZE : 1;
+  void *newp;
+
+  if (n <= oldn){
+    if (n < oldn){
+      clear_bits(h->alloc, g + n, g + oldn);
+      if (g + n < h->hint){
+        h->hint = g + n;
+      }
+    }
+    return ptr;
+  }
+
+  if (next_set(h->alloc, g + oldn, MIN_SZ(h->ngran, g + n)) == h->ngran
+      && g + n > h->ngran
+      && (h->limit == 0
+          || mem_heapsize_r(h->mem) + (g + n - h->ngran) * DSIZE <= h->limit)){
+    extend(h, g + n - h->ngran);
+  }
+  if (next_set(h->alloc, g + oldn, MIN_SZ(h->ngran, g + n)) == g + n){
+    set_bits(h->alloc, g + oldn, g + n);
+    return ptr;
+  }
+
+  // On failure the old block is left alone, as with realloc(3)
+  if ((newp = mm_heap_malloc(h, size)) == NULL){
+    return NULL;
+  }
+  memcpy(newp, ptr, oldn * DSIZE);
+  mm_heap_free(h, ptr);
+  return newp;
+}
+
+//
+// mm_heap_checkheap - Check that every allocated run starts a block,
+// that no start bit marks a free granule, that nothing past the brk is
+// marked and that the hint is a true lower bound on free space
+//
+int mm_heap_checkheap(mm_heap_t *h, int verbose)
+{
+  size_t g, n, words = (h->ngran + BITS-1) / BITS;
+  int errors = 0;
+
+  if (verbose){
+    printf("Heap (%p): %lu granules\n", h->base, (unsigned long)h->ngran);
+  }
+
+  for (g = next_set(h->alloc, 0, h->ngran); g < h->ngran;
+       g = next_set(h->alloc, g + n, h->ngran)){
+    if (!TESTBIT(h->start, g)){
+      printf("Error: %p is allocated but starts no block\n",
+             h->base + g * DSIZE);
+      errors++;
+    }
+    n = block_len(h, g);
+    if (verbose){
+      printf("%p: [%lu:a]\n", h->base + g * DSIZE, (unsigned long)(n * DSIZE));
+    }
+  }
+
+  for (g = next_set(h->start, 0, h->ngran); g < h->ngran;
+       g = next_set(h->start, g + 1, h->ngran)){
+    if (!TESTBIT(h->alloc, g)){
+      printf("Error: %p starts a block but is free\n", h->base + g * DSIZE);
+      errors++;
+    }
+  }
+
+  if (next_set(h->alloc, h->ngran, words * BITS) != words * BITS
+      || next_set(h->start, h->ngran, words * BITS) != words * BITS){
+    printf("Error: granules past the brk are marked\n");
+    errors++;
+  }
+  if (next_clear(h->alloc, 0, h->hint) != h->hint){
+    printf("Error: free granule below the hint\n");
+    errors++;
+  }
+  return errors;
+}
+
+#elif MM_ENGINE == ENGINE_BUDDY
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Buddy engine
+//
+// Every block is 2^k bytes, k >= MIN_ORDER, and lies at an offset from
+// h->base that is a multiple of its size, so the buddy of the block at
+// offset o is at o ^ 2^k and coalescing is at most one step per order.
+// Blocks carry no header. The order of each block is kept in a side
+// table with one byte per MIN_BLOCK granule, and a bitmap marks the
+// granules where free blocks start. Free blocks of each order are on a
+// circular list of their own.
+//
+
+#define MIN_ORDER 4                 // smallest block is 2^MIN_ORDER bytes
+#define MIN_BLOCK (1 << MIN_ORDER)
+#define NORDERS   28                // orders MIN_ORDER..MIN_ORDER+NORDERS-1
+#define NOFIT ((size_t)-1)          // take/grow found no room
+
+struct mm_heap {
+  mem_t *mem;               // memlib heap the blocks live in
+  mem_t *meta;              // memlib region holding the side tables
+  char *base;               // offset 0 of the buddy system
+  size_t size;              // bytes between base and the brk
+  unsigned char *order;     // order of the block at each granule
+  uint64_t *freemap;        // set where a free block starts
+  struct CLNode lists[NORDERS]; // free blocks by order
+  size_t limit;             // soft limit on the heap size (0 = none)
+  mm_pressure_fn pressure;  // called when growth would cross the limit
+  void *pressure_arg;       // passed back to pressure
+  mem_t *handles;           // memlib region holding the handle table
+  struct mm_hslot *hslots;  // free handle slots
+  size_t root;              // offset of the root object + 1 (0 = none)
+};
+
+static inline size_t BLOCK(int k) {
+  return (size_t)1 << k;
+}
+
+static inline FL_Pointer NODE(mm_heap_t *h, size_t off) {
+  return (FL_Pointer)(h->base + off);
+}
+
+//
+// order_of - Smallest order whose blocks hold size bytes
+//
+static inline int order_of(size_t size)
+{
+  if (size <= MIN_BLOCK){
+    return MIN_ORDER;
+  }
+  return 8 * sizeof(unsigned long) - __builtin_clzl(size - 1);
+}
+
+//
+// is_free - Is there a free block of order k at offset off?
+//
+static inline int is_free(mm_heap_t *h, size_t off, int k)
+{
+  size_t g = off >> MIN_ORDER;
+
+  return off + BLOCK(k) <= h->size
+    && (h->freemap[g / 64] >> (g % 64) & 1)
+    && h->order[g] == k;
+}
+
+static void mark_free(mm_heap_t *h, size_t off, int k)
+{
+  size_t g = off >> MIN_ORDER;
+
+  h->order[g] = k;
+  h->freemap[g / 64] |= (uint64_t)1 << (g % 64);
+  CL_append(&h->lists[k - MIN_ORDER], NODE(h, off));
+}
+
+static void unmark_free(mm_heap_t *h, size_t off)
+{
+  size_t g = off >> MIN_ORDER;
+
+  h->freemap[g / 64] &= ~((uint64_t)1 << (g % 64));
+  CL_unlink(NODE(h, off));
+}
+
+//
+// release - Free the block of order k at off, merging it with its
+// buddy for as long as the buddy is free and whole
+//
+static void release(mm_heap_t *h, size_t off, int k)
+{
+  size_t buddy;
+
+  while (k < MIN_ORDER + NORDERS - 1){
+    buddy = off ^ BLOCK(k);
+    if (!is_free(h, buddy, k)){
+      break;
+    }
+    unmark_free(h, buddy);
+    off &= ~BLOCK(k);
+    k++;
+  }
+  mark_free(h, off, k);
+}
+
+//
+// take - Allocate a block of order k from the free lists, splitting a
+// bigger one if need be; the upper halves go back on their lists
+//
+static size_t take(mm_heap_t *h, int k)
+{
+  struct CLNode *list;
+  size_t off;
+  int j;
+
+  for (j = k; j < MIN_ORDER + NORDERS; j++){
+    list = &h->lists[j - MIN_ORDER];
+    if (list->next != list){
+      break;
+    }
+  }
+  if (j == MIN_ORDER + NORDERS){
+    return NOFIT;
+  }
+  off = (char *)list->next - h->base;
+  unmark_free(h, off);
+  while (j > k){
+    j--;
+    mark_free(h, off + BLOCK(j), j);
+  }
+  h->order[off >> MIN_ORDER] = k;
+  return off;
+}
+
+//
+// extend - Grow the heap to hold a block of order k at the next offset
+// aligned to its size. The gap below it is cut into the largest aligned
+// blocks that fit and freed.
+//
+static size_t extend(mm_heap_t *h, int k)
+{
+  size_t off = h->size;
+  size_t at = (off + BLOCK(k) - 1) & ~(BLOCK(k) - 1);
+  int j;
+
+  if (h->limit
+      && mem_heapsize_r(h->mem) + (at + BLOCK(k) - off) > h->limit){
+    return NOFIT;
+  }
+  if (mem_sbrk_r(h->mem, at + BLOCK(k) - off) == (void *)-1){
+    return NOFIT;
+  }
+  h->size = at + BLOCK(k);
+  h->order[at >> MIN_ORDER] = k;
+
+  while (off < at){
+    for (j = __builtin_ctzl(off); off + BLOCK(j) > at; j--)
+      ;
+    release(h, off, j);
+    off += BLOCK(j);
+  }
+  return at;
+}
+
+//
+// grow - Make room for a block of order k at the top of the heap. Near
+// the soft limit the pressure callback gets one chance to free memory.
+//
+static size_t grow(mm_heap_t *h, int k)
+{
+  size_t off;
+
+  if ((off = extend(h, k)) != NOFIT){
+    return off;
+  }
+  if (h->limit == 0 || h->pressure == NULL
+      || !h->pressure(h, BLOCK(k), h->pressure_arg)){
+    return NOFIT;
+  }
+  if ((off = take(h, k)) != NOFIT){
+    return off;
+  }
+  return extend(h, k);
+}
+
+//
+// mm_heap_reserve - Unless a free block of the order that holds bytes
+// is on the free lists, extend the heap by one and free it. Prefaulting
+// covers the block and its order table entries.
+//
+int mm_heap_reserve(mm_heap_t *h, size_t bytes, int flags)
+{
+  struct CLNode *list;
+  size_t off = NOFIT;
+  int j, k;
+
+  if (bytes == 0 || bytes > BLOCK(MIN_ORDER + NORDERS - 1)){
+    return -1;
+  }
+  k = order_of(bytes);
+  for (j = k; j < MIN_ORDER + NORDERS && off == NOFIT; j++){
+    list = &h->lists[j - MIN_ORDER];
+    if (list->next != list){
+      off = (char *)list->next - h->base;
+      k = j;
+    }
+  }
+  if (off == NOFIT){
+    if ((off = extend(h, k)) == NOFIT){
+      return -1;
+    }
+    release(h, off, k);
+  }
+
+  if (flags & MM_PREFAULT){
+    mem_prefault(h->base + off, BLOCK(k));
+    mem_prefault(h->order + (off >> MIN_ORDER), BLOCK(k) >> MIN_ORDER);
+    // splitting the block marks free blocks all through it
+    mem_prefault(h->freemap + (off >> MIN_ORDER) / 64,
+                 ((BLOCK(k) >> MIN_ORDER) / 64 + 1) * sizeof(uint64_t));
+  }
+  return 0;
+}
+
+//
+// mm_heap_metasize - Bytes of order table and free bitmap that cover
+// the heap at its peak
+//
+size_t mm_heap_metasize(mm_heap_t *h)
+{
+  size_t peak = (mem_heappeak_r(h->mem) + MIN_BLOCK-1) / MIN_BLOCK;
+
+  return peak + (peak + 63) / 64 * sizeof(uint64_t) + handles_metasize(h);
+}
+
+//
+// mm_heap_freestats - Count the blocks marked in the free bitmap and
+// add up their orders' sizes
+//
+void mm_heap_freestats(mm_heap_t *h, size_t *blocks, size_t *bytes)
+{
+  size_t w, g, words = (h->size / MIN_BLOCK + 63) / 64;
+  uint64_t word;
+
+  *blocks = *bytes = 0;
+  for (w = 0; w < words; w++){
+    for (word = h->freemap[w]; word != 0; word &= word - 1){
+      g = w * 64 + __builtin_ctzll(word);
+      (*blocks)++;
+      *bytes += BLOCK(h->order[g]);
+    }
+  }
+}
+
+//
+// heap_init - Map the side tables on first use (or clear the bitmap a
+// previous run touched) and empty the free lists
+//
+static int heap_init(mm_heap_t *h)
+{
+  char *lo = mem_heap_lo_r(h->mem);
+  size_t ngran = (h->mem->max_addr - lo) / MIN_BLOCK;
+  size_t words = (ngran + 63) / 64;
+  int k;
+
+  if (h->meta == NULL){
+    if ((h->meta = mem_create(words * sizeof(uint64_t) + ngran)) == NULL){
+      return -1;
+    }
+    h->freemap = mem_heap_lo_r(h->meta);
+    h->order = (unsigned char *)(h->freemap + words);
+  } else {
+    words = (h->size / MIN_BLOCK + 63) / 64;
+    memset(h->freemap, 0, words * sizeof(uint64_t));
+  }
+  for (k = 0; k < NORDERS; k++){
+    CL_init(&h->lists[k]);
+  }
+  h->base = (char *)mem_heap_hi_r(h->mem) + 1;
+  h->size = 0;
+  h->root = 0;
+  return 0;
+}
+
+//
+// mm_heap_malloc - Allocate a block of the smallest order that holds size
+//
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+  size_t off;
+  int k;
+
+  if (size == 0 || size > BLOCK(MIN_ORDER + NORDERS - 1)){
+    return NULL;
+  }
+  k = order_of(size);
+  if ((off = take(h, k)) == NOFIT && (off = grow(h, k)) == NOFIT){
+    return NULL;
+  }
+  return h->base + off;
+}
+
+//
+// mm_heap_free - Free a block and merge it with its buddies
+//
+void mm_heap_free(mm_heap_t *h, void *bp)
+{
+  size_t off = (char *)bp - h->base;
+
+  release(h, off, h->order[off >> MIN_ORDER]);
+}
+
+//
+// mm_heap_realloc - Keep the block if size still fits, grow it in place
+// by absorbing free upper buddies, and only otherwise copy
+//
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+  size_t off = (char *)ptr - h->base;
+  int k = h->order[off >> MIN_ORDER];
+  int need = order_of(size);
+  size_t oldsize = BLOCK(k);
+  void *newp;
+
+  while (k < need && (off & BLOCK(k)) == 0
+         && is_free(h, off + BLOCK(k), k)){
+    unmark_free(h, off + BLOCK(k));
+    k++;
+  }
+  h->order[off >> MIN_ORDER] = k;
+  if (k >= need){
+    return ptr;
+  }
+
+  // On failure the old block is left alone, as with realloc(3)
+  if ((newp = mm_heap_malloc(h, size)) == NULL){
+    return NULL;
+  }
+  memcpy(newp, ptr, oldsize);
+  mm_heap_free(h, ptr);
+  return newp;
+}
+
+//
+// mm_heap_checkheap - Walk the blocks in address order and check that
+// each is aligned to its size, that no two free buddies went unmerged,
+// and that the free lists hold exactly the blocks the bitmap marks
+//
+int mm_heap_checkheap(mm_heap_t *h, int verbose)
+{
+  size_t off, g, nfree = 0, nlisted = 0;
+  struct CLNode *ptr;
+  int k, errors = 0;
+
+  if (verbose){
+    printf("Heap (%p): %lu bytes\n", h->base, (unsigned long)h->size);
+  }
+  for (off = 0; off < h->size; off += BLOCK(k)){
+    g = off >> MIN_ORDER;
+    k = h->order[g];
+    if (k < MIN_ORDER || k >= MIN_ORDER + NORDERS){
+      printf("Error: bad order %d at %p\n", k, h->base + off);
+      return errors + 1;
+    }
+    if (off & (BLOCK(k) - 1)){
+      printf("Error: %p is not aligned to its size\n", h->base + off);
+      errors++;
+    }
+    if (h->freemap[g / 64] >> (g % 64) & 1){
+      nfree++;
+      if (is_free(h, off ^ BLOCK(k), k)){
+        printf("Error: free buddies %p and %p not merged\n",
+               h->base + off, h->base + (off ^ BLOCK(k)));
+        errors++;
+      }
+    }
+    if (verbose){
+      printf("%p: [%lu:%c]\n", h->base + off, (unsigned long)BLOCK(k),
+             (h->freemap[g / 64] >> (g % 64) & 1) ? 'f' : 'a');
+    }
+  }
+  if (off != h->size){
+    printf("Error: last block runs past the brk\n");
+    errors++;
+  }
+  for (k = 0; k < NORDERS; k++){
+    for (ptr = h->lists[k].next; ptr != &h->lists[k]; ptr = ptr->next){
+      nlisted++;
+      if (!is_free(h, (char *)ptr - h->base, k + MIN_ORDER)){
+        printf("Error: %p is on the order %d list but not free\n",
+               ptr, k + MIN_ORDER);
+        errors++;
+      }
+    }
+  }
+  if (nlisted != nfree){
+    printf("Error: %lu free blocks but %lu on the lists\n",
+           (unsigned long)nfree, (unsigned long)nlisted);
+    errors++;
+  }
+  return errors;
+}
+
+#endif /* MM_ENGINE */
+
+#if MM_ENGINE != ENGINE_TAGS
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Side-table engines
+//
+// The bitmap and buddy engines keep their metadata in a memlib region
+// of their own, h->meta, and share the rest of their plumbing.
+//
+
+//
+// mm_heap_create - Make an independent heap of at most maxsize bytes.
+// The struct mm_heap sits at the bottom of the heap's memlib region;
+// the side tables get a region of their own.
+//
+mm_heap_t *mm_heap_create(size_t maxsize)
+{
+  mem_t *mem;
+  mm_heap_t *h;
+
+  if ((mem = mem_create(maxsize)) == NULL){
+    return NULL;
+  }
+  h = mem_sbrk_r(mem, DSIZE * ((sizeof(struct mm_heap) + DSIZE-1) / DSIZE));
+  if (h == (void *)-1){
+    mem_destroy(mem);
+    return NULL;
+  }
+  h->mem = mem;
+  h->meta = NULL;
+  if (heap_init(h) < 0){
+    mem_destroy(mem);
+    return NULL;
+  }
+  return h;
+}
+
+//
+// mm_heap_destroy - Release a heap, its side tables and every block in it
+//
+void mm_heap_destroy(mm_heap_t *h)
+{
+  mem_t *mem = h->mem;
+
+  mem_destroy(h->meta);
+  if (h->handles != NULL){
+    mem_destroy(h->handles);
+  }
+  mem_destroy(mem);
+}
+
+//
+// mm_heap_set_limit/mm_heap_set_pressure_callback - As for the
+// boundary-tag engine
+//
+void mm_heap_set_limit(mm_heap_t *h, size_t bytes)
+{
+  h->limit = bytes;
+}
 
-  hsize = GET_SIZE(HDRP(bp));
-  halloc = GET_ALLOC(HDRP(bp));
-  fsize = GET_SIZE(FTRP(bp));
-  falloc = GET_ALLOC(FTRP(bp));
+void mm_heap_set_pressure_callback(mm_heap_t *h, mm_pressure_fn fn, void *arg)
+{
+  h->pressure = fn;
+  h->pressure_arg = arg;
+}
 
-  if (hsize == 0) {
-    printf("%p: EOL\n", bp);
+//
+// Decay purging and deferred frees are boundary-tag features. In the
+// bitmap engine a free only clears bits, and a buddy free is a bounded
+// walk up the orders, so both are accepted and ignored here.
+//
+void mm_heap_set_decay(mm_heap_t *h, long ms)
+{
+  (void)h;
+  (void)ms;
+}
+
+void mm_heap_purge(mm_heap_t *h)
+{
+  (void)h;
+}
+
+void mm_heap_set_deferred(mm_heap_t *h, int on)
+{
+  (void)h;
+  (void)on;
+}
+
+void mm_heap_flush(mm_heap_t *h)
+{
+  (void)h;
+}
+
+//
+// Buddy blocks come in size classes of their own, and the bitmap
+// engine's granules leave no sliver to avoid.
+//
+void mm_heap_set_classes(mm_heap_t *h, int on)
+{
+  (void)h;
+  (void)on;
+}
+
+//
+// Free space in the bitmap engine is found in address order already,
+// and buddy blocks are placed by their order: there is no free index
+// to reorder.
+//
+void mm_heap_set_reorder(mm_heap_t *h, int n)
+{
+  (void)h;
+  (void)n;
+}
+
+int mm_heap_reorder(mm_heap_t *h, size_t steps)
+{
+  (void)h;
+  (void)steps;
+  return 0;
+}
+
+//
+// Blocks never move in these engines, so a handle block is a plain
+// block and compaction has nothing to do
+//
+#define HANDLE_HDR 0
+
+static void handle_attach(mm_heap_t *h, void *bp, struct mm_hslot *s)
+{
+  (void)h;
+  (void)bp;
+  (void)s;
+}
+
+static void handle_detach(mm_heap_t *h, void *bp)
+{
+  (void)h;
+  (void)bp;
+}
+
+size_t mm_heap_compact(mm_heap_t *h, size_t budget)
+{
+  (void)h;
+  (void)budget;
+  return 0;
+}
+
+//
+// Their side tables hold no addresses either, but only the boundary-tag
+// engine knows how to keep a heap in a file.
+//
+mm_heap_t *mm_heap_open(const char *path, size_t maxsize)
+{
+  (void)path;
+  (void)maxsize;
+  return NULL;
+}
+
+int mm_heap_sync(mm_heap_t *h)
+{
+  (void)h;
+  return -1;
+}
+
+void mm_heap_close(mm_heap_t *h)
+{
+  mm_heap_destroy(h);
+}
+
+mm_heap_t *mm_heap_share(size_t maxsize)
+{
+  (void)maxsize;
+  return NULL;
+}
+
+mm_heap_t *mm_heap_attach(int fd)
+{
+  (void)fd;
+  return NULL;
+}
+
+int mm_heap_fd(mm_heap_t *h)
+{
+  (void)h;
+  return -1;
+}
+
+// Their heaps are never shared, so there is nothing to lock
+static int heap_lock(mm_heap_t *h)
+{
+  (void)h;
+  return 0;
+}
+
+static void heap_unlock(mm_heap_t *h)
+{
+  (void)h;
+}
+
+static int heap_shared(mm_heap_t *h)
+{
+  (void)h;
+  return 0;
+}
+
+#endif /* MM_ENGINE != ENGINE_TAGS */
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Size classes
+//
+// The class table comes from sizeclass.h, which mkclasses generates
+// from the request sizes of a trace set ("make classes"). Each class
+// is the largest request it serves; requests above the largest class
+// have none.
+//
+
+//
+// mm_size_class - The smallest class that holds size bytes, or size
+// itself if no class is that big
+//
+size_t mm_size_class(size_t size)
+{
+  int lo = 0, hi = SIZE_CLASSES, mid;
+
+  if (size > SIZE_CLASS_MAX){
+    return size;
+  }
+  while (lo < hi){
+    mid = (lo + hi) / 2;
+    if (size_class[mid] < size){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return size_class[lo];
+}
+
+//
+// mm_size_classes - Point *classes at the class table; returns its length
+//
+int mm_size_classes(const unsigned int **classes)
+{
+  *classes = size_class;
+  return SIZE_CLASSES;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Root objects
+//
+// Every engine keeps the root as an offset from h->base, so that it
+// stays valid in a persistent heap mapped somewhere else. In a shared
+// heap h->base is only this process's while it holds the lock.
+//
+
+void mm_heap_set_root(mm_heap_t *h, void *p)
+{
+  if (heap_lock(h) < 0){
     return;
   }
+  h->root = (p != NULL) ? (size_t)((char *)p - h->base) + 1 : 0;
+  heap_unlock(h);
+}
 
-  printf("%p: header: [%d:%c] footer: [%d:%c]\n",
-      bp,
-      (int) hsize, (halloc ? 'a' : 'f'),
-      (int) fsize, (falloc ? 'a' : 'f'));
+void *mm_heap_root(mm_heap_t *h)
+{
+  void *p;
+
+  if (heap_lock(h) < 0){
+    return NULL;
+  }
+  p = h->root ? h->base + h->root - 1 : NULL;
+  heap_unlock(h);
+  return p;
 }
 
-static void checkblock(void *bp)
+/////////////////////////////////////////////////////////////////////////////
+//
+// Handle tables
+//
+// Every heap keeps its handle slots in a memlib region of its own, so
+// a slot never moves even when the blocks do. The region is mapped on
+// the first mm_heap_halloc and sized for one slot per minimum block.
+//
+
+static struct mm_hslot *hslot_new(mm_heap_t *h)
 {
-  if ((size_t)bp % 8) {
-    printf("Error: %p is not doubleword aligned\n", bp);
+  struct mm_hslot *s;
+  size_t max;
+
+  if ((s = h->hslots) != NULL){
+    h->hslots = s->bp;
+    return s;
   }
-  if (GET(HDRP(bp)) != GET(FTRP(bp))) {
-    printf("Error: header does not match footer\n");
+  if (h->handles == NULL){
+    max = (h->mem->max_addr - h->mem->start_brk) / (2*DSIZE);
+    if ((h->handles = mem_create(max * sizeof(struct mm_hslot))) == NULL){
+      return NULL;
+    }
+  }
+  s = mem_sbrk_r(h->handles, sizeof(struct mm_hslot));
+  return s == (void *)-1 ? NULL : s;
+}
+
+static void hslot_free(mm_heap_t *h, struct mm_hslot *s)
+{
+  s->bp = h->hslots;
+  h->hslots = s;
+}
+
+//
+// handles_metasize - Bytes of handle table at its peak
+//
+static size_t handles_metasize(mm_heap_t *h)
+{
+  return h->handles ? mem_heappeak_r(h->handles) : 0;
+}
+
+//
+// mm_heap_halloc - Allocate a relocatable block of size bytes
+//
+mm_handle_t mm_heap_halloc(mm_heap_t *h, size_t size)
+{
+  struct mm_hslot *s;
+  void *bp;
+
+  // the handle table is private to one process
+  if (heap_shared(h)){
+    return NULL;
+  }
+  if ((s = hslot_new(h)) == NULL){
+    return NULL;
+  }
+  if ((bp = mm_heap_malloc(h, size + HANDLE_HDR)) == NULL){
+    hslot_free(h, s);
+    return NULL;
+  }
+  handle_attach(h, bp, s);
+  s->bp = bp;
+  s->locks = 0;
+  return s;
+}
+
+//
+// mm_heap_hrealloc - Resize a handle's block; the handle stays the same.
+// On failure the old block is left alone and NULL is returned.
+//
+mm_handle_t mm_heap_hrealloc(mm_heap_t *h, mm_handle_t hd, size_t size)
+{
+  void *bp;
+
+  handle_detach(h, hd->bp);
+  if ((bp = mm_heap_realloc(h, hd->bp, size + HANDLE_HDR)) == NULL){
+    handle_attach(h, hd->bp, hd);
+    return NULL;
+  }
+  handle_attach(h, bp, hd);
+  hd->bp = bp;
+  return hd;
+}
+
+void mm_heap_hfree(mm_heap_t *h, mm_handle_t hd)
+{
+  handle_detach(h, hd->bp);
+  mm_heap_free(h, hd->bp);
+  hslot_free(h, hd);
+}
+
+void *mm_hlock(mm_handle_t hd)
+{
+  hd->locks++;
+  return (char *)hd->bp + HANDLE_HDR;
+}
+
+void mm_hunlock(mm_handle_t hd)
+{
+  hd->locks--;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The default heap
+//
+// The classic mm_* interface is the mm_heap_* interface applied to
+// default_heap, which grows in memlib's default heap. Every engine
+// provides heap_init and the mm_heap_* functions.
+//
+
+static struct mm_heap default_heap;
+
+//
+// mm_init - Initialize the memory manager
+//
+int mm_init(void)
+{
+  default_heap.mem = mem_default();
+  if (default_heap.handles != NULL){
+    mem_reset_brk_r(default_heap.handles);
   }
+  default_heap.hslots = NULL;
+  return heap_init(&default_heap);
+}
+
+void *mm_malloc(size_t size)
+{
+  return mm_heap_malloc(&default_heap, size);
+}
+
+void mm_free(void *bp)
+{
+  mm_heap_free(&default_heap, bp);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+  return mm_heap_realloc(&default_heap, ptr, size);
+}
+
+int mm_checkheap(int verbose)
+{
+  return mm_heap_checkheap(&default_heap, verbose);
+}
+
+void mm_set_limit(size_t bytes)
+{
+  mm_heap_set_limit(&default_heap, bytes);
+}
+
+void mm_set_pressure_callback(mm_pressure_fn fn, void *arg)
+{
+  mm_heap_set_pressure_callback(&default_heap, fn, arg);
+}
+
+void mm_set_decay(long ms)
+{
+  mm_heap_set_decay(&default_heap, ms);
+}
+
+void mm_purge(void)
+{
+  mm_heap_purge(&default_heap);
+}
+
+int mm_reserve(size_t bytes, int flags)
+{
+  return mm_heap_reserve(&default_heap, bytes, flags);
+}
+
+void mm_set_deferred(int on)
+{
+  mm_heap_set_deferred(&default_heap, on);
+}
+
+void mm_flush(void)
+{
+  mm_heap_flush(&default_heap);
+}
+
+void mm_set_classes(int on)
+{
+  mm_heap_set_classes(&default_heap, on);
+}
+
+const char *mm_engine_name(void)
+{
+#if MM_ENGINE == ENGINE_BITMAP
+  return "bitmap";
+#elif MM_ENGINE == ENGINE_BUDDY
+  return "buddy";
+#else
+  return "tags";
+#endif
+}
+
+int mm_engine_features(void)
+{
+#if MM_ENGINE == ENGINE_TAGS
+  return MM_DECAY | MM_DEFERRED | MM_CLASSES | MM_REORDER | MM_COMPACT
+    | MM_FILES;
+#else
+  return 0;
+#endif
+}
+
+mm_handle_t mm_halloc(size_t size)
+{
+  return mm_heap_halloc(&default_heap, size);
+}
+
+mm_handle_t mm_hrealloc(mm_handle_t hd, size_t size)
+{
+  return mm_heap_hrealloc(&default_heap, hd, size);
+}
+
+void mm_hfree(mm_handle_t hd)
+{
+  mm_heap_hfree(&default_heap, hd);
+}
+
+size_t mm_compact(size_t budget)
+{
+  return mm_heap_compact(&default_heap, budget);
+}
+
+void mm_set_reorder(int n)
+{
+  mm_heap_set_reorder(&default_heap, n);
+}
+
+int mm_reorder(size_t steps)
+{
+  return mm_heap_reorder(&default_heap, steps);
+}
+
+size_t mm_metasize(void)
+{
+  return mm_heap_metasize(&default_heap);
 }
 
+void mm_freestats(size_t *blocks, size_t *bytes)
+{
+  mm_heap_freestats(&default_heap, blocks, bytes);
+}
+
+void mm_set_root(void *p)
+{
+  mm_heap_set_root(&default_heap, p);
+}
+
+void *mm_root(void)
+{
+  return mm_heap_root(&default_heap);
+}
@@ -5,7 +5,185 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_checkheap(int verbose);
 
+/*
+ * Independent heaps. mm_init/mm_malloc/mm_free/mm_realloc above use a
+ * default heap; each mm_heap_t has its own memory, released in one
+ * call by mm_heap_destroy without visiting the blocks inside it.
+ * mm_checkheap and mm_heap_checkheap return the problems they found.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(size_t maxsize);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+extern int mm_heap_checkheap(mm_heap_t *h, int verbose);
+
+/* Name of the allocator engine mm.c was built with */
+extern const char *mm_engine_name(void);
+
+/*
+ * Features the engine implements. The boundary-tag engine has them
+ * all; the others accept the calls of a feature they lack and ignore
+ * them (persistent and shared heaps fail to open).
+ */
+#define MM_DECAY      0x01   /* mm_set_decay, mm_purge */
+#define MM_DEFERRED   0x02   /* mm_set_deferred, mm_flush */
+#define MM_CLASSES    0x04   /* mm_set_classes */
+#define MM_REORDER    0x08   /* mm_set_reorder, mm_reorder */
+#define MM_COMPACT    0x10   /* mm_compact moves handle blocks */
+#define MM_FILES      0x20   /* mm_heap_open, mm_heap_share */
+
+extern int mm_engine_features(void);
+
+/* Bytes of allocator metadata kept outside the heap, at its peak size */
+extern size_t mm_metasize(void);
+extern size_t mm_heap_metasize(mm_heap_t *h);
+
+/*
+ * Free blocks the allocator would search, and the bytes they hold.
+ * Counted on each call, in time linear in the free blocks (the bitmap
+ * engine scans its bitmap), so for sampling rather than every request.
+ */
+extern void mm_freestats(size_t *blocks, size_t *bytes);
+extern void mm_heap_freestats(mm_heap_t *h, size_t *blocks, size_t *bytes);
+
+/*
+ * Soft heap limits. When growth would push a heap past its limit, the
+ * allocator grows by the bare minimum, then purges dirty pages (with
+ * decay purging on) and calls the pressure callback, which returns
+ * nonzero if it released memory. The request is retried once and only
+ * then fails with NULL. Trimming the heap first would not help, as the
+ * limit is on the heap size and the top free block already counts.
+ */
+typedef int (*mm_pressure_fn)(mm_heap_t *h, size_t need, void *arg);
+
+extern void mm_set_limit(size_t bytes);
+extern void mm_set_pressure_callback(mm_pressure_fn fn, void *arg);
+extern void mm_heap_set_limit(mm_heap_t *h, size_t bytes);
+extern void mm_heap_set_pressure_callback(mm_heap_t *h, mm_pressure_fn fn,
+                                          void *arg);
+
+/*
+ * Decay purging. Pages inside big free blocks are returned to the OS
+ * once the block has been free for ms milliseconds (0 = never).
+ * Ages are checked every few hundred mallocs; mm_purge purges now.
+ */
+extern void mm_set_decay(long ms);
+extern void mm_purge(void);
+extern void mm_heap_set_decay(mm_heap_t *h, long ms);
+extern void mm_heap_purge(mm_heap_t *h);
+
+/*
+ * Reservation. mm_reserve grows the heap up front so that its top is
+ * one free block that holds a bytes-byte request. With MM_PREFAULT
+ * the block's pages are made resident too, so later requests that fit
+ * in it neither grow the heap nor fault (unless decay purging hands
+ * the pages back first). Returns 0, or -1 if the heap cannot grow
+ * that far under its limit.
+ */
+#define MM_PREFAULT 0x1
+
+extern int mm_reserve(size_t bytes, int flags);
+extern int mm_heap_reserve(mm_heap_t *h, size_t bytes, int flags);
+
+/*
+ * Deferred frees. Small blocks freed in deferred mode wait on per-size
+ * quick lists for exact reuse. A list that overflows coalesces a few of
+ * its blocks; mm_flush coalesces them all, in address order.
+ */
+extern void mm_set_deferred(int on);
+extern void mm_flush(void);
+extern void mm_heap_set_deferred(mm_heap_t *h, int on);
+extern void mm_heap_flush(mm_heap_t *h);
+
+/*
+ * Size classes, generated from trace request sizes into sizeclass.h.
+ * mm_size_class rounds a request up to its class (requests above the
+ * largest class are returned unchanged); in class mode every request
+ * is rounded so, trading internal for external fragmentation.
+ */
+extern size_t mm_size_class(size_t size);
+extern int mm_size_classes(const unsigned int **classes);
+extern void mm_set_classes(int on);
+extern void mm_heap_set_classes(mm_heap_t *h, int on);
+
+/*
+ * Address-ordered free blocks. mm_reorder sorts the free index by
+ * address in bounded steps (for idle time) and returns 0 once it is
+ * sorted; mm_set_reorder runs a few steps every n frees instead.
+ */
+extern void mm_set_reorder(int n);
+extern int mm_reorder(size_t steps);
+extern void mm_heap_set_reorder(mm_heap_t *h, int n);
+extern int mm_heap_reorder(mm_heap_t *h, size_t steps);
+
+/*
+ * Relocatable allocations. A handle names a block that mm_compact may
+ * slide towards the bottom of the heap while it is unlocked. mm_hlock
+ * pins the block and returns its address, valid until the matching
+ * mm_hunlock; locks nest. mm_compact does at most about budget bytes
+ * of work per call, resumes where the last call stopped, and trims the
+ * top of the heap when a pass completes. It returns the bytes moved.
+ * Engines that never move blocks treat handles as plain blocks.
+ */
+typedef struct mm_hslot *mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern mm_handle_t mm_hrealloc(mm_handle_t hd, size_t size);
+extern void mm_hfree(mm_handle_t hd);
+extern void *mm_hlock(mm_handle_t hd);
+extern void mm_hunlock(mm_handle_t hd);
+extern size_t mm_compact(size_t budget);
+extern mm_handle_t mm_heap_halloc(mm_heap_t *h, size_t size);
+extern mm_handle_t mm_heap_hrealloc(mm_heap_t *h, mm_handle_t hd, size_t size);
+extern void mm_heap_hfree(mm_heap_t *h, mm_handle_t hd);
+extern size_t mm_heap_compact(mm_heap_t *h, size_t budget);
+
+
+/*
+ * Root objects. A heap remembers one block, its root, from which the
+ * application can find the rest of its data; mm_init clears it.
+ */
+extern void mm_set_root(void *p);
+extern void *mm_root(void);
+extern void mm_heap_set_root(mm_heap_t *h, void *p);
+extern void *mm_heap_root(mm_heap_t *h);
+
+/*
+ * Persistent heaps. mm_heap_open maps the heap kept in the file at
+ * path, or makes one there with room for maxsize bytes if the file is
+ * new. The heap holds offsets rather than addresses, so reopening the
+ * file brings back its blocks, free ones included, and its root
+ * without replaying anything. Settings such as limits and deferred
+ * frees start over, and handles do not survive. mm_heap_sync writes the
+ * heap to disk now; mm_heap_close unmaps it and keeps the file. The
+ * heap is consistent between calls only: a process killed inside one
+ * can leave it damaged, which mm_heap_checkheap on the reopened heap
+ * reports. Only the boundary-tag engine has persistent heaps; the
+ * others return NULL.
+ */
+extern mm_heap_t *mm_heap_open(const char *path, size_t maxsize);
+extern int mm_heap_sync(mm_heap_t *h);
+extern void mm_heap_close(mm_heap_t *h);
+
+/*
+ * Shared heaps. mm_heap_share makes a heap in a memfd that forked
+ * children share; other processes given its fd (mm_heap_fd) map it with
+ * mm_heap_attach, at any address. Any of them may free a block another
+ * allocated. A process-shared robust mutex serializes the calls; if a
+ * process dies holding it and left the heap inconsistent, the heap is
+ * marked broken and further calls fail. Decay purging, deferred frees,
+ * pressure callbacks and handles are not available on shared heaps.
+ * mm_heap_close unmaps the heap from the calling process only. Only
+ * the boundary-tag engine shares heaps; the others return NULL.
+ */
+extern mm_heap_t *mm_heap_share(size_t maxsize);
+extern mm_heap_t *mm_heap_attach(int fd);
+extern int mm_heap_fd(mm_heap_t *h);
 
 /*
  * Students work in teams of one or two.  Teams enter their team name,
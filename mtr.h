@@ -0,0 +1,57 @@
+/*
+ * mtr.h - trace requests and the binary .mtr trace format
+ *
+ * A .rep trace is text, one request per line, and has to be parsed a
+ * token at a time. A .mtr trace holds the same requests the way
+ * mdriver keeps them in memory, so mdriver maps the file and uses it
+ * as is. The layout is
+ *
+ *     mtr_header_t
+ *     traceop_t ops[num_ops]
+ *     int32_t block_regions[num_ids]   region of each block, else 0
+ *
+ * in the byte order of the machine that wrote it. The header records
+ * sizeof(traceop_t), and its magic reads differently in the other byte
+ * order, so a file from an incompatible build is refused, not misread.
+ * mtrconv converts between the two formats.
+ */
+#ifndef __MTR_H_
+#define __MTR_H_
+
+#include <stdint.h>
+
+/*
+ * Characterizes a single trace operation (allocator request). The
+ * region ops create a region (index is the region id), carve block
+ * index out of a region, and destroy a region with all of its blocks.
+ */
+typedef enum {ALLOC, FREE, REALLOC, RNEW, RALLOC, RFREE} RequestType;
+typedef struct {
+    unsigned int type : 3;    /* RequestType of the request */
+    unsigned int index : 29;  /* index for free() to use later */
+    int size;                 /* byte size of alloc/realloc request */
+} traceop_t;
+
+#define MTR_MAX_INDEX ((1U << 29) - 1)  /* largest id an op can hold */
+
+#define MTR_MAGIC   0x3152544dU  /* "MTR1" */
+#define MTR_VERSION 1
+
+typedef struct {
+    uint32_t magic;          /* MTR_MAGIC */
+    uint16_t version;        /* MTR_VERSION */
+    uint16_t opsize;         /* sizeof(traceop_t) */
+    int32_t sugg_heapsize;   /* the four numbers of a .rep header */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+    int32_t num_regions;     /* region ids used (0 if no region ops) */
+    uint32_t reserved;       /* 0; keeps the ops 8-byte aligned */
+} mtr_header_t;
+
+/* Bytes of a .mtr file with this header */
+#define MTR_SIZE(hdr) (sizeof(mtr_header_t) \
+		       + (size_t)(hdr)->num_ops * sizeof(traceop_t) \
+		       + (size_t)(hdr)->num_ids * sizeof(int32_t))
+
+#endif /* __MTR_H_ */
@@ -0,0 +1,611 @@
+/*
+ * mtrconv.c - convert traces between the text (.rep), binary (.mtr)
+ *     and compressed (.mtz) formats, report how well traces compress,
+ *     and generate large synthetic binary traces
+ *
+ * The input format is recognized by its magic number, and the output
+ * format follows the extension of the output file. Without one of
+ * the three extensions, a binary or compressed input becomes text and
+ * a text input becomes binary. Converting a trace there and back gives
+ * the original requests (and header numbers) again.
+ *
+ * The report (-r) gives the size of each trace in every format and
+ * the speed of the .mtz decoder, in MB of decoded .mtr per second.
+ *
+ * The generator writes a random alloc/realloc/free workload with at
+ * most a given number of live blocks, straight to disk, so traces of
+ * hundreds of millions of requests need no more memory than that.
+ *
+ * usage: mtrconv <infile> <outfile>
+ *        mtrconv -r <tracefile>...
+ *        mtrconv -g <ops> [-l <live>] [-s <seed>] <outfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "mtr.h"
+#include "mtz.h"
+
+#define MAXLINE    1024     /* max string size */
+#define DEF_LIVE  10000     /* live blocks at most, by default (-g) */
+#define GEN_BATCH  4096     /* ops buffered per write (-g) */
+#define DECODE_SECS 0.2     /* time each trace is decoded for (-r) */
+
+/* Trace formats */
+enum {REP, MTR, MTZ};
+
+typedef struct {
+    mtr_header_t hdr;
+    traceop_t *ops;
+    int32_t *regions;       /* region of each block id */
+    void *map;              /* the mapped .mtr file, if read from one */
+    size_t map_len;
+} mtrace_t;
+
+static int read_any(const char *path, mtrace_t *t);
+static void read_rep(const char *path, mtrace_t *t);
+static void read_mtr(const char *path, mtrace_t *t);
+static void read_mtz(const char *path, mtrace_t *t);
+static void write_rep(const char *path, mtrace_t *t);
+static void write_mtr(const char *path, mtrace_t *t);
+static void write_mtz(const char *path, mtrace_t *t);
+static void free_mtrace(mtrace_t *t);
+static void report(int n, char **paths);
+static void generate(const char *path, long nops, int maxlive);
+static int gen_size(void);
+static void usage(void);
+static void app_error(const char *msg);
+static void unix_error(const char *msg);
+
+/*
+ * read_any - read a trace in whichever format it is; returns which
+ */
+static int read_any(const char *path, mtrace_t *t)
+{
+    FILE *f;
+    uint32_t magic = 0;
+
+    if ((f = fopen(path, "rb")) == NULL)
+	unix_error(path);
+    if (fread(&magic, sizeof(magic), 1, f) != 1)
+	magic = 0;
+    fclose(f);
+    if (magic == MTR_MAGIC) {
+	read_mtr(path, t);
+	return MTR;
+    }
+    if (magic == MTZ_MAGIC) {
+	read_mtz(path, t);
+	return MTZ;
+    }
+    read_rep(path, t);
+    return REP;
+}
+
+/*
+ * read_rep - parse a text trace
+ */
+static void read_rep(const char *path, mtrace_t *t)
+{
+    FILE *f;
+    char type[MAXLINE];
+    unsigned int index, size, rid;
+    int hdr[4], i, max_region = -1;
+    long n = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+	unix_error(path);
+    for (i = 0; i < 4; i++)
+	if (fscanf(f, "%d", &hdr[i]) != 1)
+	    app_error("bad trace file header");
+    memset(&t->hdr, 0, sizeof(t->hdr));
+    t->hdr.magic = MTR_MAGIC;
+    t->hdr.version = MTR_VERSION;
+    t->hdr.opsize = sizeof(traceop_t);
+    t->hdr.sugg_heapsize = hdr[0];
+    t->hdr.num_ids = hdr[1];
+    t->hdr.num_ops = hdr[2];
+    t->hdr.weight = hdr[3];
+    if (hdr[1] < 0 || hdr[2] < 0 || (unsigned int)hdr[1] > MTR_MAX_INDEX + 1)
+	app_error("trace header out of range");
+    t->ops = (traceop_t *) malloc((size_t)hdr[2] * sizeof(traceop_t));
+    t->regions = (int32_t *) calloc(hdr[1] > 0 ? hdr[1] : 1, sizeof(int32_t));
+    if (t->ops == NULL || t->regions == NULL)
+	app_error("out of memory");
+    t->map = NULL;
+
+    while (fscanf(f, "%s", type) != EOF) {
+	if (n == t->hdr.num_ops)
+	    app_error("more requests than the header says");
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(f, "%u %u", &index, &size) != 2)
+		app_error("bad alloc/realloc request");
+	    t->ops[n].type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    break;
+	case 'f':
+	    if (fscanf(f, "%u", &index) != 1)
+		app_error("bad free request");
+	    t->ops[n].type = FREE;
+	    break;
+	case 'n':
+	case 'd':
+	    if (fscanf(f, "%u", &index) != 1)
+		app_error("bad region request");
+	    t->ops[n].type = (type[0] == 'n') ? RNEW : RFREE;
+	    if ((int)index > max_region)
+		max_region = index;
+	    break;
+	case 'b':
+	    if (fscanf(f, "%u %u %u", &rid, &index, &size) != 3)
+		app_error("bad region alloc request");
+	    t->ops[n].type = RALLOC;
+	    if (index < (unsigned int)t->hdr.num_ids)
+		t->regions[index] = rid;
+	    break;
+	default:
+	    fprintf(stderr, "Bogus type character (%c) in %s\n", type[0], path);
+	    exit(1);
+	}
+	if (index > MTR_MAX_INDEX || (t->ops[n].type != RNEW &&
+				      t->ops[n].type != RFREE &&
+				      index >= (unsigned int)t->hdr.num_ids))
+	    app_error("request id out of range");
+	t->ops[n].index = index;
+	t->ops[n].size = size;
+	n++;
+    }
+    fclose(f);
+    if (n != t->hdr.num_ops)
+	app_error("fewer requests than the header says");
+    t->hdr.num_regions = max_region + 1;
+}
+
+/*
+ * read_mtr - map a binary trace
+ */
+static void read_mtr(const char *path, mtrace_t *t)
+{
+    struct stat st;
+    char *p;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	unix_error(path);
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+	unix_error("mmap");
+    close(fd);
+    memcpy(&t->hdr, p, sizeof(t->hdr));
+    if ((size_t)st.st_size < sizeof(mtr_header_t) ||
+	t->hdr.version != MTR_VERSION || t->hdr.opsize != sizeof(traceop_t) ||
+	t->hdr.num_ids < 0 || t->hdr.num_ops < 0 ||
+	(size_t)st.st_size != MTR_SIZE(&t->hdr))
+	app_error("not a binary trace of this version and build");
+    t->ops = (traceop_t *)(p + sizeof(mtr_header_t));
+    t->regions = (int32_t *)(t->ops + t->hdr.num_ops);
+    t->map = p;
+    t->map_len = st.st_size;
+}
+
+/*
+ * read_mtz - decode a compressed trace
+ */
+static void read_mtz(const char *path, mtrace_t *t)
+{
+    struct stat st;
+    unsigned char *p;
+    mtz_state_t s;
+    int fd, n;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	unix_error(path);
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+	unix_error("mmap");
+    close(fd);
+    memcpy(&t->hdr, p, sizeof(t->hdr));
+    if ((size_t)st.st_size < sizeof(mtr_header_t) + MTZ_MAXOP ||
+	t->hdr.version != MTR_VERSION ||
+	t->hdr.num_ids < 0 || t->hdr.num_ops < 0)
+	app_error("not a compressed trace of this version");
+    t->ops = (traceop_t *) malloc((size_t)t->hdr.num_ops * sizeof(traceop_t));
+    t->regions = (int32_t *) calloc(t->hdr.num_ids > 0 ? t->hdr.num_ids : 1,
+				    sizeof(int32_t));
+    if (t->ops == NULL || t->regions == NULL)
+	app_error("out of memory");
+    t->map = NULL;
+
+    mtz_init(&s);
+    n = t->hdr.num_ops;
+    if (mtz_decode(&s, p + sizeof(mtr_header_t), p + st.st_size, t->ops,
+		   &n, t->regions, t->hdr.num_ids) == NULL ||
+	n != t->hdr.num_ops)
+	app_error("compressed trace is corrupt");
+    munmap(p, st.st_size);
+    t->hdr.magic = MTR_MAGIC;
+    t->hdr.opsize = sizeof(traceop_t);
+}
+
+/*
+ * write_rep - write a trace as text
+ */
+static void write_rep(const char *path, mtrace_t *t)
+{
+    FILE *f;
+    traceop_t *op;
+    long i;
+
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error(path);
+    fprintf(f, "%d\n%d\n%d\n%d\n", t->hdr.sugg_heapsize, t->hdr.num_ids,
+	    t->hdr.num_ops, t->hdr.weight);
+    for (i = 0; i < t->hdr.num_ops; i++) {
+	op = &t->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	    fprintf(f, "a %u %d\n", op->index, op->size);
+	    break;
+	case REALLOC:
+	    fprintf(f, "r %u %d\n", op->index, op->size);
+	    break;
+	case FREE:
+	    fprintf(f, "f %u\n", op->index);
+	    break;
+	case RNEW:
+	    fprintf(f, "n %u\n", op->index);
+	    break;
+	case RALLOC:
+	    fprintf(f, "b %d %u %d\n", t->regions[op->index], op->index,
+		    op->size);
+	    break;
+	case RFREE:
+	    fprintf(f, "d %u\n", op->index);
+	    break;
+	default:
+	    app_error("bad request type in binary trace");
+	}
+    }
+    if (fclose(f) != 0)
+	unix_error(path);
+}
+
+/*
+ * write_mtr - write a trace in binary
+ */
+static void write_mtr(const char *path, mtrace_t *t)
+{
+    FILE *f;
+
+    if ((f = fopen(path, "wb")) == NULL)
+	unix_error(path);
+    if (fwrite(&t->hdr, sizeof(t->hdr), 1, f) != 1 ||
+	fwrite(t->ops, sizeof(traceop_t), t->hdr.num_ops, f)
+	!= (size_t)t->hdr.num_ops ||
+	fwrite(t->regions, sizeof(int32_t), t->hdr.num_ids, f)
+	!= (size_t)t->hdr.num_ids)
+	unix_error(path);
+    if (fclose(f) != 0)
+	unix_error(path);
+}
+
+/*
+ * write_mtz - write a trace compressed
+ */
+static void write_mtz(const char *path, mtrace_t *t)
+{
+    FILE *f;
+    mtr_header_t hdr = t->hdr;
+    mtz_state_t s;
+    unsigned char *buf;
+    size_t len;
+
+    if ((buf = (unsigned char *) malloc(MTZ_BOUND(t->hdr.num_ops))) == NULL)
+	app_error("out of memory");
+    mtz_init(&s);
+    len = mtz_encode(&s, t->ops, t->hdr.num_ops, t->regions, buf)
+	+ MTZ_MAXOP;
+    hdr.magic = MTZ_MAGIC;
+    if ((f = fopen(path, "wb")) == NULL)
+	unix_error(path);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	fwrite(buf, 1, len, f) != len)
+	unix_error(path);
+    if (fclose(f) != 0)
+	unix_error(path);
+    free(buf);
+}
+
+/*
+ * free_mtrace - release what read_any got for a trace
+ */
+static void free_mtrace(mtrace_t *t)
+{
+    if (t->map != NULL)
+	munmap(t->map, t->map_len);
+    else {
+	free(t->ops);
+	free(t->regions);
+    }
+}
+
+/*
+ * report - print the size of each trace in each format, and how fast
+ *     its .mtz form decodes: the best of as many runs as fit in
+ *     DECODE_SECS
+ */
+static void report(int n, char **paths)
+{
+    mtrace_t t;
+    mtz_state_t s;
+    struct stat st;
+    struct timespec t0, t1;
+    unsigned char *buf;
+    traceop_t *ops;
+    size_t len, mtr, text, sum_text = 0, sum_mtr = 0, sum_mtz = 0;
+    double secs, best, spent, sum_secs = 0;
+    int i, k, format;
+
+    printf("%-24s%10s%12s%12s%10s%8s%8s%10s\n", "trace", "ops", "rep bytes",
+	   "mtr bytes", "mtz bytes", "mtr/mtz", "rep/mtz", "dec MB/s");
+    for (i = 0; i < n; i++) {
+	format = read_any(paths[i], &t);
+	if ((buf = (unsigned char *) malloc(MTZ_BOUND(t.hdr.num_ops))) == NULL ||
+	    (ops = (traceop_t *) malloc((t.hdr.num_ops + 1) * sizeof(traceop_t)))
+	    == NULL)
+	    app_error("out of memory");
+	mtz_init(&s);
+	len = mtz_encode(&s, t.ops, t.hdr.num_ops, t.regions, buf) + MTZ_MAXOP;
+	mtr = MTR_SIZE(&t.hdr);
+	text = 0;
+	if (format == REP && stat(paths[i], &st) == 0)
+	    text = st.st_size;
+
+	best = 1e30;
+	for (spent = 0; spent < DECODE_SECS; spent += secs) {
+	    mtz_init(&s);
+	    k = t.hdr.num_ops;
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    if (mtz_decode(&s, buf, buf + len, ops, &k, t.regions,
+			   t.hdr.num_ids) == NULL || k != t.hdr.num_ops)
+		app_error("decoding failed");
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	    if (secs < best)
+		best = secs;
+	}
+	if (memcmp(ops, t.ops, t.hdr.num_ops * sizeof(traceop_t)) != 0)
+	    app_error("decoded requests differ");
+
+	if (text)
+	    printf("%-24s%10d%12lu%12lu%10lu%8.1f%8.1f%10.0f\n", paths[i],
+		   t.hdr.num_ops, (unsigned long)text, (unsigned long)mtr,
+		   (unsigned long)len, (double)mtr / len, (double)text / len,
+		   mtr / best / 1e6);
+	else
+	    printf("%-24s%10d%12s%12lu%10lu%8.1f%8s%10.0f\n", paths[i],
+		   t.hdr.num_ops, "-", (unsigned long)mtr,
+		   (unsigned long)len, (double)mtr / len, "-",
+		   mtr / best / 1e6);
+	sum_text += text;
+	sum_mtr += mtr;
+	sum_mtz += len;
+	sum_secs += best;
+	free(buf);
+	free(ops);
+	free_mtrace(&t);
+    }
+    if (sum_text)
+	printf("%-24s%10s%12lu%12lu%10lu%8.1f%8.1f%10.0f\n", "Total", "",
+	       (unsigned long)sum_text, (unsigned long)sum_mtr,
+	       (unsigned long)sum_mtz, (double)sum_mtr / sum_mtz,
+	       (double)sum_text / sum_mtz, sum_mtr / sum_secs / 1e6);
+    else
+	printf("%-24s%10s%12s%12lu%10lu%8.1f%8s%10.0f\n", "Total", "", "-",
+	       (unsigned long)sum_mtr, (unsigned long)sum_mtz,
+	       (double)sum_mtr / sum_mtz, "-", sum_mtr / sum_secs / 1e6);
+}
+
+/*
+ * gen_size - request size of the synthetic workload: mostly small
+ *     objects, some buffers of a few KB, now and then a big one
+ */
+static int gen_size(void)
+{
+    int r = rand() % 100;
+
+    if (r < 70)
+	return 8 + rand() % 249;
+    if (r < 95)
+	return 256 + rand() % 3841;
+    return 4096 + rand() % 61441;
+}
+
+/*
+ * generate - write a synthetic binary trace of about nops requests.
+ *     Each step allocates a new block (while fewer than maxlive are
+ *     live), reallocates or frees a random live one; whatever is still
+ *     live at the end is freed, so the trace always balances.
+ */
+static void generate(const char *path, long nops, int maxlive)
+{
+    FILE *f;
+    mtr_header_t hdr;
+    traceop_t buf[GEN_BATCH];
+    int32_t zero[GEN_BATCH];
+    int *live, nlive = 0, nbuf = 0, k, r;
+    long done = 0, next = 0, i;
+
+    if ((live = (int *) malloc(maxlive * sizeof(int))) == NULL)
+	app_error("out of memory");
+    if ((f = fopen(path, "wb")) == NULL)
+	unix_error(path);
+    memset(&hdr, 0, sizeof(hdr));
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)   /* filled in at the end */
+	unix_error(path);
+
+#define EMIT(t, i, s) do {						\
+	buf[nbuf].type = (t);						\
+	buf[nbuf].index = (i);						\
+	buf[nbuf].size = (s);						\
+	if (++nbuf == GEN_BATCH) {					\
+	    if (fwrite(buf, sizeof(traceop_t), nbuf, f) != (size_t)nbuf) \
+		unix_error(path);					\
+	    nbuf = 0;							\
+	}								\
+	done++;								\
+    } while (0)
+
+    /* every live block still costs a free, so stop at nops - nlive */
+    while (done + nlive < nops) {
+	r = rand() % 100;
+	if (nlive == 0 || (nlive < maxlive && r < 50 && done + nlive + 2 <= nops)) {
+	    if (next > MTR_MAX_INDEX || next == 0x7fffffff)
+		app_error("too many block ids");
+	    live[nlive++] = next;
+	    EMIT(ALLOC, next, gen_size());
+	    next++;
+	} else if (r < 60) {
+	    EMIT(REALLOC, live[rand() % nlive], gen_size());
+	} else {
+	    k = rand() % nlive;
+	    EMIT(FREE, live[k], 0);
+	    live[k] = live[--nlive];
+	}
+    }
+    while (nlive > 0)
+	EMIT(FREE, live[--nlive], 0);
+#undef EMIT
+    if (nbuf > 0 && fwrite(buf, sizeof(traceop_t), nbuf, f) != (size_t)nbuf)
+	unix_error(path);
+
+    /* no regions */
+    memset(zero, 0, sizeof(zero));
+    for (i = 0; i < next; i += GEN_BATCH) {
+	k = (next - i < GEN_BATCH) ? next - i : GEN_BATCH;
+	if (fwrite(zero, sizeof(int32_t), k, f) != (size_t)k)
+	    unix_error(path);
+    }
+
+    hdr.magic = MTR_MAGIC;
+    hdr.version = MTR_VERSION;
+    hdr.opsize = sizeof(traceop_t);
+    hdr.num_ids = next;
+    hdr.num_ops = done;
+    hdr.weight = 1;
+    if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	unix_error(path);
+    if (fclose(f) != 0)
+	unix_error(path);
+    free(live);
+    printf("%s: %ld ops, %ld ids\n", path, done, next);
+}
+
+int main(int argc, char **argv)
+{
+    mtrace_t t;
+    char *out, *ext;
+    long nops = 0;
+    int maxlive = DEF_LIVE;
+    int ch, rep = 0, in, to;
+
+    while ((ch = getopt(argc, argv, "g:l:s:rh")) != EOF) {
+	switch (ch) {
+	case 'g':
+	    nops = atol(optarg);
+	    break;
+	case 'l':
+	    maxlive = atoi(optarg);
+	    break;
+	case 's':
+	    srand(atoi(optarg));
+	    break;
+	case 'r':
+	    rep = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    if (nops > 0) {
+	if (optind != argc - 1 || maxlive < 1 || nops > 0x7fffffffL) {
+	    usage();
+	    exit(1);
+	}
+	generate(argv[optind], nops, maxlive);
+	return 0;
+    }
+    if (rep) {
+	if (optind == argc) {
+	    usage();
+	    exit(1);
+	}
+	report(argc - optind, argv + optind);
+	return 0;
+    }
+    if (optind != argc - 2) {
+	usage();
+	exit(1);
+    }
+
+    in = read_any(argv[optind], &t);
+    out = argv[optind+1];
+    ext = strrchr(out, '.');
+    if (ext != NULL && strcmp(ext, ".mtz") == 0)
+	to = MTZ;
+    else if (ext != NULL && strcmp(ext, ".mtr") == 0)
+	to = MTR;
+    else if (ext != NULL && strcmp(ext, ".rep") == 0)
+	to = REP;
+    else
+	to = (in == REP) ? MTR : REP;
+    if (to == MTZ)
+	write_mtz(out, &t);
+    else if (to == MTR)
+	write_mtr(out, &t);
+    else
+	write_rep(out, &t);
+    free_mtrace(&t);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtrconv [-h] <infile> <outfile>\n");
+    fprintf(stderr, "       mtrconv -r <tracefile>...\n");
+    fprintf(stderr, "       mtrconv -g <ops> [-l <live>] [-s <seed>] <outfile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-g <ops>   Generate a random binary trace of <ops> requests.\n");
+    fprintf(stderr, "\t-l <live>  Keep at most <live> blocks live (default %d).\n",
+	    DEF_LIVE);
+    fprintf(stderr, "\t-s <seed>  Seed the generator.\n");
+    fprintf(stderr, "\t-r         Report sizes and .mtz decode speed of traces.\n");
+    fprintf(stderr, "<outfile> is written as text, .mtr or .mtz by its extension;\n");
+    fprintf(stderr, "without one, binary input becomes text and text becomes .mtr.\n");
+}
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "mtrconv: %s\n", msg);
+    exit(1);
+}
+
+static void unix_error(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
@@ -0,0 +1,177 @@
+/*
+ * mtz.c - delta and varint coding of trace requests
+ *
+ * See mtz.h for the format. The decoder is a straight loop over the
+ * tag bytes: the common requests (a new block of a recent size, the
+ * free of the block just used) are one byte each, and the padding at
+ * the end lets it read a whole request without checking for the end
+ * of the input in between.
+ */
+#include <string.h>
+
+#include "mtz.h"
+
+/* The id and size fields of a tag byte */
+#define ID_BASE     0
+#define ID_NEXT     1
+#define ID_VARINT   2
+#define SIZE_VARINT 7
+
+/* Requests that carry a size, and those that allocate a new block */
+#define HAS_SIZE(t) ((t) == ALLOC || (t) == REALLOC || (t) == RALLOC)
+#define IS_NEW(t)   ((t) == ALLOC || (t) == RALLOC)
+
+static inline unsigned char *put_varint(unsigned char *p, uint32_t v)
+{
+    while (v >= 0x80) {
+	*p++ = (unsigned char)(v | 0x80);
+	v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/* A varint of at most five bytes; NULL if longer */
+static inline const unsigned char *get_varint(const unsigned char *p,
+					      uint32_t *v)
+{
+    uint32_t x = *p & 0x7f;
+    int shift = 7;
+
+    while (*p++ & 0x80) {
+	if (shift > 28)
+	    return NULL;
+	x |= (uint32_t)(*p & 0x7f) << shift;
+	shift += 7;
+    }
+    *v = x;
+    return p;
+}
+
+/* Signed deltas as unsigned: 0, -1, 1, -2, ... become 0, 1, 2, 3, ... */
+static inline uint32_t zigzag(int32_t d)
+{
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/* Move entry i of the recent-size list to the front, as size */
+static inline void size_to_front(mtz_state_t *s, int i, uint32_t size)
+{
+    for (; i > 0; i--)
+	s->sizes[i] = s->sizes[i-1];
+    s->sizes[0] = size;
+}
+
+void mtz_init(mtz_state_t *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+size_t mtz_encode(mtz_state_t *s, const traceop_t *ops, int n,
+		  const int32_t *block_regions, unsigned char *out)
+{
+    unsigned char *p = out, *tag;
+    uint32_t id, base, size;
+    int i, k, type;
+
+    for (i = 0; i < n; i++) {
+	type = ops[i].type;
+	id = ops[i].index;
+	base = IS_NEW(type) ? s->next_id : s->last_id;
+	tag = p++;
+	*tag = type;
+	if (id == base)
+	    *tag |= ID_BASE << 3;
+	else if (id == base + 1)
+	    *tag |= ID_NEXT << 3;
+	else {
+	    *tag |= ID_VARINT << 3;
+	    p = put_varint(p, zigzag((int32_t)(id - base)));
+	}
+	if (HAS_SIZE(type)) {
+	    size = (uint32_t)ops[i].size;
+	    for (k = 0; k < MTZ_DICT && s->sizes[k] != size; k++)
+		;
+	    if (k < MTZ_DICT)
+		*tag |= k << 5;
+	    else {
+		*tag |= SIZE_VARINT << 5;
+		p = put_varint(p, size);
+		k = MTZ_DICT - 1;
+	    }
+	    size_to_front(s, k, size);
+	}
+	if (type == RALLOC)
+	    p = put_varint(p, (uint32_t)block_regions[id]);
+	if (IS_NEW(type) && id >= s->next_id)
+	    s->next_id = id + 1;
+	s->last_id = id;
+    }
+    memset(p, 0, MTZ_MAXOP);
+    return p - out;
+}
+
+const unsigned char *mtz_decode(mtz_state_t *s, const unsigned char *in,
+				const unsigned char *end, traceop_t *ops,
+				int *n, int32_t *block_regions,
+				uint32_t max_ids)
+{
+    const unsigned char *p = in;
+    uint32_t t, id, v, size;
+    int i, k;
+
+    for (i = 0; i < *n && end - p >= MTZ_MAXOP; i++) {
+	t = *p++;
+	if ((t & 7) > RFREE)
+	    return NULL;
+	id = IS_NEW(t & 7) ? s->next_id : s->last_id;
+	switch ((t >> 3) & 3) {
+	case ID_BASE:
+	    break;
+	case ID_NEXT:
+	    id++;
+	    break;
+	case ID_VARINT:
+	    if ((p = get_varint(p, &v)) == NULL)
+		return NULL;
+	    id += unzigzag(v);
+	    break;
+	default:
+	    return NULL;
+	}
+	if (id > MTR_MAX_INDEX ||
+	    ((t & 7) != RNEW && (t & 7) != RFREE && id >= max_ids))
+	    return NULL;
+	ops[i].type = t & 7;
+	ops[i].index = id;
+	ops[i].size = 0;
+
+	if (HAS_SIZE(t & 7)) {
+	    k = t >> 5;
+	    if (k == SIZE_VARINT) {
+		if ((p = get_varint(p, &size)) == NULL)
+		    return NULL;
+		k = MTZ_DICT - 1;
+	    } else
+		size = s->sizes[k];
+	    size_to_front(s, k, size);
+	    ops[i].size = size;
+	}
+	if ((t & 7) == RALLOC) {
+	    if ((p = get_varint(p, &v)) == NULL)
+		return NULL;
+	    if (block_regions != NULL)
+		block_regions[id] = v;
+	}
+	if (IS_NEW(t & 7) && id >= s->next_id)
+	    s->next_id = id + 1;
+	s->last_id = id;
+    }
+    *n = i;
+    return p;
+}
@@ -0,0 +1,64 @@
+/*
+ * mtz.h - compressed (.mtz) traces: delta and varint coded requests
+ *
+ * A .mtz file is an mtr_header_t with magic MTZ_MAGIC followed by the
+ * coded requests and MTZ_MAXOP bytes of zero padding. Each request is
+ * a tag byte, packing
+ *
+ *     bits 0-2  the RequestType
+ *     bits 3-4  how to find the id: 0 the base, 1 the base plus one,
+ *               2 the base plus a zigzag varint that follows
+ *     bits 5-7  the size, for alloc, realloc and region alloc: 0-6
+ *               the entry of the recent-size list, 7 a varint that
+ *               follows
+ *
+ * and then the varints it calls for, and for a region alloc the
+ * region id as a varint. The base for a new block (alloc or region
+ * alloc) is one past the largest id allocated so far, and for any
+ * other request the id of the request before. The recent-size list
+ * is kept in move-to-front order by encoder and decoder alike.
+ */
+#ifndef __MTZ_H_
+#define __MTZ_H_
+
+#include <stddef.h>
+
+#include "mtr.h"
+
+#define MTZ_MAGIC  0x315a544dU  /* "MTZ1" */
+#define MTZ_DICT   7            /* entries in the recent-size list */
+#define MTZ_MAXOP  16           /* most bytes a request takes */
+
+/* Coder state, the same on both sides after every request */
+typedef struct {
+    uint32_t next_id;           /* one past the largest id allocated */
+    uint32_t last_id;           /* id of the request before */
+    uint32_t sizes[MTZ_DICT];   /* recent sizes, most recent first */
+} mtz_state_t;
+
+/* Bytes that n requests can take coded, padding included */
+#define MTZ_BOUND(n) ((size_t)((n) + 1) * MTZ_MAXOP)
+
+void mtz_init(mtz_state_t *s);
+
+/*
+ * Code the n requests of ops into out (MTZ_BOUND(n) bytes), taking the
+ * region of each region alloc from block_regions. Returns the bytes
+ * written, padding not included.
+ */
+size_t mtz_encode(mtz_state_t *s, const traceop_t *ops, int n,
+		  const int32_t *block_regions, unsigned char *out);
+
+/*
+ * Decode up to *n requests from in while at least MTZ_MAXOP bytes are
+ * left before end, storing the region of each region alloc in
+ * block_regions unless it is NULL. Block ids must be below max_ids.
+ * Sets *n to the requests decoded and returns where decoding stopped,
+ * or NULL if the input is corrupt.
+ */
+const unsigned char *mtz_decode(mtz_state_t *s, const unsigned char *in,
+				const unsigned char *end, traceop_t *ops,
+				int *n, int32_t *block_regions,
+				uint32_t max_ids);
+
+#endif /* __MTZ_H_ */
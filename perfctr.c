@@ -0,0 +1,137 @@
+/*
+ * perfctr.c - hardware event counts through perf_event_open(2)
+ *
+ * The counters are opened disabled, each on its own rather than as a
+ * group, and read with the times they were enabled and running, so
+ * that multiplexed counts can be scaled. Off Linux nothing opens.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perfctr.h"
+
+const char *perf_event_name[PERF_EVENTS] = {
+    "cycles", "instrs", "L1d", "LLC", "dTLB", "branch"
+};
+
+static int fd[PERF_EVENTS] = {-1, -1, -1, -1, -1, -1};
+static char error[128] = "";
+
+#ifdef __linux__
+
+/* Type and config of each event */
+#define CACHE_MISS(c) ((c) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |	\
+		       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} event[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int perf_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = event[i].type;
+	attr.config = event[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd[i] >= 0)
+	    n++;
+	else if (n == 0)
+	    snprintf(error, sizeof(error), "perf_event_open: %s%s",
+		     strerror(errno), (errno == EACCES || errno == EPERM) ?
+		     " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+    }
+    return n;
+}
+
+void perf_start(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	if (fd[i] >= 0) {
+	    ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+}
+
+void perf_stop(double counts[PERF_EVENTS])
+{
+    uint64_t v[3];   /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fd[i] >= 0)
+	    ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PERF_EVENTS; i++) {
+	counts[i] = -1;
+	if (fd[i] < 0 || read(fd[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+	    continue;
+	counts[i] = (double)v[0] * ((double)v[1] / v[2]);
+    }
+}
+
+#else /* !__linux__ */
+
+int perf_open(void)
+{
+    snprintf(error, sizeof(error), "perf_event_open needs Linux");
+    return 0;
+}
+
+void perf_start(void)
+{
+}
+
+void perf_stop(double counts[PERF_EVENTS])
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	counts[i] = -1;
+}
+
+#endif /* __linux__ */
+
+const char *perf_error(void)
+{
+    return error;
+}
+
+void perf_close(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	if (fd[i] >= 0)
+	    close(fd[i]);
+	fd[i] = -1;
+    }
+}
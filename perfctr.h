@@ -0,0 +1,43 @@
+/*
+ * perfctr.h - hardware event counts through perf_event_open(2)
+ *
+ * Every event has a counter of its own, for this thread in user mode
+ * only, so an event the machine cannot count (common in VMs) leaves
+ * the others working. When the kernel has to share the hardware
+ * counters among events, each count is scaled up by the fraction of
+ * the time its event was actually counted.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,     /* L1 data cache read misses */
+    PERF_LLC_MISSES,     /* last level cache misses */
+    PERF_DTLB_MISSES,    /* data TLB read misses */
+    PERF_BRANCH_MISSES,
+    PERF_EVENTS
+};
+
+/* Short name of each event, for table headings */
+extern const char *perf_event_name[PERF_EVENTS];
+
+/* Open the counters. Returns how many could be opened; if none, the
+   reason is in perf_error() */
+int perf_open(void);
+
+/* Why perf_open opened no counters */
+const char *perf_error(void);
+
+/* Zero the open counters and start them */
+void perf_start(void);
+
+/* Stop the counters and store the count of each event in counts,
+   or -1 for an event that is not being counted */
+void perf_stop(double counts[PERF_EVENTS]);
+
+/* Close the counters */
+void perf_close(void);
+
+#endif /* __PERFCTR_H_ */
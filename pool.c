@@ -0,0 +1,90 @@
+/*
+ * pool.c - fixed-size object pools on top of the mm malloc package
+ *
+ * Slabs are obtained from mm_malloc and chained through their first
+ * word so that mm_pool_destroy can return them. The objects in a slab
+ * follow the slab header, rounded up to the pool's alignment, and are
+ * pushed on the free list in reverse so that consecutive gets walk
+ * the slab in address order.
+ */
+#include <stdlib.h>
+
+#include "mm.h"
+#include "pool.h"
+#include "config.h"
+
+#define POOL_SLABSIZE  (1<<12)  /* target slab size (bytes) */
+#define POOL_MINOBJS   16       /* objects per slab, at least */
+
+/* Round n up to a multiple of the power of two a */
+#define ROUNDUP(n, a) (((n) + ((a)-1)) & ~(size_t)((a)-1))
+
+/*
+ * mm_pool_create - Create an empty pool. Objects are at least a
+ *     pointer wide, since free objects hold the free-list link.
+ */
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align)
+{
+    mm_pool_t *p;
+
+    if (align < ALIGNMENT)
+	align = ALIGNMENT;
+    if ((align & (align - 1)) != 0)
+	return NULL;
+    if (obj_size < sizeof(void *))
+	obj_size = sizeof(void *);
+
+    if ((p = (mm_pool_t *) mm_malloc(sizeof(mm_pool_t))) == NULL)
+	return NULL;
+    p->free = NULL;
+    p->slabs = NULL;
+    p->align = align;
+    p->objsize = ROUNDUP(obj_size, align);
+    p->per_slab = POOL_SLABSIZE / p->objsize;
+    if (p->per_slab < POOL_MINOBJS)
+	p->per_slab = POOL_MINOBJS;
+    return p;
+}
+
+/*
+ * mm_pool_refill - Carve a fresh slab into objects, keep the first
+ *     for the caller and put the rest on the free list.
+ */
+void *mm_pool_refill(mm_pool_t *p)
+{
+    char *slab, *obj, *first;
+    int i;
+
+    /*
+     * The slab is ALIGNMENT-aligned and its link is at most ALIGNMENT
+     * bytes wide, so the first object starts within align bytes.
+     */
+    slab = (char *) mm_malloc(p->align + p->objsize * p->per_slab);
+    if (slab == NULL)
+	return NULL;
+    *(void **)slab = p->slabs;
+    p->slabs = slab;
+
+    first = (char *) ROUNDUP((size_t)(slab + sizeof(void *)), p->align);
+    for (i = p->per_slab - 1; i > 0; i--) {
+	obj = first + i * p->objsize;
+	*(void **)obj = p->free;
+	p->free = obj;
+    }
+    return first;
+}
+
+/*
+ * mm_pool_destroy - Free every slab and the pool itself. Objects still
+ *     handed out become invalid.
+ */
+void mm_pool_destroy(mm_pool_t *p)
+{
+    void *slab, *next;
+
+    for (slab = p->slabs; slab != NULL; slab = next) {
+	next = *(void **)slab;
+	mm_free(slab);
+    }
+    mm_free(p);
+}
@@ -0,0 +1,44 @@
+/*
+ * pool.h - fixed-size object pools on top of the mm malloc package
+ *
+ * A pool keeps a LIFO free list threaded through its free objects and
+ * refills it from mm_malloc one slab of many objects at a time. Get
+ * and put are inline and never touch block headers; only an empty
+ * free list falls back to mm_pool_refill.
+ */
+#include <stddef.h>
+
+typedef struct mm_pool {
+    void *free;        /* first free object; each holds the next */
+    void *slabs;       /* slabs obtained from mm_malloc, for destroy */
+    size_t objsize;    /* object stride, a multiple of align */
+    size_t align;      /* object alignment (power of two) */
+    int per_slab;      /* objects carved out of each slab */
+} mm_pool_t;
+
+/* Create a pool of obj_size-byte objects aligned to align (0 = default) */
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align);
+
+/* Return every slab of the pool to mm_free */
+void mm_pool_destroy(mm_pool_t *p);
+
+/* Slow path of mm_pool_get: carve a new slab, return one object */
+void *mm_pool_refill(mm_pool_t *p);
+
+/* Take an object off the free list */
+static inline void *mm_pool_get(mm_pool_t *p)
+{
+    void *obj = p->free;
+
+    if (obj == NULL)
+	return mm_pool_refill(p);
+    p->free = *(void **)obj;
+    return obj;
+}
+
+/* Push an object back on the free list */
+static inline void mm_pool_put(mm_pool_t *p, void *obj)
+{
+    *(void **)obj = p->free;
+    p->free = obj;
+}
@@ -0,0 +1,125 @@
+/*
+ * region.c - region (arena) allocation on top of the mm malloc package
+ *
+ * Each region is a singly linked list of chunks obtained from
+ * mm_malloc. The region descriptor itself lives at the start of the
+ * first chunk, so creating a region costs exactly one mm_malloc call.
+ * Allocation bumps r->cur through the current chunk; requests that
+ * would waste too much of a fresh chunk get a dedicated chunk of their
+ * own. Destroying a region frees its chunks, O(chunks) rather than
+ * O(objects).
+ */
+#include <stdlib.h>
+
+#include "mm.h"
+#include "region.h"
+#include "config.h"
+
+#define REGION_CHUNKSIZE (1<<12)  /* default chunk size (bytes) */
+
+/* Round n up to a multiple of ALIGNMENT */
+#define ALIGN(n) (((n) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+/* Every chunk starts with a link to the previously allocated chunk */
+struct chunk {
+    struct chunk *next;
+};
+#define CHUNK_HDR ALIGN(sizeof(struct chunk))
+
+struct mm_region {
+    char *cur;            /* next free byte in the current chunk */
+    char *end;            /* first byte past the current chunk */
+    struct chunk *chunks; /* most recently allocated chunk */
+    size_t chunksize;     /* bytes requested from mm_malloc per chunk */
+};
+
+/*
+ * new_chunk - Get a chunk with room for size payload bytes and push it
+ *     on the chunk list. Returns a pointer to the chunk's payload.
+ */
+static char *new_chunk(mm_region_t *r, size_t size)
+{
+    struct chunk *c;
+
+    if ((c = (struct chunk *) mm_malloc(CHUNK_HDR + size)) == NULL)
+	return NULL;
+    c->next = r->chunks;
+    r->chunks = c;
+    return (char *)c + CHUNK_HDR;
+}
+
+/*
+ * mm_region_create - Create an empty region. The descriptor is carved
+ *     out of the first chunk.
+ */
+mm_region_t *mm_region_create(size_t chunksize)
+{
+    struct chunk *c;
+    mm_region_t *r;
+
+    if (chunksize == 0)
+	chunksize = REGION_CHUNKSIZE;
+    chunksize = ALIGN(chunksize);
+    if (chunksize < CHUNK_HDR + 2*ALIGN(sizeof(mm_region_t)))
+	chunksize = CHUNK_HDR + 2*ALIGN(sizeof(mm_region_t));
+
+    if ((c = (struct chunk *) mm_malloc(chunksize)) == NULL)
+	return NULL;
+    c->next = NULL;
+    r = (mm_region_t *)((char *)c + CHUNK_HDR);
+    r->chunks = c;
+    r->chunksize = chunksize;
+    r->cur = (char *)r + ALIGN(sizeof(mm_region_t));
+    r->end = (char *)c + chunksize;
+    return r;
+}
+
+/*
+ * region_refill - Slow path of mm_region_alloc: the current chunk is
+ *     exhausted. Large requests (more than a quarter of a chunk) get a
+ *     dedicated chunk so the tail of the current chunk stays usable;
+ *     everything else starts a fresh current chunk.
+ */
+static void *region_refill(mm_region_t *r, size_t asize)
+{
+    size_t payload = r->chunksize - CHUNK_HDR;
+    char *p;
+
+    if (asize > payload / 4)
+	return new_chunk(r, asize);
+
+    if ((p = new_chunk(r, payload)) == NULL)
+	return NULL;
+    r->cur = p + asize;
+    r->end = p + payload;
+    return p;
+}
+
+/*
+ * mm_region_alloc - Bump-allocate an ALIGNMENT-aligned block
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+    size_t asize = ALIGN(size);
+    char *p = r->cur;
+
+    if (asize <= (size_t)(r->end - p)) {
+	r->cur = p + asize;
+	return p;
+    }
+    return region_refill(r, asize);
+}
+
+/*
+ * mm_region_destroy - Free every chunk. The chunk holding the
+ *     descriptor is the oldest one and therefore freed last.
+ */
+void mm_region_destroy(mm_region_t *r)
+{
+    struct chunk *c, *next;
+
+    for (c = r->chunks; c != NULL; c = next) {
+	next = c->next;
+	mm_free(c);
+    }
+}
@@ -0,0 +1,19 @@
+/*
+ * region.h - region (arena) allocation on top of the mm malloc package
+ *
+ * A region hands out memory by bumping a pointer through large chunks
+ * obtained from mm_malloc. Objects carry no header and cannot be freed
+ * one at a time; mm_region_destroy releases every chunk at once.
+ */
+#include <stddef.h>
+
+typedef struct mm_region mm_region_t;
+
+/* Create an empty region that grows in chunks of chunksize bytes (0 = default) */
+mm_region_t *mm_region_create(size_t chunksize);
+
+/* Bump-allocate size bytes from region r, or return NULL */
+void *mm_region_alloc(mm_region_t *r, size_t size);
+
+/* Release r and everything ever allocated from it */
+void mm_region_destroy(mm_region_t *r);
@@ -0,0 +1,552 @@
+/*
+ * tstream.c - read a trace as a stream of fixed-size chunks
+ *
+ * The reader thread owns the file and the id map; the caller owns the
+ * chunk it was last given. The two chunk buffers pass between them
+ * under one mutex: the reader fills a buffer that is empty and marks
+ * it full, tstream_next empties the buffer it handed out before and
+ * waits for the other one to fill.
+ *
+ * The id map is an open-addressing hash table from trace ids to slots,
+ * with linear probing and backward-shift deletion, so it never fills
+ * up with tombstones. It doubles when half full; freed slots go on a
+ * stack, and the most recently freed one is handed out first.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tstream.h"
+#include "mtz.h"
+
+#define MAXLINE     1024        /* max string size */
+#define MAP_MIN     1024        /* initial id map capacity (power of two) */
+#define NO_ID       0xffffffffU /* key of an empty id map entry */
+#define INBUF       (1<<20)     /* bytes of .mtz input read at a time */
+
+/* Trace formats */
+enum {REP, MTR, MTZ};
+
+typedef struct {
+    traceop_t *ops;  /* chunk_ops requests */
+    int n;           /* requests in the chunk */
+    int slots;       /* slots in use by the end of the chunk */
+    int full;        /* filled by the reader, not yet handed back */
+} chunk_t;
+
+struct tstream {
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    chunk_t buf[2];
+    int chunk_ops;
+    int next;            /* buffer the caller gets next */
+    int held;            /* buffer the caller holds, or -1 */
+    int started;         /* the reader thread is running */
+    int done;            /* the reader has filled its last chunk */
+    int failed;          /* ... and err says why it was the last */
+    int stop;            /* tstream_close wants the reader gone */
+    char err[MAXLINE];   /* why the trace ended early, or "" */
+    double waited;       /* seconds spent waiting in tstream_next */
+
+    /* used by the reader only */
+    FILE *f;
+    int format;          /* REP, MTR or MTZ */
+    long ops_left;       /* requests still to read from a .mtr/.mtz file */
+    unsigned char *in;   /* .mtz input buffer, INBUF bytes */
+    unsigned char *pos;  /* ... next byte to decode */
+    unsigned char *end;  /* ... end of the bytes read into it */
+    mtz_state_t mtz;     /* .mtz decoder state */
+    long line;           /* line number in a text file */
+    uint32_t *keys;      /* id map: trace id of each entry, or NO_ID */
+    int32_t *vals;       /* ... and its slot */
+    size_t cap;          /* entries in the id map */
+    int shift;           /* 32 - log2(cap), for hash_id */
+    size_t used;         /* live ids in it */
+    int *free_slots;     /* stack of freed slots */
+    int nfree;
+    int free_cap;        /* room on the stack */
+    int slots;           /* slots handed out so far */
+    size_t bytes;        /* most bytes of buffers and map so far */
+};
+
+static void *reader(void *arg);
+static int fill(tstream_t *ts, chunk_t *c);
+static int read_op(tstream_t *ts, char *type, unsigned long *id,
+		   unsigned long *size);
+static int remap(tstream_t *ts, traceop_t *op, char type,
+		 unsigned long id, unsigned long size);
+static int map_alloc(tstream_t *ts, uint32_t id);
+static int map_find(tstream_t *ts, uint32_t id);
+static int map_free(tstream_t *ts, uint32_t id);
+static int map_grow(tstream_t *ts);
+static void note_bytes(tstream_t *ts);
+
+/* Hash of a trace id: a multiplicative hash, as ids are often dense.
+   Its high bits depend on all of the id; the low bits only on the id's
+   low bits, which would pile strided ids into one probe run. */
+static inline size_t hash_id(tstream_t *ts, uint32_t id)
+{
+    return (size_t)((uint32_t)(id * 2654435761U) >> ts->shift);
+}
+
+/*
+ * tstream_open - open the trace and start the reader. A file that
+ *     begins with the .mtr or .mtz magic is read as a binary or
+ *     compressed trace.
+ */
+tstream_t *tstream_open(const char *path, int chunk_ops)
+{
+    tstream_t *ts;
+    mtr_header_t hdr;
+    int i, h;
+
+    if ((ts = (tstream_t *) calloc(1, sizeof(tstream_t))) == NULL)
+	return NULL;
+    if ((ts->f = fopen(path, "rb")) == NULL) {
+	free(ts);
+	return NULL;
+    }
+    ts->chunk_ops = chunk_ops;
+    ts->held = -1;
+    ts->cap = MAP_MIN;
+    ts->shift = 32 - __builtin_ctz(MAP_MIN);
+    ts->keys = (uint32_t *) malloc(ts->cap * sizeof(uint32_t));
+    ts->vals = (int32_t *) malloc(ts->cap * sizeof(int32_t));
+    for (i = 0; i < 2; i++)
+	ts->buf[i].ops = (traceop_t *) malloc(chunk_ops * sizeof(traceop_t));
+    if (ts->keys == NULL || ts->vals == NULL ||
+	ts->buf[0].ops == NULL || ts->buf[1].ops == NULL) {
+	tstream_close(ts);
+	return NULL;
+    }
+    memset(ts->keys, 0xff, ts->cap * sizeof(uint32_t));
+    note_bytes(ts);
+
+    /* the header: binary, or four numbers of which none is needed */
+    if (fread(&hdr, sizeof(hdr), 1, ts->f) == 1 &&
+	(hdr.magic == MTR_MAGIC || hdr.magic == MTZ_MAGIC)) {
+	ts->format = (hdr.magic == MTR_MAGIC) ? MTR : MTZ;
+	ts->ops_left = hdr.num_ops;
+	if (hdr.version != MTR_VERSION || hdr.opsize != sizeof(traceop_t))
+	    sprintf(ts->err, "%s is not a version %d trace of this build",
+		    path, MTR_VERSION);
+	if (ts->format == MTZ) {
+	    if ((ts->in = (unsigned char *) malloc(INBUF)) == NULL) {
+		tstream_close(ts);
+		return NULL;
+	    }
+	    ts->pos = ts->end = ts->in;
+	    mtz_init(&ts->mtz);
+	    note_bytes(ts);
+	}
+    } else {
+	rewind(ts->f);
+	for (i = 0; i < 4; i++)
+	    if (fscanf(ts->f, "%d", &h) != 1)
+		sprintf(ts->err, "bad trace file header in %s", path);
+	ts->line = 4;
+    }
+    if (ts->err[0] != '\0') {
+	ts->done = 1;
+	return ts;
+    }
+
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->cond, NULL);
+    if (pthread_create(&ts->reader, NULL, reader, ts) != 0) {
+	strcpy(ts->err, "could not start the reader thread");
+	ts->done = 1;
+	return ts;
+    }
+    ts->started = 1;
+    return ts;
+}
+
+/*
+ * tstream_next - hand back the chunk held, then wait for the next
+ */
+traceop_t *tstream_next(tstream_t *ts, int *n, int *slots)
+{
+    struct timespec t0, t1;
+    chunk_t *c = &ts->buf[ts->next];
+    int failed;
+
+    if (!ts->started)
+	return NULL;
+    pthread_mutex_lock(&ts->lock);
+    if (ts->held >= 0) {
+	ts->buf[ts->held].full = 0;
+	ts->held = -1;
+	pthread_cond_broadcast(&ts->cond);
+    }
+    if (!c->full && !ts->done) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (!c->full && !ts->done)
+	    pthread_cond_wait(&ts->cond, &ts->lock);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ts->waited += (t1.tv_sec - t0.tv_sec) +
+	    (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    failed = ts->failed;
+    pthread_mutex_unlock(&ts->lock);
+
+    /* after an error, the chunks before it are not replayed either */
+    if (!c->full || failed)
+	return NULL;
+    ts->held = ts->next;
+    ts->next ^= 1;
+    *n = c->n;
+    *slots = c->slots;
+    return c->ops;
+}
+
+const char *tstream_error(tstream_t *ts)
+{
+    return ts->err[0] != '\0' ? ts->err : NULL;
+}
+
+size_t tstream_bytes(tstream_t *ts)
+{
+    return ts->bytes;
+}
+
+double tstream_waited(tstream_t *ts)
+{
+    return ts->waited;
+}
+
+/*
+ * tstream_close - stop the reader, if it is still going, and free
+ *     everything
+ */
+void tstream_close(tstream_t *ts)
+{
+    if (ts->started) {
+	pthread_mutex_lock(&ts->lock);
+	ts->stop = 1;
+	pthread_cond_broadcast(&ts->cond);
+	pthread_mutex_unlock(&ts->lock);
+	pthread_join(ts->reader, NULL);
+	pthread_mutex_destroy(&ts->lock);
+	pthread_cond_destroy(&ts->cond);
+    }
+    if (ts->f != NULL)
+	fclose(ts->f);
+    free(ts->buf[0].ops);
+    free(ts->buf[1].ops);
+    free(ts->keys);
+    free(ts->vals);
+    free(ts->free_slots);
+    free(ts->in);
+    free(ts);
+}
+
+/*
+ * reader - the reader thread: fill the two buffers in turn until the
+ *     trace ends, fails, or the stream is closed
+ */
+static void *reader(void *arg)
+{
+    tstream_t *ts = (tstream_t *)arg;
+    chunk_t *c;
+    int i = 0, more = 1, stop;
+
+    while (more) {
+	c = &ts->buf[i];
+	pthread_mutex_lock(&ts->lock);
+	while (c->full && !ts->stop)
+	    pthread_cond_wait(&ts->cond, &ts->lock);
+	stop = ts->stop;
+	pthread_mutex_unlock(&ts->lock);
+	if (stop)
+	    break;
+
+	more = fill(ts, c);
+
+	pthread_mutex_lock(&ts->lock);
+	c->full = (c->n > 0);
+	if (!more) {
+	    ts->done = 1;
+	    ts->failed = (ts->err[0] != '\0');
+	}
+	pthread_cond_broadcast(&ts->cond);
+	pthread_mutex_unlock(&ts->lock);
+	i ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * fill - read the next chunk, remapping ids to slots. Returns 0 once
+ *     the trace has ended or failed.
+ */
+static int fill(tstream_t *ts, chunk_t *c)
+{
+    static const char types[] = "afrnbd";  /* by RequestType */
+    traceop_t *op;
+    unsigned long id, size;
+    long want;
+    size_t left;
+    int k;
+    char type;
+
+    c->n = 0;
+    if (ts->format == MTR) {
+	/* read the chunk as is */
+	want = ts->ops_left < ts->chunk_ops ? ts->ops_left : ts->chunk_ops;
+	c->n = fread(c->ops, sizeof(traceop_t), want, ts->f);
+	ts->ops_left -= c->n;
+	if (c->n < want)
+	    strcpy(ts->err, "binary trace ends early");
+    } else if (ts->format == MTZ) {
+	/* decode the chunk, topping the input up as it runs low */
+	while (c->n < ts->chunk_ops && ts->ops_left > 0) {
+	    if (ts->end - ts->pos < MTZ_MAXOP && !feof(ts->f)) {
+		left = ts->end - ts->pos;
+		memmove(ts->in, ts->pos, left);
+		ts->pos = ts->in;
+		ts->end = ts->in + left +
+		    fread(ts->in + left, 1, INBUF - left, ts->f);
+	    }
+	    k = ts->chunk_ops - c->n;
+	    if (k > ts->ops_left)
+		k = ts->ops_left;
+	    ts->pos = (unsigned char *)
+		mtz_decode(&ts->mtz, ts->pos, ts->end, c->ops + c->n, &k,
+			   NULL, NO_ID);
+	    if (ts->pos == NULL || (k == 0 && feof(ts->f))) {
+		strcpy(ts->err, ts->pos == NULL ? "compressed trace is corrupt"
+		       : "compressed trace ends early");
+		ts->pos = ts->end;
+		break;
+	    }
+	    c->n += k;
+	    ts->ops_left -= k;
+	}
+    }
+    if (ts->format != REP) {
+	/* remap the requests in place */
+	for (op = c->ops; op < c->ops + c->n; op++) {
+	    ts->line++;
+	    type = op->type < 6 ? types[op->type] : '?';
+	    if (remap(ts, op, type, op->index, op->size) < 0)
+		return 0;
+	}
+    } else {
+	while (c->n < ts->chunk_ops && read_op(ts, &type, &id, &size) > 0) {
+	    if (remap(ts, &c->ops[c->n], type, id, size) < 0)
+		return 0;
+	    c->n++;
+	}
+    }
+    c->slots = ts->slots;
+    return c->n == ts->chunk_ops && ts->err[0] == '\0';
+}
+
+/*
+ * remap - turn request type, trace id and size into an op on a slot
+ */
+static int remap(tstream_t *ts, traceop_t *op, char type,
+		 unsigned long id, unsigned long size)
+{
+    int slot;
+
+    if (id >= NO_ID) {
+	sprintf(ts->err, "id %lu too large (line %ld)", id, ts->line);
+	return -1;
+    }
+    switch (type) {
+    case 'a':
+	slot = map_alloc(ts, id);
+	op->type = ALLOC;
+	break;
+    case 'r':
+	slot = map_find(ts, id);
+	op->type = REALLOC;
+	break;
+    case 'f':
+	slot = map_free(ts, id);
+	op->type = FREE;
+	break;
+    default:
+	sprintf(ts->err, "region requests cannot be streamed (line %ld)",
+		ts->line);
+	return -1;
+    }
+    if (slot < 0) {
+	if (ts->err[0] == '\0')
+	    sprintf(ts->err, "id %lu is %s (line %ld)", id,
+		    type == 'a' ? "allocated twice" : "not allocated",
+		    ts->line);
+	return -1;
+    }
+    op->index = slot;
+    op->size = size;
+    return 0;
+}
+
+/*
+ * read_op - read one request of a text trace: 1 if read, 0 at the end
+ *     of the trace, -1 on an error
+ */
+static int read_op(tstream_t *ts, char *type, unsigned long *id,
+		   unsigned long *size)
+{
+    char line[MAXLINE], *p, *q;
+
+    do {
+	if (fgets(line, MAXLINE, ts->f) == NULL)
+	    return 0;
+	ts->line++;
+	for (p = line; *p == ' ' || *p == '\t'; p++)
+	    ;
+    } while (*p == '\n' || *p == '\0');
+
+    *type = *p++;
+    *id = strtoul(p, &q, 10);
+    if (q == p) {
+	sprintf(ts->err, "bad request (line %ld)", ts->line);
+	return -1;
+    }
+    *size = 0;
+    if (*type == 'a' || *type == 'r') {
+	p = q;
+	*size = strtoul(p, &q, 10);
+	if (q == p) {
+	    sprintf(ts->err, "bad alloc/realloc request (line %ld)", ts->line);
+	    return -1;
+	}
+    }
+    return 1;
+}
+
+/*
+ * map_alloc - give a newly allocated id a slot; -1 if already live
+ */
+static int map_alloc(tstream_t *ts, uint32_t id)
+{
+    size_t i;
+    int slot;
+
+    if (2 * (ts->used + 1) > ts->cap && map_grow(ts) < 0)
+	return -1;
+    for (i = hash_id(ts, id); ts->keys[i] != NO_ID; i = (i + 1) & (ts->cap - 1))
+	if (ts->keys[i] == id)
+	    return -1;
+    slot = ts->nfree > 0 ? ts->free_slots[--ts->nfree] : ts->slots++;
+    ts->keys[i] = id;
+    ts->vals[i] = slot;
+    ts->used++;
+    return slot;
+}
+
+/*
+ * map_find - slot of a live id, or -1
+ */
+static int map_find(tstream_t *ts, uint32_t id)
+{
+    size_t i;
+
+    for (i = hash_id(ts, id); ts->keys[i] != NO_ID; i = (i + 1) & (ts->cap - 1))
+	if (ts->keys[i] == id)
+	    return ts->vals[i];
+    return -1;
+}
+
+/*
+ * map_free - drop a live id and free its slot, which it returns; -1
+ *     if the id is not live. The entries after it in its run move
+ *     back into the hole wherever their home position allows.
+ */
+static int map_free(tstream_t *ts, uint32_t id)
+{
+    size_t i, j, home, mask = ts->cap - 1;
+    int slot, *s;
+
+    for (i = hash_id(ts, id); ts->keys[i] != id; i = (i + 1) & mask)
+	if (ts->keys[i] == NO_ID)
+	    return -1;
+    slot = ts->vals[i];
+
+    for (j = (i + 1) & mask; ts->keys[j] != NO_ID; j = (j + 1) & mask) {
+	home = hash_id(ts, ts->keys[j]);
+	/* move j to i unless its home lies cyclically in (i, j] */
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    ts->keys[i] = ts->keys[j];
+	    ts->vals[i] = ts->vals[j];
+	    i = j;
+	}
+    }
+    ts->keys[i] = NO_ID;
+    ts->used--;
+
+    /* freed slots are reused most recent first */
+    if (ts->nfree == ts->free_cap) {
+	ts->free_cap = ts->free_cap ? 2 * ts->free_cap : MAP_MIN;
+	if ((s = (int *) realloc(ts->free_slots,
+				 ts->free_cap * sizeof(int))) == NULL) {
+	    strcpy(ts->err, "out of memory for the slot stack");
+	    return -1;
+	}
+	ts->free_slots = s;
+	note_bytes(ts);
+    }
+    ts->free_slots[ts->nfree++] = slot;
+    return slot;
+}
+
+/*
+ * map_grow - double the id map
+ */
+static int map_grow(tstream_t *ts)
+{
+    uint32_t *keys = ts->keys;
+    int32_t *vals = ts->vals;
+    size_t i, j, cap = ts->cap;
+
+    if (ts->shift == 0) {
+	strcpy(ts->err, "too many live ids for the id map");
+	return -1;
+    }
+    ts->cap = 2 * cap;
+    ts->shift--;
+    ts->keys = (uint32_t *) malloc(ts->cap * sizeof(uint32_t));
+    ts->vals = (int32_t *) malloc(ts->cap * sizeof(int32_t));
+    if (ts->keys == NULL || ts->vals == NULL) {
+	strcpy(ts->err, "out of memory for the id map");
+	free(keys);
+	free(vals);
+	return -1;
+    }
+    memset(ts->keys, 0xff, ts->cap * sizeof(uint32_t));
+    for (i = 0; i < cap; i++) {
+	if (keys[i] == NO_ID)
+	    continue;
+	for (j = hash_id(ts, keys[i]); ts->keys[j] != NO_ID;
+	     j = (j + 1) & (ts->cap - 1))
+	    ;
+	ts->keys[j] = keys[i];
+	ts->vals[j] = vals[i];
+    }
+    free(keys);
+    free(vals);
+    note_bytes(ts);
+    return 0;
+}
+
+/*
+ * note_bytes - update the most bytes taken by buffers, map and stack
+ */
+static void note_bytes(tstream_t *ts)
+{
+    size_t bytes;
+
+    bytes = 2 * ts->chunk_ops * sizeof(traceop_t) +
+	ts->cap * (sizeof(uint32_t) + sizeof(int32_t)) +
+	ts->free_cap * sizeof(int) + (ts->in != NULL ? INBUF : 0);
+    if (bytes > ts->bytes)
+	ts->bytes = bytes;
+}
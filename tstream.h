@@ -0,0 +1,38 @@
+/*
+ * tstream.h - read a trace as a stream of fixed-size chunks
+ *
+ * A reader thread parses the trace (text, .mtr or .mtz) into one of
+ * two chunk buffers while the caller replays the other, so a trace of
+ * any length is replayed in constant memory plus what its live blocks
+ * need. Block ids are remapped on the way: every block gets a slot
+ * that no live block holds, so the caller's block table only grows to
+ * the largest number of blocks live at once, not to the number of ids
+ * in the trace. Region requests cannot be streamed.
+ */
+#include <stddef.h>
+
+#include "mtr.h"
+
+typedef struct tstream tstream_t;
+
+/* Start reading the trace at path in chunks of chunk_ops requests */
+tstream_t *tstream_open(const char *path, int chunk_ops);
+
+/*
+ * Hand back the previous chunk and return the next one, waiting for
+ * the reader if need be: *n requests, whose indexes are slots below
+ * *slots. Returns NULL at the end of the trace or on an error.
+ */
+traceop_t *tstream_next(tstream_t *ts, int *n, int *slots);
+
+/* Why the stream ended early, or NULL if it did not */
+const char *tstream_error(tstream_t *ts);
+
+/* Most bytes the stream's buffers and id map have taken up */
+size_t tstream_bytes(tstream_t *ts);
+
+/* Seconds tstream_next has spent waiting for the reader */
+double tstream_waited(tstream_t *ts);
+
+/* Stop the reader and free the stream */
+void tstream_close(tstream_t *ts);